@@ -1,15 +1,74 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "buffer.h"
 
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#if defined(__x86_64__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+static void
+buffer_journal_clear(GArray *journals)
+{
+    for (guint i = 0; i < journals->len; i++) {
+        g_array_free(g_array_index(journals, journal_t, i).replaced, TRUE);
+    }
+
+    g_array_set_size(journals, 0);
+}
+
+static void
+buffer_snapshots_clear(GArray *snapshots)
+{
+    for (guint i = 0; i < snapshots->len; i++) {
+        snapshot_t *snapshot = &g_array_index(snapshots, snapshot_t, i);
+        g_free(snapshot->name);
+        g_array_free(snapshot->pieces, TRUE);
+    }
+
+    g_array_set_size(snapshots, 0);
+}
+
+// Starts the buffer as the bytes of its mapping, with no edits.
+//
+static void
+buffer_reset(buffer_t *buffer)
+{
+    g_array_set_size(buffer->pieces, 0);
+    if (buffer->size > 0) {
+        piece_t piece = {
+            .size = buffer->size,
+        };
+        g_array_append_val(buffer->pieces, piece);
+    }
+
+    buffer_journal_clear(buffer->undo);
+    buffer_journal_clear(buffer->redo);
+    buffer_snapshots_clear(buffer->snapshots);
+    g_ptr_array_set_size(buffer->blocks, 0);
+    buffer->block = NULL;
+    buffer->block_free = 0;
+    buffer->modified = 0;
+}
 
 void
 buffer_from_data(buffer_t *buffer, const uint8_t *data, size_t size)
 {
     buffer->data = (uint8_t*) data;
+    buffer->data_size = size;
     buffer->size = size;
     buffer->path = NULL;
     buffer->f = -1;
@@ -17,9 +76,26 @@ buffer_from_data(buffer_t *buffer, const uint8_t *data, size_t size)
     buffer->end_mark = -1;
     buffer->cursor = 0;
     buffer->comments = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+    buffer->symbols = g_hash_table_new(g_str_hash, g_str_equal);
     buffer->highlights = NULL;
     buffer->bookmarks_head = -1;
     buffer->editable = 0;
+    buffer->failed = 0;
+    buffer->edits = 0;
+    buffer->names = 0;
+    buffer->pieces = g_array_new(FALSE, FALSE, sizeof(piece_t));
+    buffer->blocks = g_ptr_array_new_with_free_func(g_free);
+    buffer->undo = g_array_new(FALSE, FALSE, sizeof(journal_t));
+    buffer->redo = g_array_new(FALSE, FALSE, sizeof(journal_t));
+    buffer->snapshots = g_array_new(FALSE, FALSE, sizeof(snapshot_t));
+    buffer->recorder = NULL;
+    buffer->recorder_data = NULL;
+    buffer->clipboard = g_array_new(FALSE, FALSE, sizeof(piece_t));
+    buffer->clipboard_size = 0;
+    buffer->clipboard_blocks = g_ptr_array_new_with_free_func(g_free);
+    buffer->clipboard_owned = 0;
+    buffer_reset(buffer);
+    g_rw_lock_init(&buffer->lock);
 }
 
 int
@@ -51,14 +127,32 @@ buffer_open(buffer_t *buffer, const char *path)
     }
 
     buffer->data = data;
+    buffer->data_size = status.st_size;
     buffer->path = strdup(path);
     buffer->start_mark = -1;
     buffer->end_mark = -1;
     buffer->cursor = 0;
     buffer->comments = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+    buffer->symbols = g_hash_table_new(g_str_hash, g_str_equal);
     buffer->highlights = NULL;
     buffer->bookmarks_head = -1;
     buffer->editable = 0;
+    buffer->failed = 0;
+    buffer->edits = 0;
+    buffer->names = 0;
+    buffer->pieces = g_array_new(FALSE, FALSE, sizeof(piece_t));
+    buffer->blocks = g_ptr_array_new_with_free_func(g_free);
+    buffer->undo = g_array_new(FALSE, FALSE, sizeof(journal_t));
+    buffer->redo = g_array_new(FALSE, FALSE, sizeof(journal_t));
+    buffer->snapshots = g_array_new(FALSE, FALSE, sizeof(snapshot_t));
+    buffer->recorder = NULL;
+    buffer->recorder_data = NULL;
+    buffer->clipboard = g_array_new(FALSE, FALSE, sizeof(piece_t));
+    buffer->clipboard_size = 0;
+    buffer->clipboard_blocks = g_ptr_array_new_with_free_func(g_free);
+    buffer->clipboard_owned = 0;
+    buffer_reset(buffer);
+    g_rw_lock_init(&buffer->lock);
     return 0;
 error:
     if (f > 0) {
@@ -72,16 +166,26 @@ int
 buffer_close(buffer_t *buffer)
 {
     if (buffer->f < 0) {
+        buffer_reset(buffer);
+        g_array_free(buffer->pieces, TRUE);
+        g_ptr_array_unref(buffer->blocks);
+        g_array_free(buffer->undo, TRUE);
+        g_array_free(buffer->redo, TRUE);
+        g_array_free(buffer->snapshots, TRUE);
+        g_array_free(buffer->clipboard, TRUE);
+        g_ptr_array_unref(buffer->clipboard_blocks);
+        g_hash_table_unref(buffer->symbols);
         g_hash_table_unref(buffer->comments);
         if (buffer->highlights) {
             g_slist_free_full(buffer->highlights, g_free);
         }
+        g_rw_lock_clear(&buffer->lock);
         return 0;
     }
 
     int status = 0;
 
-    if (munmap(buffer->data, buffer->size) != 0) {
+    if (munmap(buffer->data, buffer->data_size) != 0) {
         perror("munmap");
         status = 1;
     }
@@ -91,20 +195,31 @@ buffer_close(buffer_t *buffer)
         status = 1;
     }
 
+    buffer_reset(buffer);
+    g_array_free(buffer->pieces, TRUE);
+    g_ptr_array_unref(buffer->blocks);
+    g_array_free(buffer->undo, TRUE);
+    g_array_free(buffer->redo, TRUE);
+    g_array_free(buffer->snapshots, TRUE);
+    g_array_free(buffer->clipboard, TRUE);
+    g_ptr_array_unref(buffer->clipboard_blocks);
+    g_hash_table_unref(buffer->symbols);
     g_hash_table_unref(buffer->comments);
     if (buffer->highlights) {
         g_slist_free_full(buffer->highlights, g_free);
     }
     free((void*) buffer->path);
+    g_rw_lock_clear(&buffer->lock);
     return status;
 }
 
 int
 buffer_try_reopen(buffer_t *buffer)
 {
-    // Not possible to reopen a in-memory buffer.
+    // Not possible to reopen a in-memory buffer, or one left by a failed
+    // save.
     //
-    if (buffer->path == NULL) {
+    if (buffer->path == NULL || buffer->failed) {
         return 1;
     }
 
@@ -121,188 +236,2140 @@ buffer_try_reopen(buffer_t *buffer)
         return 1;
     }
 
-    uint8_t *data = mmap(NULL, status.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, f, 0);
+    // Edits are kept apart until saved, but the mapping is shared so that it
+    // sees the bytes saved.
+    //
+    uint8_t *data = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, f, 0);
     if (data == MAP_FAILED) {
         close(f);
         return 1;
     }
 
-    (void) munmap(buffer->data, buffer->size);
+    g_rw_lock_writer_lock(&buffer->lock);
+
+    (void) munmap(buffer->data, buffer->data_size);
     (void) close(buffer->f);
 
     buffer->data = data;
+    buffer->data_size = status.st_size;
     buffer->f = f;
-    buffer->size = status.st_size;
     buffer->editable = 1;
+
+    g_rw_lock_writer_unlock(&buffer->lock);
     return 0;
 }
 
 int
 buffer_read(buffer_t *buffer, void *data, size_t size)
 {
-    if (buffer->cursor + size > buffer->size) {
-        return 1;
+    return buffer_read_at(buffer, buffer->cursor, data, size);
+}
+
+// Returns the index of the piece of pieces containing address, which MUST be in
+// bounds.
+//
+static guint
+buffer_find_piece(const GArray *pieces, uint64_t address)
+{
+    guint low = 0;
+    guint high = pieces->len;
+    while (high - low > 1) {
+        guint middle = low + (high - low) / 2;
+        if (g_array_index(pieces, piece_t, middle).start <= address) {
+            low = middle;
+        } else {
+            high = middle;
+        }
     }
 
-    memcpy(data, &buffer->data[buffer->cursor], size);
-    return 0;
+    return low;
 }
 
-int
-buffer_read_u8(buffer_t *buffer, uint8_t *data)
+// Returns the index of the piece containing address, which MUST be in bounds.
+//
+static guint
+buffer_piece(buffer_t *buffer, uint64_t address)
 {
-    return buffer_read(buffer, data, sizeof(*data));
+    return buffer_find_piece(buffer->pieces, address);
 }
 
-int
-buffer_read_i8(buffer_t *buffer, int8_t *data)
+const uint8_t*
+buffer_span(buffer_t *buffer, uint64_t address, uint64_t *size)
 {
-    return buffer_read(buffer, data, sizeof(*data));
+    if (address >= buffer->size) {
+        return NULL;
+    }
+
+    const piece_t *piece = &g_array_index(buffer->pieces, piece_t, buffer_piece(buffer, address));
+    const uint8_t *data = piece->data != NULL ? piece->data : buffer->data + piece->source;
+
+    *size = piece->start + piece->size - address;
+    return data + (address - piece->start);
 }
 
 int
-buffer_read_lu16(buffer_t *buffer, uint16_t *data)
+buffer_read_at(buffer_t *buffer, uint64_t address, void *data, size_t size)
 {
-    uint8_t v[sizeof(*data)];
-    if (buffer_read(buffer, v, sizeof(v))) {
+    if (address > buffer->size || size > buffer->size - address) {
         return 1;
     }
 
-    *data = (uint16_t) v[0] | (uint16_t) v[1] << 8;
+    uint8_t *bytes = (uint8_t*) data;
+    for (size_t done = 0; done < size;) {
+        uint64_t available;
+        const uint8_t *span = buffer_span(buffer, address + done, &available);
+
+        size_t chunk = MIN(available, size - done);
+        memcpy(bytes + done, span, chunk);
+        done += chunk;
+    }
+
     return 0;
 }
 
-int
-buffer_read_bu16(buffer_t *buffer, uint16_t *data)
+// Sizes of the blocks holding the bytes added by edits. Small edits share a
+// block, larger ones get their own.
+//
+#define BUFFER_BLOCK_SIZE (64 * 1024)
+
+// Returns storage for size bytes of an edit, freed once the buffer is saved or
+// closed.
+//
+static uint8_t*
+buffer_alloc(buffer_t *buffer, size_t size)
 {
-    uint8_t v[sizeof(*data)];
-    if (buffer_read(buffer, v, sizeof(v))) {
+    if (size > BUFFER_BLOCK_SIZE / 4) {
+        uint8_t *block = g_malloc(size);
+        g_ptr_array_add(buffer->blocks, block);
+        return block;
+    }
+
+    if (size > buffer->block_free) {
+        buffer->block = g_malloc(BUFFER_BLOCK_SIZE);
+        buffer->block_free = BUFFER_BLOCK_SIZE;
+        g_ptr_array_add(buffer->blocks, buffer->block);
+    }
+
+    uint8_t *data = buffer->block;
+    buffer->block += size;
+    buffer->block_free -= size;
+    return data;
+}
+
+// Splits the piece containing address so that a piece starts there. Returns its
+// index, or the number of pieces if address is the size of the buffer.
+//
+static guint
+buffer_split(buffer_t *buffer, uint64_t address)
+{
+    if (address == buffer->size) {
+        return buffer->pieces->len;
+    }
+
+    guint i = buffer_piece(buffer, address);
+    piece_t *piece = &g_array_index(buffer->pieces, piece_t, i);
+    if (piece->start == address) {
+        return i;
+    }
+
+    uint64_t offset = address - piece->start;
+    piece_t right = {
+        .start = address,
+        .size = piece->size - offset,
+        .data = piece->data != NULL ? piece->data + offset : NULL,
+        .source = piece->source + offset,
+    };
+
+    piece->size = offset;
+    g_array_insert_val(buffer->pieces, i + 1, right);
+    return i + 1;
+}
+
+// Merges the piece at index into the one before, if its bytes follow on.
+//
+static void
+buffer_merge(buffer_t *buffer, guint index)
+{
+    if (index == 0 || index >= buffer->pieces->len) {
+        return;
+    }
+
+    piece_t *left = &g_array_index(buffer->pieces, piece_t, index - 1);
+    piece_t *right = &g_array_index(buffer->pieces, piece_t, index);
+    if ((left->data == NULL) != (right->data == NULL)) {
+        return;
+    }
+
+    if (left->data != NULL ? left->data + left->size == right->data : left->source + left->size == right->source) {
+        left->size += right->size;
+        g_array_remove_index(buffer->pieces, index);
+    }
+}
+
+// Replaces the pieces of the range [address, address + size) with pieces of
+// new_size bytes in all, and appends those replaced to replaced. The starts of
+// both are relative to address.
+//
+static void
+buffer_splice(buffer_t *buffer, uint64_t address, uint64_t size, const piece_t *pieces, guint pieces_size,
+        uint64_t new_size, GArray *replaced)
+{
+    g_rw_lock_writer_lock(&buffer->lock);
+
+    guint first = buffer_split(buffer, address);
+    guint last = buffer_split(buffer, address + size);
+    for (guint i = first; i < last; i++) {
+        piece_t piece = g_array_index(buffer->pieces, piece_t, i);
+        piece.start -= address;
+        g_array_append_val(replaced, piece);
+    }
+
+    g_array_remove_range(buffer->pieces, first, last - first);
+    g_array_insert_vals(buffer->pieces, first, pieces, pieces_size);
+
+    for (guint i = first; i < buffer->pieces->len; i++) {
+        piece_t *piece = &g_array_index(buffer->pieces, piece_t, i);
+        piece->start += i < first + pieces_size ? address : new_size - size;
+    }
+
+    buffer->size += new_size - size;
+
+    buffer_merge(buffer, first + pieces_size);
+    buffer_merge(buffer, first);
+
+    // Bytes past an edit that changes the size all move.
+    //
+    int i = buffer->edits++ % BUFFER_EDITS;
+    buffer->edit_start[i] = address;
+    buffer->edit_end[i] = new_size == size ? address + size : UINT64_MAX;
+    buffer->modified = 1;
+
+    g_rw_lock_writer_unlock(&buffer->lock);
+
+    if (buffer->recorder != NULL) {
+        buffer->recorder(buffer->recorder_data, address, size, pieces, pieces_size);
+    }
+}
+
+// Replaces a range as an edit that can be undone.
+//
+static void
+buffer_edit(buffer_t *buffer, uint64_t address, uint64_t size, const piece_t *pieces, guint pieces_size,
+        uint64_t new_size)
+{
+    journal_t journal = {
+        .address = address,
+        .size = new_size,
+        .replaced_size = size,
+        .replaced = g_array_new(FALSE, FALSE, sizeof(piece_t)),
+    };
+
+    buffer_splice(buffer, address, size, pieces, pieces_size, new_size, journal.replaced);
+    g_array_append_val(buffer->undo, journal);
+    buffer_journal_clear(buffer->redo);
+}
+
+// Reverts the last edit of from, and adds the edit reverting that to to.
+//
+static int
+buffer_revert(buffer_t *buffer, GArray *from, GArray *to, uint64_t *address)
+{
+    if (from->len == 0) {
         return 1;
     }
 
-    *data = (uint16_t) v[1] | (uint16_t) v[0] << 8;
+    journal_t journal = g_array_index(from, journal_t, from->len - 1);
+    g_array_set_size(from, from->len - 1);
+
+    journal_t reverted = {
+        .address = journal.address,
+        .size = journal.replaced_size,
+        .replaced_size = journal.size,
+        .replaced = g_array_new(FALSE, FALSE, sizeof(piece_t)),
+    };
+
+    buffer_splice(buffer, journal.address, journal.size, (const piece_t*) journal.replaced->data,
+            journal.replaced->len, journal.replaced_size, reverted.replaced);
+    g_array_append_val(to, reverted);
+    g_array_free(journal.replaced, TRUE);
+
+    *address = journal.address;
     return 0;
 }
 
 int
-buffer_read_lu32(buffer_t *buffer, uint32_t *data)
+buffer_write(buffer_t *buffer, uint64_t address, const void *data, size_t size)
 {
-    uint8_t v[sizeof(*data)];
-    if (buffer_read(buffer, v, sizeof(v))) {
+    if (address > buffer->size || size > buffer->size - address) {
         return 1;
     }
 
-    *data = (uint32_t) v[0] | (uint32_t) v[1] << 8 | (uint32_t) v[2] << 16 | (uint32_t) v[3] << 24;
+    if (size == 0) {
+        return 0;
+    }
+
+    uint8_t *bytes = buffer_alloc(buffer, size);
+    memcpy(bytes, data, size);
+
+    piece_t piece = {
+        .size = size,
+        .data = bytes,
+    };
+    buffer_edit(buffer, address, size, &piece, 1, size);
     return 0;
 }
 
 int
-buffer_read_bu32(buffer_t *buffer, uint32_t *data)
+buffer_insert(buffer_t *buffer, uint64_t address, const void *data, size_t size)
 {
-    uint8_t v[sizeof(*data)];
-    if (buffer_read(buffer, v, sizeof(v))) {
+    if (address > buffer->size) {
         return 1;
     }
 
-    *data = (uint32_t) v[3] | (uint32_t) v[2] << 8 | (uint32_t) v[1] << 16 | (uint32_t) v[0] << 24;
+    if (size == 0) {
+        return 0;
+    }
+
+    uint8_t *bytes = buffer_alloc(buffer, size);
+    memcpy(bytes, data, size);
+
+    piece_t piece = {
+        .size = size,
+        .data = bytes,
+    };
+    buffer_edit(buffer, address, 0, &piece, 1, size);
     return 0;
 }
 
 int
-buffer_read_lu64(buffer_t *buffer, uint64_t *data)
+buffer_apply(buffer_t *buffer, uint64_t address, uint64_t size, const piece_t *pieces, guint pieces_size)
 {
-    uint8_t v[sizeof(*data)];
-    if (buffer_read(buffer, v, sizeof(v))) {
+    if (address > buffer->size || size > buffer->size - address) {
         return 1;
     }
 
-    *data = (uint64_t) v[0] | (uint64_t) v[1] << 8 | (uint64_t) v[2] << 16 | (uint64_t) v[3] << 24 | (uint64_t) v[4] << 32 | (uint64_t) v[5] << 40 | (uint64_t) v[6] << 48 | (uint64_t) v[7] << 56;
+    uint64_t new_size = 0;
+    for (guint i = 0; i < pieces_size; i++) {
+        const piece_t *piece = &pieces[i];
+        if (piece->data == NULL && (piece->source > buffer->data_size || piece->size > buffer->data_size - piece->source)) {
+            return 1;
+        }
+
+        new_size += piece->size;
+    }
+
+    if (buffer->size - size + new_size == 0) {
+        return 1;
+    }
+
+    if (size == 0 && new_size == 0) {
+        return 0;
+    }
+
+    // Pieces are rebuilt with their starts, empty ones dropped.
+    //
+    GArray *applied = g_array_sized_new(FALSE, FALSE, sizeof(piece_t), pieces_size);
+    uint64_t start = 0;
+    for (guint i = 0; i < pieces_size; i++) {
+        piece_t piece = pieces[i];
+        if (piece.size == 0) {
+            continue;
+        }
+
+        if (piece.data != NULL) {
+            uint8_t *bytes = buffer_alloc(buffer, piece.size);
+            memcpy(bytes, piece.data, piece.size);
+            piece.data = bytes;
+        }
+
+        piece.start = start;
+        start += piece.size;
+        g_array_append_val(applied, piece);
+    }
+
+    buffer_edit(buffer, address, size, (const piece_t*) applied->data, applied->len, new_size);
+    g_array_free(applied, TRUE);
     return 0;
 }
 
 int
-buffer_read_bu64(buffer_t *buffer, uint64_t *data)
+buffer_delete(buffer_t *buffer, uint64_t address, uint64_t size)
 {
-    uint8_t v[sizeof(*data)];
-    if (buffer_read(buffer, v, sizeof(v))) {
+    if (address > buffer->size || size > buffer->size - address || size == buffer->size) {
         return 1;
     }
 
-    *data = (uint64_t) v[7] | (uint64_t) v[6] << 8 | (uint64_t) v[5] << 16 | (uint64_t) v[4] << 24 | (uint64_t) v[3] << 32 | (uint64_t) v[2] << 40 | (uint64_t) v[1] << 48 | (uint64_t) v[0] << 56;
+    if (size == 0) {
+        return 0;
+    }
+
+    buffer_edit(buffer, address, size, NULL, 0, 0);
     return 0;
 }
 
-int
-buffer_read_li16(buffer_t *buffer, int16_t *data)
+// Appends the pieces of a range to pieces, with starts relative to it. The
+// range MUST be in bounds.
+//
+static void
+buffer_pieces(buffer_t *buffer, uint64_t address, uint64_t size, GArray *pieces)
 {
-    return buffer_read_lu16(buffer, (uint16_t*) data);
+    for (guint i = size > 0 ? buffer_piece(buffer, address) : buffer->pieces->len; i < buffer->pieces->len; i++) {
+        piece_t piece = g_array_index(buffer->pieces, piece_t, i);
+        if (piece.start >= address + size) {
+            break;
+        }
+
+        // Trim the pieces at either end to the range.
+        //
+        uint64_t start = MAX(piece.start, address);
+        uint64_t end = MIN(piece.start + piece.size, address + size);
+        piece.data = piece.data != NULL ? piece.data + (start - piece.start) : NULL;
+        piece.source += start - piece.start;
+        piece.start = start - address;
+        piece.size = end - start;
+        g_array_append_val(pieces, piece);
+    }
 }
 
 int
-buffer_read_bi16(buffer_t *buffer, int16_t *data)
+buffer_replace(buffer_t *buffer, const uint64_t *addresses, size_t count, uint64_t size, const void *data,
+        size_t data_size, size_t *replaced)
 {
-    return buffer_read_bu16(buffer, (uint16_t*) data);
+    *replaced = 0;
+    if (count == 0) {
+        return 0;
+    }
+
+    uint64_t first = addresses[0];
+    uint64_t last = addresses[count - 1];
+    if (last > buffer->size || size > buffer->size - last) {
+        return 1;
+    }
+
+    // Every occurrence refers to the same copy of the replacement, between
+    // the pieces of the bytes in between.
+    //
+    uint8_t *bytes = data_size > 0 ? buffer_alloc(buffer, data_size) : NULL;
+    if (bytes != NULL) {
+        memcpy(bytes, data, data_size);
+    }
+
+    GArray *pieces = g_array_new(FALSE, FALSE, sizeof(piece_t));
+    uint64_t end = first;
+    uint64_t new_size = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        if (addresses[i] < end) {
+            continue;
+        }
+
+        guint gap = pieces->len;
+        buffer_pieces(buffer, end, addresses[i] - end, pieces);
+        for (guint j = gap; j < pieces->len; j++) {
+            g_array_index(pieces, piece_t, j).start += new_size;
+        }
+        new_size += addresses[i] - end;
+
+        if (data_size > 0) {
+            piece_t piece = {
+                .start = new_size,
+                .size = data_size,
+                .data = bytes,
+            };
+            g_array_append_val(pieces, piece);
+            new_size += data_size;
+        }
+
+        end = addresses[i] + size;
+        (*replaced)++;
+    }
+
+    // A buffer is never empty.
+    //
+    int error = buffer->size - (end - first) + new_size == 0;
+    if (!error) {
+        buffer_edit(buffer, first, end - first, (const piece_t*) pieces->data, pieces->len, new_size);
+    } else {
+        *replaced = 0;
+    }
+
+    g_array_free(pieces, TRUE);
+    return error;
 }
 
 int
-buffer_read_li32(buffer_t *buffer, int32_t *data)
+buffer_copy(buffer_t *buffer, uint64_t address, uint64_t size)
 {
-    return buffer_read_lu32(buffer, (uint32_t*) data);
+    if (address > buffer->size || size > buffer->size - address) {
+        return 1;
+    }
+
+    // Pastes and the undo journal may refer to the blocks the clipboard owns,
+    // so they are handed to the buffer rather than freed.
+    //
+    g_array_set_size(buffer->clipboard, 0);
+    g_ptr_array_extend_and_steal(buffer->blocks, buffer->clipboard_blocks);
+    buffer->clipboard_blocks = g_ptr_array_new_with_free_func(g_free);
+    buffer->clipboard_owned = 0;
+
+    buffer_pieces(buffer, address, size, buffer->clipboard);
+    buffer->clipboard_size = size;
+    return 0;
 }
 
 int
-buffer_read_bi32(buffer_t *buffer, int32_t *data)
+buffer_paste(buffer_t *buffer, uint64_t address, int insert)
 {
-    return buffer_read_bu32(buffer, (uint32_t*) data);
+    uint64_t size = buffer->clipboard_size;
+    if (size == 0 || address > buffer->size || (!insert && size > buffer->size - address)) {
+        return 1;
+    }
+
+    buffer_edit(buffer, address, insert ? 0 : size, (const piece_t*) buffer->clipboard->data, buffer->clipboard->len,
+            size);
+    return 0;
 }
 
-int
-buffer_read_li64(buffer_t *buffer, int64_t *data)
+void
+buffer_snapshot(buffer_t *buffer, const char *name)
 {
-    return buffer_read_lu64(buffer, (uint64_t*) data);
+    snapshot_t snapshot = {
+        .name = g_strdup(name),
+        .size = buffer->size,
+        .pieces = g_array_sized_new(FALSE, FALSE, sizeof(piece_t), buffer->pieces->len),
+    };
+    g_array_append_vals(snapshot.pieces, buffer->pieces->data, buffer->pieces->len);
+
+    for (guint i = 0; i < buffer->snapshots->len; i++) {
+        snapshot_t *kept = &g_array_index(buffer->snapshots, snapshot_t, i);
+        if (strcmp(kept->name, name) == 0) {
+            g_free(kept->name);
+            g_array_free(kept->pieces, TRUE);
+            g_array_remove_index(buffer->snapshots, i);
+            break;
+        }
+    }
+
+    g_array_append_val(buffer->snapshots, snapshot);
 }
 
 int
-buffer_read_bi64(buffer_t *buffer, int64_t *data)
+buffer_diff(buffer_t *buffer, const snapshot_t *snapshot, uint64_t address, uint64_t size, GArray *extents)
 {
-    return buffer_read_bu64(buffer, (uint64_t*) data);
+    if (address > buffer->size || size > buffer->size - address) {
+        return 1;
+    }
+
+    // Both lists of pieces are walked together, over the runs that neither
+    // splits.
+    //
+    const GArray *ours = buffer->pieces, *theirs = snapshot->pieces;
+    uint64_t end = address + size;
+    guint i = size > 0 ? buffer_find_piece(ours, address) : ours->len;
+    guint j = address < snapshot->size ? buffer_find_piece(theirs, address) : theirs->len;
+
+    for (uint64_t offset = address; offset < end;) {
+        const piece_t *our = &g_array_index(ours, piece_t, i);
+        uint64_t run_end = MIN(our->start + our->size, end);
+
+        int same = 0;
+        if (j < theirs->len) {
+            const piece_t *their = &g_array_index(theirs, piece_t, j);
+            run_end = MIN(run_end, their->start + their->size);
+
+            uint64_t our_offset = offset - our->start, their_offset = offset - their->start;
+            if (our->data != NULL && their->data != NULL) {
+                same = our->data + our_offset == their->data + their_offset;
+            } else if (our->data == NULL && their->data == NULL) {
+                same = our->source + our_offset == their->source + their_offset;
+            }
+
+            if (run_end == their->start + their->size) {
+                j++;
+            }
+        }
+
+        if (!same) {
+            extent_t *last = extents->len > 0 ? &g_array_index(extents, extent_t, extents->len - 1) : NULL;
+            if (last != NULL && last->address + last->size == offset) {
+                last->size += run_end - offset;
+            } else {
+                extent_t extent = {
+                    .address = offset,
+                    .size = run_end - offset,
+                };
+                g_array_append_val(extents, extent);
+            }
+        }
+
+        if (run_end == our->start + our->size) {
+            i++;
+        }
+
+        offset = run_end;
+    }
+
+    return 0;
 }
 
-uint64_t
-buffer_scroll(buffer_t *buffer, uint64_t offset, int width, int height)
+// Returns the bytes of a snapshot from address, which MUST be in bounds, and
+// sets size to the number available.
+//
+static const uint8_t*
+buffer_snapshot_span(buffer_t *buffer, const snapshot_t *snapshot, uint64_t address, uint64_t *size)
 {
-    uint64_t rows = height - 2;
-    uint64_t middle = rows / 2;
+    const piece_t *piece = &g_array_index(snapshot->pieces, piece_t, buffer_find_piece(snapshot->pieces, address));
+    const uint8_t *data = piece->data != NULL ? piece->data : buffer->data + piece->source;
 
-    uint64_t start = offset - (offset % width);
-    int64_t scroll = start / width - middle;
+    *size = piece->start + piece->size - address;
+    return data + (address - piece->start);
+}
 
-    if (scroll < 0) {
-        scroll = 0;
+int
+buffer_compare(buffer_t *buffer, const snapshot_t *snapshot, uint64_t address, uint64_t size,
+        uint8_t *changed)
+{
+    GArray *extents = g_array_new(FALSE, FALSE, sizeof(extent_t));
+    if (buffer_diff(buffer, snapshot, address, size, extents)) {
+        g_array_free(extents, TRUE);
+        return 1;
     }
 
-    if (scroll > buffer->size / width - height + 3) {
-        scroll = buffer->size / width - height + 3;
+    memset(changed, 0, size);
+    for (guint i = 0; i < extents->len; i++) {
+        extent_t extent = g_array_index(extents, extent_t, i);
+        uint64_t end = extent.address + extent.size;
+
+        for (uint64_t offset = extent.address; offset < end;) {
+            uint8_t *flags = changed + (offset - address);
+
+            // Bytes past the end of the snapshot are all new.
+            //
+            if (offset >= snapshot->size) {
+                memset(flags, 1, end - offset);
+                break;
+            }
+
+            uint64_t ours_size, theirs_size;
+            const uint8_t *ours = buffer_span(buffer, offset, &ours_size);
+            const uint8_t *theirs = buffer_snapshot_span(buffer, snapshot, offset, &theirs_size);
+
+            uint64_t chunk = MIN(MIN(ours_size, theirs_size), end - offset);
+            for (uint64_t k = 0; k < chunk; k++) {
+                flags[k] = ours[k] != theirs[k];
+            }
+
+            offset += chunk;
+        }
     }
 
-    if (offset > buffer->size - 1) {
-        offset = buffer->size - 1;
+    g_array_free(extents, TRUE);
+    return 0;
+}
+
+static int
+hex_digit(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
     }
 
-    buffer->cursor = offset;
-    return scroll;
+    c = tolower(c);
+    return c >= 'a' && c <= 'f' ? 10 + c - 'a' : -1;
 }
 
-void
-buffer_add_comment(buffer_t *buffer, uintptr_t address, char *message)
+// Decodes pairs of hex digits into data, which holds at least size / 2 bytes.
+// Returns 1 if text has any other character than spaces, or an odd digit.
+//
+static int
+decode_hex(const char *text, size_t size, uint8_t *data, size_t *data_size)
 {
-    g_hash_table_insert(buffer->comments, GSIZE_TO_POINTER(address), g_strdup(message));
+    size_t digits = 0;
+    for (size_t i = 0; i < size; i++) {
+        if (isspace((unsigned char) text[i])) {
+            continue;
+        }
+
+        int n = hex_digit(text[i]);
+        if (n == -1) {
+            return 1;
+        }
+
+        if (digits % 2 == 0) {
+            data[digits / 2] = n << 4;
+        } else {
+            data[digits / 2] |= n;
+        }
+        digits++;
+    }
+
+    *data_size = digits / 2;
+    return digits % 2 != 0;
 }
 
-void
-buffer_remove_comment(buffer_t *buffer, uintptr_t address)
+// Decodes base64 into data, which holds at least size / 4 * 3 + 3 bytes.
+// Returns 1 if text has any other character than spaces, is not padded to
+// whole quanta, or has characters after the padding.
+//
+static int
+decode_base64(const char *text, size_t size, uint8_t *data, size_t *data_size)
 {
-    g_hash_table_remove(buffer->comments, GSIZE_TO_POINTER(address));
+    size_t characters = 0, padding = 0;
+    for (size_t i = 0; i < size; i++) {
+        char c = text[i];
+        if (isspace((unsigned char) c)) {
+            continue;
+        }
+
+        if (c == '=') {
+            padding++;
+        } else if (padding > 0 || !(isalnum((unsigned char) c) || c == '+' || c == '/')) {
+            return 1;
+        }
+
+        characters++;
+    }
+
+    if (characters % 4 != 0 || padding > 2) {
+        return 1;
+    }
+
+    // Spaces are skipped by the decoder.
+    //
+    int state = 0;
+    unsigned int save = 0;
+    *data_size = g_base64_decode_step(text, size, data, &state, &save);
+    return 0;
+}
+
+uint8_t*
+buffer_decode(const char *text, size_t size, size_t *data_size)
+{
+    uint8_t *data = g_malloc(size / 4 * 3 + 3);
+    if (decode_hex(text, size, data, data_size) == 0 || decode_base64(text, size, data, data_size) == 0) {
+        if (*data_size > 0) {
+            return data;
+        }
+    }
+
+    g_free(data);
+    return NULL;
+}
+
+// Returns the end of the run of the file from offset, up to end, whose bytes
+// saving either changes or leaves, and sets changed accordingly. Bytes change
+// unless the piece over them is the file's own bytes in place.
+//
+static uint64_t
+buffer_saved_run(buffer_t *buffer, uint64_t offset, uint64_t end, int *changed)
+{
+    // Bytes past the end are truncated.
+    //
+    if (offset >= buffer->size) {
+        *changed = 1;
+        return end;
+    }
+
+    const piece_t *piece = &g_array_index(buffer->pieces, piece_t, buffer_piece(buffer, offset));
+    *changed = piece->data != NULL || piece->source != piece->start;
+    return MIN(piece->start + piece->size, end);
+}
+
+// Returns the pieces with the bytes that saving is about to change copied to a
+// new block of blocks: those of the file that are overwritten, and if
+// copy_added, those added by edits, whose blocks are freed.
+//
+static GArray*
+buffer_keep(buffer_t *buffer, const GArray *pieces, int copy_added, GPtrArray *blocks)
+{
+    GArray *kept = g_array_new(FALSE, FALSE, sizeof(piece_t));
+    GArray *copies = g_array_new(FALSE, FALSE, sizeof(guint));
+    uint64_t copied = 0;
+
+    for (guint i = 0; i < pieces->len; i++) {
+        piece_t piece = g_array_index(pieces, piece_t, i);
+
+        if (piece.data != NULL) {
+            if (copy_added) {
+                g_array_append_val(copies, kept->len);
+                copied += piece.size;
+            }
+
+            g_array_append_val(kept, piece);
+            continue;
+        }
+
+        uint64_t end = piece.source + piece.size;
+        for (uint64_t source = piece.source; source < end;) {
+            int changed;
+            uint64_t next = buffer_saved_run(buffer, source, end, &changed);
+
+            piece_t part = {
+                .start = piece.start + (source - piece.source),
+                .size = next - source,
+                .source = source,
+            };
+
+            if (changed) {
+                part.data = buffer->data + source;
+                g_array_append_val(copies, kept->len);
+                copied += part.size;
+            }
+
+            g_array_append_val(kept, part);
+            source = next;
+        }
+    }
+
+    if (copied > 0) {
+        uint8_t *block = g_malloc(copied);
+        g_ptr_array_add(blocks, block);
+
+        for (guint i = 0; i < copies->len; i++) {
+            piece_t *piece = &g_array_index(kept, piece_t, g_array_index(copies, guint, i));
+            memcpy(block, piece->data, piece->size);
+            piece->data = block;
+            block += piece->size;
+        }
+    }
+
+    g_array_free(copies, TRUE);
+    return kept;
+}
+
+int
+buffer_undo(buffer_t *buffer, uint64_t *address)
+{
+    return buffer_revert(buffer, buffer->undo, buffer->redo, address);
+}
+
+int
+buffer_redo(buffer_t *buffer, uint64_t *address)
+{
+    return buffer_revert(buffer, buffer->redo, buffer->undo, address);
+}
+
+int
+buffer_changed(buffer_t *buffer, uint64_t edits, uint64_t address, uint64_t size)
+{
+    if (buffer->edits - edits > BUFFER_EDITS) {
+        return 1;
+    }
+
+    for (uint64_t edit = edits; edit < buffer->edits; edit++) {
+        int i = edit % BUFFER_EDITS;
+        if (buffer->edit_start[i] < address + size && address < buffer->edit_end[i]) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int
+buffer_pwrite(int f, const uint8_t *data, uint64_t size, uint64_t offset)
+{
+    while (size > 0) {
+        ssize_t written = pwrite(f, data, size, offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return 1;
+        }
+
+        data += written;
+        size -= written;
+        offset += written;
+    }
+
+    return 0;
+}
+
+// Bytes moved by each copy when saving, and the size of the buffer they pass
+// through when a copy overlaps the bytes it moves.
+//
+#define BUFFER_MOVE_SIZE (8 * 1024 * 1024)
+
+// Copies a range of a file to another, or to where it does not overlap
+// itself in the same file, within the kernel. Returns 1 if the file system
+// cannot.
+//
+static int
+buffer_copy_range(int from, int to, uint64_t source, uint64_t size, uint64_t destination)
+{
+    loff_t in = source, out = destination;
+    while (size > 0) {
+        ssize_t copied = copy_file_range(from, &in, to, &out, size, 0);
+        if (copied <= 0) {
+            if (copied < 0 && errno == EINTR) {
+                continue;
+            }
+
+            return 1;
+        }
+
+        size -= copied;
+    }
+
+    return 0;
+}
+
+// Moves a range of the file to destination. Chunks are moved from the end if
+// the range moves forward, and from the start if it moves back, so that each
+// is read before it is overwritten.
+//
+static int
+buffer_move(buffer_t *buffer, uint8_t *bounce, uint64_t source, uint64_t size, uint64_t destination)
+{
+    uint64_t distance = destination > source ? destination - source : source - destination;
+
+    for (uint64_t done = 0; done < size;) {
+        uint64_t chunk = MIN(BUFFER_MOVE_SIZE, size - done);
+        uint64_t offset = destination > source ? size - done - chunk : done;
+        const uint8_t *data = buffer->data + source + offset;
+
+        if (distance < chunk) {
+            memcpy(bounce, data, chunk);
+            data = bounce;
+        } else if (buffer_copy_range(buffer->f, buffer->f, source + offset, chunk, destination + offset) == 0) {
+            done += chunk;
+            continue;
+        }
+
+        if (buffer_pwrite(buffer->f, data, chunk, destination + offset)) {
+            return 1;
+        }
+
+        done += chunk;
+    }
+
+    return 0;
+}
+
+// Returns whether the pieces of the file are in the order of the file, without
+// overlapping, as inserts, deletes and writes leave them. Saving then only
+// moves them, and reads no byte of the file after it is overwritten.
+//
+static int
+buffer_in_order(buffer_t *buffer)
+{
+    uint64_t end = 0;
+    for (guint i = 0; i < buffer->pieces->len; i++) {
+        const piece_t *piece = &g_array_index(buffer->pieces, piece_t, i);
+        if (piece->data != NULL) {
+            continue;
+        }
+
+        if (piece->source < end) {
+            return 0;
+        }
+
+        end = piece->source + piece->size;
+    }
+
+    return 1;
+}
+
+// Maps the file again once its size is that of the buffer. Returns 1 if it
+// could not be mapped, leaving the previous mapping.
+//
+static int
+buffer_remap(buffer_t *buffer)
+{
+    if (buffer->size == buffer->data_size) {
+        return 0;
+    }
+
+    uint8_t *data = mmap(NULL, buffer->size, PROT_READ, MAP_SHARED, buffer->f, 0);
+    if (data == MAP_FAILED) {
+        return 1;
+    }
+
+    (void) munmap(buffer->data, buffer->data_size);
+    buffer->data = data;
+    buffer->data_size = buffer->size;
+    return 0;
+}
+
+int
+buffer_save(buffer_t *buffer)
+{
+    if (!buffer->modified) {
+        return 0;
+    }
+
+    if (buffer->f < 0 || !buffer->editable || buffer->failed) {
+        return 1;
+    }
+
+    // The bytes of the file that the clipboard refers to are copied before
+    // they are overwritten.
+    //
+    GArray *clipboard = buffer_keep(buffer, buffer->clipboard, !buffer->clipboard_owned, buffer->clipboard_blocks);
+    g_array_free(buffer->clipboard, TRUE);
+    buffer->clipboard = clipboard;
+    buffer->clipboard_owned = 1;
+
+    g_rw_lock_writer_lock(&buffer->lock);
+
+    // Pasting can reorder or repeat the bytes of the file, in which case those
+    // that move are copied instead, and every piece is then either in place or
+    // added.
+    //
+    if (!buffer_in_order(buffer)) {
+        GArray *pieces = buffer_keep(buffer, buffer->pieces, 0, buffer->blocks);
+        g_array_free(buffer->pieces, TRUE);
+        buffer->pieces = pieces;
+    }
+
+    // Pieces of the file moved forward are moved last first, and those moved
+    // back first first: neither overwrites the bytes of another before they
+    // are moved. Pieces in place are left, so nothing before the first change
+    // is written. The bytes added are written once the file has moved.
+    //
+    // Space for the growth is allocated before any byte moves, so that
+    // running out of it leaves the file as it was.
+    //
+    if (buffer->size > buffer->data_size
+            && fallocate(buffer->f, 0, buffer->data_size, buffer->size - buffer->data_size) != 0
+            && errno != EOPNOTSUPP) {
+        g_rw_lock_writer_unlock(&buffer->lock);
+        return 1;
+    }
+
+    int status = 0;
+    uint8_t *bounce = g_malloc(BUFFER_MOVE_SIZE);
+
+    for (guint i = buffer->pieces->len; i-- > 0 && status == 0;) {
+        const piece_t *piece = &g_array_index(buffer->pieces, piece_t, i);
+        if (piece->data == NULL && piece->start > piece->source) {
+            status = buffer_move(buffer, bounce, piece->source, piece->size, piece->start);
+        }
+    }
+
+    for (guint i = 0; i < buffer->pieces->len && status == 0; i++) {
+        const piece_t *piece = &g_array_index(buffer->pieces, piece_t, i);
+        if (piece->data == NULL && piece->start < piece->source) {
+            status = buffer_move(buffer, bounce, piece->source, piece->size, piece->start);
+        }
+    }
+
+    for (guint i = 0; i < buffer->pieces->len && status == 0; i++) {
+        const piece_t *piece = &g_array_index(buffer->pieces, piece_t, i);
+        if (piece->data != NULL) {
+            status = buffer_pwrite(buffer->f, piece->data, piece->size, piece->start);
+        }
+    }
+
+    g_free(bounce);
+
+    if (status == 0 && buffer->size != buffer->data_size && ftruncate(buffer->f, buffer->size) != 0) {
+        status = 1;
+    }
+
+    if (status == 0 && fdatasync(buffer->f) != 0) {
+        status = 1;
+    }
+
+    if (status == 0) {
+        status = buffer_remap(buffer);
+    }
+
+    // The pieces of the file now refer to bytes that may have been
+    // overwritten, so the buffer is left as it is, read only.
+    //
+    if (status == 0) {
+        buffer_reset(buffer);
+    } else {
+        buffer->failed = 1;
+        buffer->editable = 0;
+    }
+
+    g_rw_lock_writer_unlock(&buffer->lock);
+    return status;
+}
+
+// Writes the fill repeated over a range of the file, from its first byte. The
+// fill is written once, to a chunk of whole repeats, and copied from there
+// within the kernel, or written again if the file system cannot.
+//
+static int
+buffer_fill(buffer_t *buffer, uint64_t address, uint64_t size, const uint8_t *fill, size_t fill_size)
+{
+    size_t chunk = MIN(BUFFER_MOVE_SIZE / fill_size * fill_size, size);
+    uint8_t *repeats = g_malloc(chunk);
+    for (size_t i = 0; i < chunk; i++) {
+        repeats[i] = fill[i % fill_size];
+    }
+
+    int status = buffer_pwrite(buffer->f, repeats, chunk, address);
+    for (uint64_t done = chunk; done < size && status == 0;) {
+        uint64_t next = MIN(chunk, size - done);
+        if (buffer_copy_range(buffer->f, buffer->f, address, next, address + done)) {
+            status = buffer_pwrite(buffer->f, repeats, next, address + done);
+        }
+
+        done += next;
+    }
+
+    g_free(repeats);
+    return status;
+}
+
+int
+buffer_resize(buffer_t *buffer, uint64_t size, const uint8_t *fill, size_t fill_size)
+{
+    if (buffer->f < 0 || !buffer->editable || size == 0 || buffer_save(buffer)) {
+        return 1;
+    }
+
+    uint64_t previous = buffer->size;
+    if (size == previous) {
+        return 0;
+    }
+
+    // A fill of zeroes is left to the file system, which reads the bytes past
+    // the previous end as zeroes without storing them.
+    //
+    int zeroes = 1;
+    for (size_t i = 0; i < fill_size; i++) {
+        zeroes &= fill[i] == 0;
+    }
+
+    g_rw_lock_writer_lock(&buffer->lock);
+
+    // The bytes of the file that the clipboard refers to are copied before
+    // they are cut.
+    //
+    buffer->size = size;
+    GArray *clipboard = buffer_keep(buffer, buffer->clipboard, !buffer->clipboard_owned, buffer->clipboard_blocks);
+    g_array_free(buffer->clipboard, TRUE);
+    buffer->clipboard = clipboard;
+    buffer->clipboard_owned = 1;
+
+    int status = 0;
+    if (size < previous || zeroes) {
+        status = ftruncate(buffer->f, size) != 0;
+    } else {
+        // Space for the fill is allocated first, so that it runs out before
+        // anything is written rather than midway.
+        //
+        if (fallocate(buffer->f, 0, previous, size - previous) != 0 && errno != EOPNOTSUPP) {
+            status = 1;
+        }
+
+        if (status == 0 && buffer_fill(buffer, previous, size - previous, fill, fill_size)) {
+            (void) ftruncate(buffer->f, previous);
+            status = 1;
+        }
+    }
+
+    if (status != 0) {
+        buffer->size = previous;
+        g_rw_lock_writer_unlock(&buffer->lock);
+        return 1;
+    }
+
+    // The file is resized, so a buffer that cannot follow it is left read
+    // only, as by a failed save.
+    //
+    if (fdatasync(buffer->f) != 0 || buffer_remap(buffer)) {
+        buffer->failed = 1;
+        buffer->editable = 0;
+        g_rw_lock_writer_unlock(&buffer->lock);
+        return 1;
+    }
+
+    buffer_reset(buffer);
+
+    // The bytes from the end before or after change, as the range of an edit,
+    // so that results read from them are evaluated again.
+    //
+    int i = buffer->edits++ % BUFFER_EDITS;
+    buffer->edit_start[i] = MIN(previous, size);
+    buffer->edit_end[i] = UINT64_MAX;
+
+    g_rw_lock_writer_unlock(&buffer->lock);
+    return 0;
+}
+
+// Copies a range of the file of a buffer to another file, sharing the extents
+// of the whole blocks it spans if the file system can. Copying through the
+// mapping is the last resort.
+//
+static int
+buffer_clone_range(buffer_t *buffer, int to, uint64_t source, uint64_t size, uint64_t destination,
+        uint64_t block)
+{
+    // Blocks are only shared at the same offset within them in both files.
+    //
+    if (block > 0 && source % block == destination % block) {
+        uint64_t head = MIN(size, (block - source % block) % block);
+        uint64_t body = (size - head) / block * block;
+
+        struct file_clone_range range = {
+            .src_fd = buffer->f,
+            .src_offset = source + head,
+            .src_length = body,
+            .dest_offset = destination + head,
+        };
+
+        if (body > 0 && ioctl(to, FICLONERANGE, &range) == 0) {
+            uint64_t tail = head + body;
+            return buffer_clone_range(buffer, to, source, head, destination, 0)
+                || buffer_clone_range(buffer, to, source + tail, size - tail, destination + tail, 0);
+        }
+    }
+
+    if (size == 0 || buffer_copy_range(buffer->f, to, source, size, destination) == 0) {
+        return 0;
+    }
+
+    return buffer_pwrite(to, buffer->data + source, size, destination);
+}
+
+int
+buffer_save_as(buffer_t *buffer, const char *path)
+{
+    if (buffer->f < 0 || buffer->failed) {
+        return 1;
+    }
+
+    struct stat status;
+    if (fstat(buffer->f, &status) != 0) {
+        return 1;
+    }
+
+    // Renaming over the file itself would leave the buffer on the old file,
+    // unlinked, where later saves are lost.
+    //
+    struct stat target;
+    if (stat(path, &target) == 0 && target.st_dev == status.st_dev && target.st_ino == status.st_ino) {
+        return 2;
+    }
+
+    // The copy is written next to path and renamed over it once complete, so
+    // that path is never left half written.
+    //
+    char *temporary = g_strdup_printf("%s.XXXXXX", path);
+    int f = mkstemp(temporary);
+    if (f < 0) {
+        g_free(temporary);
+        return 1;
+    }
+
+    // A clone of the whole file has every piece in place already.
+    //
+    int cloned = ioctl(f, FICLONE, buffer->f) == 0;
+
+    struct stat copy;
+    int error = fstat(f, &copy) != 0 || fchmod(f, status.st_mode & 07777) != 0
+        || ftruncate(f, buffer->size) != 0;
+
+    for (guint i = 0; i < buffer->pieces->len && !error; i++) {
+        const piece_t *piece = &g_array_index(buffer->pieces, piece_t, i);
+
+        if (piece->data != NULL) {
+            error = buffer_pwrite(f, piece->data, piece->size, piece->start);
+        } else if (!cloned || piece->source != piece->start) {
+            error = buffer_clone_range(buffer, f, piece->source, piece->size, piece->start, copy.st_blksize);
+        }
+    }
+
+    error = error || fdatasync(f) != 0;
+    error = close(f) != 0 || error;
+    error = error || rename(temporary, path) != 0;
+
+    if (error) {
+        unlink(temporary);
+    }
+
+    g_free(temporary);
+    return error;
+}
+
+int
+buffer_read_u8(buffer_t *buffer, uint8_t *data)
+{
+    return buffer_read(buffer, data, sizeof(*data));
+}
+
+int
+buffer_read_i8(buffer_t *buffer, int8_t *data)
+{
+    return buffer_read(buffer, data, sizeof(*data));
+}
+
+int
+buffer_read_lu16(buffer_t *buffer, uint16_t *data)
+{
+    uint8_t v[sizeof(*data)];
+    if (buffer_read(buffer, v, sizeof(v))) {
+        return 1;
+    }
+
+    *data = (uint16_t) v[0] | (uint16_t) v[1] << 8;
+    return 0;
+}
+
+int
+buffer_read_bu16(buffer_t *buffer, uint16_t *data)
+{
+    uint8_t v[sizeof(*data)];
+    if (buffer_read(buffer, v, sizeof(v))) {
+        return 1;
+    }
+
+    *data = (uint16_t) v[1] | (uint16_t) v[0] << 8;
+    return 0;
+}
+
+int
+buffer_read_lu32(buffer_t *buffer, uint32_t *data)
+{
+    uint8_t v[sizeof(*data)];
+    if (buffer_read(buffer, v, sizeof(v))) {
+        return 1;
+    }
+
+    *data = (uint32_t) v[0] | (uint32_t) v[1] << 8 | (uint32_t) v[2] << 16 | (uint32_t) v[3] << 24;
+    return 0;
+}
+
+int
+buffer_read_bu32(buffer_t *buffer, uint32_t *data)
+{
+    uint8_t v[sizeof(*data)];
+    if (buffer_read(buffer, v, sizeof(v))) {
+        return 1;
+    }
+
+    *data = (uint32_t) v[3] | (uint32_t) v[2] << 8 | (uint32_t) v[1] << 16 | (uint32_t) v[0] << 24;
+    return 0;
+}
+
+int
+buffer_read_lu64(buffer_t *buffer, uint64_t *data)
+{
+    uint8_t v[sizeof(*data)];
+    if (buffer_read(buffer, v, sizeof(v))) {
+        return 1;
+    }
+
+    *data = (uint64_t) v[0] | (uint64_t) v[1] << 8 | (uint64_t) v[2] << 16 | (uint64_t) v[3] << 24 | (uint64_t) v[4] << 32 | (uint64_t) v[5] << 40 | (uint64_t) v[6] << 48 | (uint64_t) v[7] << 56;
+    return 0;
+}
+
+int
+buffer_read_bu64(buffer_t *buffer, uint64_t *data)
+{
+    uint8_t v[sizeof(*data)];
+    if (buffer_read(buffer, v, sizeof(v))) {
+        return 1;
+    }
+
+    *data = (uint64_t) v[7] | (uint64_t) v[6] << 8 | (uint64_t) v[5] << 16 | (uint64_t) v[4] << 24 | (uint64_t) v[3] << 32 | (uint64_t) v[2] << 40 | (uint64_t) v[1] << 48 | (uint64_t) v[0] << 56;
+    return 0;
+}
+
+int
+buffer_read_li16(buffer_t *buffer, int16_t *data)
+{
+    return buffer_read_lu16(buffer, (uint16_t*) data);
+}
+
+int
+buffer_read_bi16(buffer_t *buffer, int16_t *data)
+{
+    return buffer_read_bu16(buffer, (uint16_t*) data);
+}
+
+int
+buffer_read_li32(buffer_t *buffer, int32_t *data)
+{
+    return buffer_read_lu32(buffer, (uint32_t*) data);
+}
+
+int
+buffer_read_bi32(buffer_t *buffer, int32_t *data)
+{
+    return buffer_read_bu32(buffer, (uint32_t*) data);
+}
+
+int
+buffer_read_li64(buffer_t *buffer, int64_t *data)
+{
+    return buffer_read_lu64(buffer, (uint64_t*) data);
+}
+
+int
+buffer_read_bi64(buffer_t *buffer, int64_t *data)
+{
+    return buffer_read_bu64(buffer, (uint64_t*) data);
+}
+
+// Bytes processed between progress reports.
+//
+#define BUFFER_PROGRESS_CHUNK (16 * 1024 * 1024)
+
+typedef void (*buffer_kernel_t)(const uint8_t *data, uint64_t size, void *state);
+
+// Runs a kernel over the contiguous spans of a range, at most a progress chunk
+// at a time.
+//
+static int
+buffer_reduce(buffer_t *buffer, uint64_t address, uint64_t size, const progress_t *progress,
+        buffer_kernel_t kernel, void *state)
+{
+    if (address > buffer->size || size > buffer->size - address) {
+        return 1;
+    }
+
+    for (uint64_t done = 0; done < size;) {
+        uint64_t available;
+        const uint8_t *data = buffer_span(buffer, address + done, &available);
+
+        uint64_t chunk = MIN(MIN(available, size - done), BUFFER_PROGRESS_CHUNK);
+        kernel(data, chunk, state);
+        done += chunk;
+
+        if (progress != NULL) {
+            progress->report(progress->user_data, done, size);
+        }
+    }
+
+    return 0;
+}
+
+static void
+histogram_kernel(const uint8_t *data, uint64_t size, void *state)
+{
+    uint64_t *histogram = (uint64_t*) state;
+
+    // Count into four tables so that runs of the same byte don't serialize on a
+    // single counter. The 32-bit counters can't overflow within a chunk.
+    //
+    uint32_t tables[4][256] = {};
+    uint64_t i = 0;
+
+    for (; i + 8 <= size; i += 8) {
+        uint64_t v;
+        memcpy(&v, data + i, sizeof(v));
+
+        tables[0][v & 0xff]++;
+        tables[1][(v >> 8) & 0xff]++;
+        tables[2][(v >> 16) & 0xff]++;
+        tables[3][(v >> 24) & 0xff]++;
+        tables[0][(v >> 32) & 0xff]++;
+        tables[1][(v >> 40) & 0xff]++;
+        tables[2][(v >> 48) & 0xff]++;
+        tables[3][v >> 56]++;
+    }
+
+    for (; i < size; i++) {
+        tables[0][data[i]]++;
+    }
+
+    for (int j = 0; j < 256; j++) {
+        histogram[j] += (uint64_t) tables[0][j] + tables[1][j] + tables[2][j] + tables[3][j];
+    }
+}
+
+int
+buffer_histogram(buffer_t *buffer, uint64_t address, uint64_t size, const progress_t *progress,
+        uint64_t histogram[256])
+{
+    memset(histogram, 0, 256 * sizeof(*histogram));
+    return buffer_reduce(buffer, address, size, progress, histogram_kernel, histogram);
+}
+
+// Slicing-by-8 tables for the reflected CRC-32 polynomial, the fallback when
+// carry-less multiplication isn't available, and for the tail of a range.
+//
+static uint32_t crc32_tables[8][256];
+
+static void
+crc32_init(void)
+{
+    static gsize initialized = 0;
+
+    if (g_once_init_enter(&initialized)) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int j = 0; j < 8; j++) {
+                crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+            }
+
+            crc32_tables[0][i] = crc;
+        }
+
+        for (uint32_t i = 0; i < 256; i++) {
+            for (int j = 1; j < 8; j++) {
+                crc32_tables[j][i] = (crc32_tables[j - 1][i] >> 8) ^ crc32_tables[0][crc32_tables[j - 1][i] & 0xff];
+            }
+        }
+
+        g_once_init_leave(&initialized, 1);
+    }
+}
+
+static uint32_t
+crc32_slice(uint32_t crc, const uint8_t *data, uint64_t size)
+{
+    for (; size >= 8; data += 8, size -= 8) {
+        uint32_t low = (uint32_t) data[0] | (uint32_t) data[1] << 8 | (uint32_t) data[2] << 16
+            | (uint32_t) data[3] << 24;
+        low ^= crc;
+
+        crc = crc32_tables[7][low & 0xff] ^ crc32_tables[6][(low >> 8) & 0xff]
+            ^ crc32_tables[5][(low >> 16) & 0xff] ^ crc32_tables[4][low >> 24]
+            ^ crc32_tables[3][data[4]] ^ crc32_tables[2][data[5]]
+            ^ crc32_tables[1][data[6]] ^ crc32_tables[0][data[7]];
+    }
+
+    for (; size > 0; data++, size--) {
+        crc = (crc >> 8) ^ crc32_tables[0][(crc ^ *data) & 0xff];
+    }
+
+    return crc;
+}
+
+#if defined(__x86_64__)
+// Folds 64 bytes at a time with carry-less multiplication, after "Fast CRC
+// Computation for Generic Polynomials Using PCLMULQDQ Instruction" (Gopal et
+// al., Intel, 2009). size MUST be a multiple of 16, and at least 64.
+//
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t
+crc32_clmul(uint32_t crc, const uint8_t *data, uint64_t size)
+{
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+    const __m128i k5 = _mm_set_epi64x(0, 0x0163cd6124);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+    const __m128i mask = _mm_setr_epi32(~0, 0, ~0, 0);
+
+    __m128i x1 = _mm_loadu_si128((const __m128i*) (data + 0x00));
+    __m128i x2 = _mm_loadu_si128((const __m128i*) (data + 0x10));
+    __m128i x3 = _mm_loadu_si128((const __m128i*) (data + 0x20));
+    __m128i x4 = _mm_loadu_si128((const __m128i*) (data + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+    data += 64;
+    size -= 64;
+
+    for (; size >= 64; data += 64, size -= 64) {
+        __m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+        __m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        __m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        __m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i*) (data + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i*) (data + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i*) (data + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i*) (data + 0x30)));
+    }
+
+    // Fold the four lanes into one, then any remaining 16-byte blocks.
+    //
+    __m128i lanes[3] = { x2, x3, x4 };
+    for (int i = 0; i < 3; i++) {
+        __m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, lanes[i]), x5);
+    }
+
+    for (; size >= 16; data += 16, size -= 16) {
+        __m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i*) data)), x5);
+    }
+
+    // Fold 128 bits to 64, then reduce to 32 (Barrett).
+    //
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask);
+    x1 = _mm_clmulepi64_si128(x1, k5, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    x2 = _mm_and_si128(x1, mask);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+    x2 = _mm_and_si128(x2, mask);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return _mm_extract_epi32(x1, 1);
+}
+#endif
+
+static void
+crc32_kernel(const uint8_t *data, uint64_t size, void *state)
+{
+    uint32_t *crc = (uint32_t*) state;
+
+#if defined(__x86_64__)
+    if (size >= 64 && __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1")) {
+        uint64_t blocks = size & ~(uint64_t) 15;
+        *crc = crc32_clmul(*crc, data, blocks);
+        data += blocks;
+        size -= blocks;
+    }
+#endif
+
+    *crc = crc32_slice(*crc, data, size);
+}
+
+uint32_t
+buffer_crc32_data(uint32_t crc, const void *data, uint64_t size)
+{
+    crc32_init();
+
+    uint32_t state = crc ^ 0xffffffff;
+    crc32_kernel((const uint8_t*) data, size, &state);
+    return state ^ 0xffffffff;
+}
+
+int
+buffer_crc32(buffer_t *buffer, uint64_t address, uint64_t size, const progress_t *progress, uint32_t *crc)
+{
+    crc32_init();
+
+    uint32_t state = 0xffffffff;
+    if (buffer_reduce(buffer, address, size, progress, crc32_kernel, &state)) {
+        return 1;
+    }
+
+    *crc = state ^ 0xffffffff;
+    return 0;
+}
+
+static void
+sum_kernel(const uint8_t *data, uint64_t size, void *state)
+{
+    uint64_t *sum = (uint64_t*) state;
+    uint64_t i = 0;
+
+#if defined(__SSE2__)
+    // Sums of absolute differences against zero add 8 bytes into each 64-bit
+    // lane.
+    //
+    __m128i zero = _mm_setzero_si128();
+    __m128i lanes = zero;
+    for (; i + 16 <= size; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (data + i));
+        lanes = _mm_add_epi64(lanes, _mm_sad_epu8(v, zero));
+    }
+
+    *sum += (uint64_t) _mm_cvtsi128_si64(lanes) + (uint64_t) _mm_cvtsi128_si64(_mm_unpackhi_epi64(lanes, lanes));
+#endif
+
+    for (; i < size; i++) {
+        *sum += data[i];
+    }
+}
+
+int
+buffer_sum(buffer_t *buffer, uint64_t address, uint64_t size, const progress_t *progress, uint64_t *sum)
+{
+    *sum = 0;
+    return buffer_reduce(buffer, address, size, progress, sum_kernel, sum);
+}
+
+static void
+xor_kernel(const uint8_t *data, uint64_t size, void *state)
+{
+    uint8_t *xor = (uint8_t*) state;
+    uint64_t i = 0;
+
+#if defined(__SSE2__)
+    __m128i lanes = _mm_setzero_si128();
+    for (; i + 16 <= size; i += 16) {
+        lanes = _mm_xor_si128(lanes, _mm_loadu_si128((const __m128i*) (data + i)));
+    }
+
+    uint8_t bytes[16];
+    _mm_storeu_si128((__m128i*) bytes, lanes);
+    for (int j = 0; j < 16; j++) {
+        *xor ^= bytes[j];
+    }
+#endif
+
+    for (; i < size; i++) {
+        *xor ^= data[i];
+    }
+}
+
+int
+buffer_xor(buffer_t *buffer, uint64_t address, uint64_t size, const progress_t *progress, uint8_t *xor)
+{
+    *xor = 0;
+    return buffer_reduce(buffer, address, size, progress, xor_kernel, xor);
+}
+
+typedef struct {
+    uint8_t byte;
+    uint64_t count;
+} count_state_t;
+
+static void
+count_kernel(const uint8_t *data, uint64_t size, void *state)
+{
+    count_state_t *count = (count_state_t*) state;
+    uint64_t i = 0;
+
+#if defined(__SSE2__)
+    // Matches are -1 in each byte lane. Subtracting them counts up to 255 per
+    // lane, so the lanes are summed every 255 blocks.
+    //
+    __m128i zero = _mm_setzero_si128();
+    __m128i needle = _mm_set1_epi8((char) count->byte);
+    __m128i total = zero;
+
+    while (i + 16 <= size) {
+        __m128i lanes = zero;
+        for (int j = 0; j < 255 && i + 16 <= size; j++, i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i*) (data + i));
+            lanes = _mm_sub_epi8(lanes, _mm_cmpeq_epi8(v, needle));
+        }
+
+        total = _mm_add_epi64(total, _mm_sad_epu8(lanes, zero));
+    }
+
+    count->count += (uint64_t) _mm_cvtsi128_si64(total) + (uint64_t) _mm_cvtsi128_si64(_mm_unpackhi_epi64(total, total));
+#endif
+
+    for (; i < size; i++) {
+        count->count += data[i] == count->byte;
+    }
+}
+
+int
+buffer_count(buffer_t *buffer, uint64_t address, uint64_t size, uint8_t byte, const progress_t *progress,
+        uint64_t *count)
+{
+    count_state_t state = {
+        .byte = byte,
+    };
+
+    if (buffer_reduce(buffer, address, size, progress, count_kernel, &state)) {
+        return 1;
+    }
+
+    *count = state.count;
+    return 0;
+}
+
+// Exclusive ors, or adds, a key stream to the bytes. The stream is a multiple
+// of 16 bytes, a whole number of repetitions of the key.
+//
+static void
+block_key_kernel(uint8_t *data, uint64_t size, block_t block, const uint8_t *stream, size_t stream_size)
+{
+    uint64_t i = 0;
+    size_t j = 0;
+
+#if defined(__SSE2__)
+    for (; i + 16 <= size; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (data + i));
+        __m128i k = _mm_loadu_si128((const __m128i*) (stream + j));
+        v = block == BLOCK_XOR ? _mm_xor_si128(v, k) : _mm_add_epi8(v, k);
+        _mm_storeu_si128((__m128i*) (data + i), v);
+
+        j += 16;
+        if (j == stream_size) {
+            j = 0;
+        }
+    }
+#endif
+
+    for (; i < size; i++) {
+        data[i] = block == BLOCK_XOR ? data[i] ^ stream[j] : data[i] + stream[j];
+
+        if (++j == stream_size) {
+            j = 0;
+        }
+    }
+}
+
+#if defined(__SSE2__)
+// Reverses the bytes of each 16-bit word, then of each 32 and 64-bit word by
+// swapping the 16-bit words within them.
+//
+static inline __m128i
+block_swap16(__m128i v)
+{
+    return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+static inline __m128i
+block_swap32(__m128i v)
+{
+    v = block_swap16(v);
+    return _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+}
+
+static inline __m128i
+block_swap64(__m128i v)
+{
+    v = block_swap16(v);
+    return _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3)), _MM_SHUFFLE(0, 1, 2, 3));
+}
+
+static inline __m128i
+block_reverse16(__m128i v)
+{
+    return _mm_shuffle_epi32(block_swap64(v), _MM_SHUFFLE(1, 0, 3, 2));
+}
+#endif
+
+static void
+block_swap_kernel(uint8_t *data, uint64_t size, block_t block)
+{
+    int width = block == BLOCK_SWAP16 ? 2 : block == BLOCK_SWAP32 ? 4 : 8;
+    uint64_t i = 0;
+
+#if defined(__SSE2__)
+    for (; i + 16 <= size; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (data + i));
+        v = width == 2 ? block_swap16(v) : width == 4 ? block_swap32(v) : block_swap64(v);
+        _mm_storeu_si128((__m128i*) (data + i), v);
+    }
+#endif
+
+    for (; i + width <= size; i += width) {
+        for (int j = 0; j < width / 2; j++) {
+            uint8_t byte = data[i + j];
+            data[i + j] = data[i + width - 1 - j];
+            data[i + width - 1 - j] = byte;
+        }
+    }
+}
+
+static void
+block_reverse_kernel(uint8_t *data, uint64_t size)
+{
+    uint64_t i = 0;
+    uint64_t j = size;
+
+#if defined(__SSE2__)
+    // Swap reversed blocks from either end until they would overlap.
+    //
+    for (; j - i >= 32; i += 16, j -= 16) {
+        __m128i low = _mm_loadu_si128((const __m128i*) (data + i));
+        __m128i high = _mm_loadu_si128((const __m128i*) (data + j - 16));
+        _mm_storeu_si128((__m128i*) (data + i), block_reverse16(high));
+        _mm_storeu_si128((__m128i*) (data + j - 16), block_reverse16(low));
+    }
+#endif
+
+    for (; j - i >= 2; i++, j--) {
+        uint8_t byte = data[i];
+        data[i] = data[j - 1];
+        data[j - 1] = byte;
+    }
+}
+
+int
+buffer_block(buffer_t *buffer, uint64_t address, uint64_t size, block_t block, const uint8_t *key,
+        size_t key_size)
+{
+    if (address > buffer->size || size > buffer->size - address) {
+        return 1;
+    }
+
+    if (block == BLOCK_INCREMENT) {
+        block = BLOCK_ADD;
+        key = (const uint8_t*) "\x01";
+        key_size = 1;
+    }
+
+    int keyed = block == BLOCK_FILL || block == BLOCK_XOR || block == BLOCK_ADD;
+    if (keyed && (key_size == 0 || key_size > BLOCK_KEY_SIZE)) {
+        return 1;
+    }
+
+    if (size == 0) {
+        return 0;
+    }
+
+    // The key repeated to a multiple of 16 bytes, for whole vectors of it.
+    //
+    uint8_t stream[BLOCK_KEY_SIZE * 16];
+    size_t stream_size = key_size;
+    while (stream_size % 16 != 0) {
+        stream_size += key_size;
+    }
+
+    for (size_t i = 0; keyed && i < stream_size; i++) {
+        stream[i] = key[i % key_size];
+    }
+
+    uint8_t *data = buffer_alloc(buffer, size);
+
+    switch (block) {
+    case BLOCK_FILL: {
+        // Double the bytes filled, which stay a whole number of keys.
+        //
+        uint64_t done = MIN(stream_size, size);
+        memcpy(data, stream, done);
+        for (; done < size; done += MIN(done, size - done)) {
+            memcpy(data + done, data, MIN(done, size - done));
+        }
+    } break;
+    case BLOCK_XOR:
+    case BLOCK_ADD:
+        (void) buffer_read_at(buffer, address, data, size);
+        block_key_kernel(data, size, block, stream, stream_size);
+        break;
+    case BLOCK_SWAP16:
+    case BLOCK_SWAP32:
+    case BLOCK_SWAP64:
+        (void) buffer_read_at(buffer, address, data, size);
+        block_swap_kernel(data, size, block);
+        break;
+    case BLOCK_REVERSE:
+        (void) buffer_read_at(buffer, address, data, size);
+        block_reverse_kernel(data, size);
+        break;
+    default:
+        break;
+    }
+
+    piece_t piece = {
+        .size = size,
+        .data = data,
+    };
+    buffer_edit(buffer, address, size, &piece, 1, size);
+    return 0;
+}
+
+int
+buffer_selection(buffer_t *buffer, uint64_t *address, uint64_t *size)
+{
+    if (buffer->start_mark == -1) {
+        return 1;
+    }
+
+    cursor_t start = buffer->start_mark;
+    cursor_t end = buffer->end_mark == -1 ? buffer->cursor : buffer->end_mark;
+    if (start > end) {
+        cursor_t swap = start;
+        start = end;
+        end = swap;
+    }
+
+    *address = start;
+    *size = end - start + 1;
+    return 0;
+}
+
+uint64_t
+buffer_scroll(buffer_t *buffer, uint64_t offset, int width, int height)
+{
+    uint64_t rows = height - 2;
+    uint64_t middle = rows / 2;
+
+    uint64_t start = offset - (offset % width);
+    int64_t scroll = start / width - middle;
+
+    if (scroll < 0) {
+        scroll = 0;
+    }
+
+    if (scroll > buffer->size / width - height + 3) {
+        scroll = buffer->size / width - height + 3;
+    }
+
+    if (offset > buffer->size - 1) {
+        offset = buffer->size - 1;
+    }
+
+    buffer->cursor = offset;
+    return scroll;
+}
+
+uint64_t
+buffer_anchor(buffer_t *buffer, int64_t row, int width, int height)
+{
+    int64_t rows = height - 2;
+
+    if (row > rows - 1) {
+        row = rows - 1;
+    }
+
+    if (row < 0) {
+        row = 0;
+    }
+
+    int64_t scroll = buffer->cursor / width - row;
+
+    // Don't leave empty rows at the bottom of the view if it can be avoided.
+    //
+    int64_t last = (int64_t) (buffer->size / width) - height + 3;
+    if (scroll > last) {
+        scroll = last;
+    }
+
+    if (scroll < 0) {
+        scroll = 0;
+    }
+
+    return scroll;
+}
+
+uint64_t
+buffer_follow(buffer_t *buffer, uint64_t address, int width, int height)
+{
+    uint64_t rows = height - 2;
+    uint64_t scroll = address / width;
+    uint64_t row = buffer->cursor / width;
+
+    if (row < scroll) {
+        scroll = row;
+    } else if (row >= scroll + rows) {
+        scroll = row - rows + 1;
+    }
+
+    return scroll;
+}
+
+void
+buffer_view(buffer_t *buffer, uint64_t scroll, int width, int height, uint64_t *address, uint64_t *size)
+{
+    uint64_t start = scroll * width;
+    uint64_t end = start + (uint64_t) (height - 2) * width;
+
+    if (start > buffer->size) {
+        start = buffer->size;
+    }
+
+    if (end > buffer->size) {
+        end = buffer->size;
+    }
+
+    *address = start;
+    *size = end - start;
+}
+
+// Returns whether a comment can be named in an expression.
+//
+static int
+buffer_is_symbol(const char *name)
+{
+    if (!isalpha(*name) && *name != '_') {
+        return 0;
+    }
+
+    for (; *name != '\0'; name++) {
+        if (!isalnum(*name) && *name != '_') {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// Removes the name of the comment at address, unless a later comment took it.
+//
+static void
+buffer_remove_symbol(buffer_t *buffer, uintptr_t address)
+{
+    const char *comment = g_hash_table_lookup(buffer->comments, GSIZE_TO_POINTER(address));
+    gpointer symbol;
+    if (comment != NULL && g_hash_table_lookup_extended(buffer->symbols, comment, NULL, &symbol)
+            && GPOINTER_TO_SIZE(symbol) == address) {
+        g_hash_table_remove(buffer->symbols, comment);
+    }
+}
+
+void
+buffer_add_comment(buffer_t *buffer, uintptr_t address, char *message)
+{
+    buffer_remove_symbol(buffer, address);
+
+    // The symbol shares its key with the comment.
+    //
+    buffer->names++;
+    char *comment = g_strdup(message);
+    g_hash_table_insert(buffer->comments, GSIZE_TO_POINTER(address), comment);
+    if (buffer_is_symbol(comment)) {
+        g_hash_table_replace(buffer->symbols, comment, GSIZE_TO_POINTER(address));
+    }
+}
+
+void
+buffer_remove_comment(buffer_t *buffer, uintptr_t address)
+{
+    buffer->names++;
+    buffer_remove_symbol(buffer, address);
+    g_hash_table_remove(buffer->comments, GSIZE_TO_POINTER(address));
+}
+
+int
+buffer_symbol(buffer_t *buffer, const char *name, uint64_t *address)
+{
+    gpointer symbol;
+    if (g_hash_table_lookup_extended(buffer->symbols, name, NULL, &symbol)) {
+        *address = GPOINTER_TO_SIZE(symbol);
+        return 0;
+    }
+
+    if (name[0] == 'b' && name[1] == 'm' && name[2] >= '0' && name[2] <= '9' && name[3] == '\0') {
+        int depth = name[2] - '0';
+        if (depth <= buffer->bookmarks_head) {
+            *address = buffer->bookmarks[buffer->bookmarks_head - depth];
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int
+buffer_import_symbols(buffer_t *buffer, const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return -1;
+    }
+
+    char *line = NULL;
+    size_t line_size = 0;
+    int imported = 0;
+
+    while (getline(&line, &line_size, file) != -1) {
+        // The address is first and the name last, as in the output of nm.
+        //
+        char *end;
+        uint64_t address = strtoull(line, &end, 16);
+        if (end == line || !isspace(*end)) {
+            continue;
+        }
+
+        g_strchomp(end);
+        char *name = end + strlen(end);
+        while (name > end && !isspace(name[-1])) {
+            name--;
+        }
+
+        if (address < buffer->size && buffer_is_symbol(name)) {
+            buffer_add_comment(buffer, address, name);
+            imported++;
+        }
+    }
+
+    free(line);
+    fclose(file);
+    return imported;
 }
 
 const char*
@@ -325,6 +2392,7 @@ void
 buffer_bookmark_push(buffer_t *buffer, uintptr_t address)
 {
     if (buffer->bookmarks_head < BOOKMARK_STACK_SIZE - 1) {
+        buffer->names++;
         buffer->bookmarks[++buffer->bookmarks_head] = address;
     }
 }
@@ -333,6 +2401,7 @@ uint64_t
 buffer_bookmark_pop(buffer_t *buffer, int width, int height, int *error)
 {
     if (buffer->bookmarks_head >= 0) {
+        buffer->names++;
         uintptr_t address = buffer->bookmarks[buffer->bookmarks_head--];
         *error = 0;
         return buffer_scroll(buffer, address, width, height);
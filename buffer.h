@@ -5,12 +5,97 @@
 #include <gmodule.h>
 
 #define BOOKMARK_STACK_SIZE 8
+// Edits whose ranges are kept, see buffer_changed.
+//
+#define BUFFER_EDITS 64
 
 typedef uintptr_t cursor_t;
 
+// A run of the bytes of a buffer, either added by an edit or, if data is NULL,
+// those of the file from source.
+//
+typedef struct {
+    uint64_t start;
+    uint64_t size;
+    const uint8_t *data;
+    uint64_t source;
+} piece_t;
+
+// An edit, which replaced the pieces of a range of the buffer. Undoing it puts
+// them back. The starts of the pieces are relative to the address.
+//
+typedef struct {
+    uint64_t address;
+    // Size of the range after and before the edit.
+    //
+    uint64_t size;
+    uint64_t replaced_size;
+    GArray *replaced;
+} journal_t;
+
+// The pieces of a buffer when it was taken, to compare the buffer with. They
+// refer to the file and the blocks of the buffer, so taking a snapshot copies
+// no bytes, and snapshots are dropped when the buffer is saved.
+//
+typedef struct {
+    char *name;
+    uint64_t size;
+    GArray *pieces;
+} snapshot_t;
+
+// A range of a buffer.
+//
+typedef struct {
+    uint64_t address;
+    uint64_t size;
+} extent_t;
+
 typedef struct {
     size_t size;
+    // The mapping of the file. The bytes of the buffer are the pieces, in
+    // order, over the mapping and the blocks added by edits.
+    //
     uint8_t *data;
+    size_t data_size;
+    GArray *pieces;
+    GPtrArray *blocks;
+    // Free space at the end of the last block, shared by small edits.
+    //
+    uint8_t *block;
+    size_t block_free;
+    // Edits that can be undone, the last one last, and those undone that can
+    // be redone.
+    //
+    GArray *undo;
+    GArray *redo;
+    // If != 0, the pieces differ from the file.
+    //
+    int modified;
+    // If != 0, saving failed after it started writing the file, which no
+    // longer holds the bytes the pieces refer to. The buffer can then no
+    // longer be edited or saved.
+    //
+    int failed;
+    // Snapshots taken since the buffer was last saved, the oldest first.
+    //
+    GArray *snapshots;
+    // If not NULL, called after every change to the pieces, edits and undos
+    // alike, with the range replaced and the pieces replacing it, whose starts
+    // are relative to address.
+    //
+    void (*recorder)(void *user_data, uint64_t address, uint64_t size, const piece_t *pieces, guint pieces_size);
+    void *recorder_data;
+    // Pieces copied from a range, with starts relative to it. Pieces do not
+    // change, so the clipboard refers to the bytes copied without copying
+    // them, until saving the buffer would change them: then they are copied
+    // to the clipboard's own blocks.
+    //
+    GArray *clipboard;
+    uint64_t clipboard_size;
+    GPtrArray *clipboard_blocks;
+    // If != 0, no piece of the clipboard refers to a block of the buffer.
+    //
+    int clipboard_owned;
     int f;
     const char *path;
     // If a mark is set, both marks != -1. Otherwise, the end mark is set to the cursor
@@ -21,10 +106,27 @@ typedef struct {
     cursor_t cursor;
 
     GHashTable *comments;
+    // The addresses of comments that are identifiers, by name.
+    //
+    GHashTable *symbols;
     GSList *highlights;
     uintptr_t bookmarks[BOOKMARK_STACK_SIZE];
     int bookmarks_head;
     int editable;
+    // Number of writes so far, and the ranges of the last BUFFER_EDITS.
+    //
+    uint64_t edits;
+    uint64_t edit_start[BUFFER_EDITS];
+    uint64_t edit_end[BUFFER_EDITS];
+    // Incremented whenever a name may resolve differently, as comments and
+    // bookmarks change.
+    //
+    uint64_t names;
+
+    // Held for writing while the mapping is replaced, and for reading by
+    // background threads while they read from the buffer.
+    //
+    GRWLock lock;
 } buffer_t;
 
 typedef struct {
@@ -33,6 +135,13 @@ typedef struct {
     uint32_t color;
 } range_t;
 
+// Reports the progress of an operation over a range, in bytes.
+//
+typedef struct {
+    void (*report)(void *user_data, uint64_t done, uint64_t total);
+    void *user_data;
+} progress_t;
+
 void buffer_from_data(buffer_t *buffer, const uint8_t *data, size_t size);
 int buffer_open(buffer_t *buffer, const char *path);
 int buffer_close(buffer_t *buffer);
@@ -43,6 +152,101 @@ int buffer_close(buffer_t *buffer);
 int buffer_try_reopen(buffer_t *buffer);
 
 int buffer_read(buffer_t *buffer, void *data, size_t size);
+int buffer_read_at(buffer_t *buffer, uint64_t address, void *data, size_t size);
+// Returns a pointer to the contiguous bytes of the buffer from address, and
+// sets size to their number, or NULL if address is out of bounds. The pointer is
+// invalidated when the buffer is remapped.
+//
+const uint8_t *buffer_span(buffer_t *buffer, uint64_t address, uint64_t *size);
+// Writes bytes at address as one edit, and logs the range written. Returns 1 if
+// the range is out of bounds. The buffer MUST be editable.
+//
+int buffer_write(buffer_t *buffer, uint64_t address, const void *data, size_t size);
+// Inserts bytes at address, which may be the size of the buffer, as one edit.
+// Returns 1 if address is out of bounds. The buffer MUST be editable.
+//
+int buffer_insert(buffer_t *buffer, uint64_t address, const void *data, size_t size);
+// Replaces a range with pieces as one edit, copying the bytes of those with
+// data. Returns 1 if the range, or the bytes of the file a piece refers to, are
+// out of bounds, or the buffer would be empty. The buffer MUST be editable.
+//
+int buffer_apply(buffer_t *buffer, uint64_t address, uint64_t size, const piece_t *pieces, guint pieces_size);
+// Deletes a range as one edit. Returns 1 if it is out of bounds, or the whole
+// buffer, which is never empty. The buffer MUST be editable.
+//
+int buffer_delete(buffer_t *buffer, uint64_t address, uint64_t size);
+// Replaces the size bytes at each of count addresses, in ascending order, with
+// data as one edit. Addresses that overlap the occurrence replaced before are
+// skipped, and replaced is set to the number of those replaced. Returns 1 if
+// an address is out of bounds, or the buffer would be empty. The buffer MUST
+// be editable.
+//
+int buffer_replace(buffer_t *buffer, const uint64_t *addresses, size_t count, uint64_t size, const void *data,
+        size_t data_size, size_t *replaced);
+// Undoes or redoes the last edit, setting address to its start. Returns 1 if
+// there is none.
+//
+int buffer_undo(buffer_t *buffer, uint64_t *address);
+int buffer_redo(buffer_t *buffer, uint64_t *address);
+// Copies a range to the clipboard. Returns 1 if it is out of bounds.
+//
+int buffer_copy(buffer_t *buffer, uint64_t address, uint64_t size);
+// Overwrites the bytes from address with the clipboard, or inserts it there if
+// insert != 0, as one edit. Returns 1 if the clipboard is empty or does not
+// fit. The buffer MUST be editable.
+//
+int buffer_paste(buffer_t *buffer, uint64_t address, int insert);
+// Takes a snapshot of the buffer, replacing any of the same name.
+//
+void buffer_snapshot(buffer_t *buffer, const char *name);
+// Appends to extents the runs of [address, address + size) whose bytes may
+// differ from those of the snapshot at the same offsets: those that are not
+// the same bytes of the file or of an edit in both, and those past the end of
+// the snapshot. Only the pieces are compared, not their bytes, so the cost is
+// in the number of edits rather than the size of the range. Returns 1 if the
+// range is out of bounds.
+//
+int buffer_diff(buffer_t *buffer, const snapshot_t *snapshot, uint64_t address, uint64_t size, GArray *extents);
+// Sets changed[i] to 1 if the byte at address + i differs from the byte of the
+// snapshot at the same offset, or 0 otherwise. Only the bytes of the extents
+// of buffer_diff are read. Returns 1 if the range is out of bounds.
+//
+int buffer_compare(buffer_t *buffer, const snapshot_t *snapshot, uint64_t address, uint64_t size,
+        uint8_t *changed);
+// Decodes text of pairs of hex digits, or else of base64, ignoring spaces and
+// newlines. Returns the bytes, which must be freed with g_free, and sets
+// data_size, or returns NULL if the text is neither or decodes to nothing.
+//
+uint8_t *buffer_decode(const char *text, size_t size, size_t *data_size);
+// Writes the edits to the file, after which they can no longer be undone.
+// Only the bytes from the first change on are written: the bytes of the file
+// moved by inserts and deletes are copied within the file in large chunks, so
+// that saving takes no more memory than the edits, unless pasting reordered
+// them. The space the file grows by is allocated first, so that it runs out
+// before anything is written. Returns 1 if the file could not be written, and
+// sets failed if it was left partly written.
+//
+int buffer_save(buffer_t *buffer);
+// Saves the edits, then cuts the file to size bytes, or extends it to size
+// bytes with the fill repeated from the previous end, in place. Zeroes, or an
+// empty fill, are not written: the file system keeps them as a hole, so
+// extending takes no time or space whatever the size. Like saving, this cannot
+// be undone. Returns 1 if size is 0, or the file could not be resized. The
+// buffer MUST be editable.
+//
+int buffer_resize(buffer_t *buffer, uint64_t size, const uint8_t *fill, size_t fill_size);
+// Writes the bytes of the buffer to a new file at path, replacing it once
+// complete, and leaves the buffer and its file as they are. The bytes of the
+// file are shared with the copy where the file system can clone them, and
+// copied within the kernel otherwise: only the bytes added by edits are
+// written. Returns 1 if the copy could not be written, or 2 if path is the
+// file itself, which is saved with buffer_save.
+//
+int buffer_save_as(buffer_t *buffer, const char *path);
+// Returns whether bytes of the range were written since the buffer had made
+// edits writes, or 1 if too many writes were made since to tell.
+//
+int buffer_changed(buffer_t *buffer, uint64_t edits, uint64_t address, uint64_t size);
 int buffer_read_u8(buffer_t *buffer, uint8_t *data);
 int buffer_read_i8(buffer_t *buffer, int8_t *data);
 int buffer_read_lu16(buffer_t *buffer, uint16_t *data);
@@ -58,15 +262,97 @@ int buffer_read_bi32(buffer_t *buffer, int32_t *data);
 int buffer_read_li64(buffer_t *buffer, int64_t *data);
 int buffer_read_bi64(buffer_t *buffer, int64_t *data);
 
+// Sets address and size to the selected range. Returns 1 if there is no
+// selection.
+//
+int buffer_selection(buffer_t *buffer, uint64_t *address, uint64_t *size);
+
+// Functions over a range of the buffer. Each returns 1 if the range is out of
+// bounds, and reports its progress if progress is not NULL.
+//
+// Counts the occurrences of each byte value.
+//
+int buffer_histogram(buffer_t *buffer, uint64_t address, uint64_t size, const progress_t *progress,
+        uint64_t histogram[256]);
+// CRC-32 (ISO-HDLC), as used by zlib and PNG.
+//
+int buffer_crc32(buffer_t *buffer, uint64_t address, uint64_t size, const progress_t *progress, uint32_t *crc);
+// Continues the CRC-32 of the bytes before data, 0 if there are none, over
+// size more bytes.
+//
+uint32_t buffer_crc32_data(uint32_t crc, const void *data, uint64_t size);
+// Sum and exclusive or of the bytes.
+//
+int buffer_sum(buffer_t *buffer, uint64_t address, uint64_t size, const progress_t *progress, uint64_t *sum);
+int buffer_xor(buffer_t *buffer, uint64_t address, uint64_t size, const progress_t *progress, uint8_t *xor);
+// Counts the occurrences of a byte value.
+//
+int buffer_count(buffer_t *buffer, uint64_t address, uint64_t size, uint8_t byte, const progress_t *progress,
+        uint64_t *count);
+
+// Block operations, rewriting a range as one edit.
+//
+typedef enum {
+    // Repeats the key over the range.
+    //
+    BLOCK_FILL,
+    // Exclusive or, and add, each byte with the byte of the key repeated from
+    // the start of the range.
+    //
+    BLOCK_XOR,
+    BLOCK_ADD,
+    // Reverses the order of the bytes of each 16, 32 or 64-bit word. Bytes
+    // past the last whole word are unchanged.
+    //
+    BLOCK_SWAP16,
+    BLOCK_SWAP32,
+    BLOCK_SWAP64,
+    // Reverses the order of the bytes of the range.
+    //
+    BLOCK_REVERSE,
+    // Adds one to each byte.
+    //
+    BLOCK_INCREMENT,
+} block_t;
+
+#define BLOCK_KEY_SIZE 64
+
+// Applies a block operation to a range, with a key of 1 to BLOCK_KEY_SIZE bytes
+// for those that take one. Returns 1 if the range is out of bounds or the key
+// is invalid. The buffer MUST be editable.
+//
+int buffer_block(buffer_t *buffer, uint64_t address, uint64_t size, block_t block, const uint8_t *key,
+        size_t key_size);
+
 // Returns the scroll required to centre the offset in a buffer view, and sets
 // the cursor to "offset", or the start/end of the buffer if the offset is out
 // of range.
 //
 uint64_t buffer_scroll(buffer_t *buffer, uint64_t offset, int width, int height);
+// Returns the scroll that places the cursor on the given row of a buffer view,
+// clamped so that the cursor remains visible. The cursor is not moved.
+//
+uint64_t buffer_anchor(buffer_t *buffer, int64_t row, int width, int height);
+// Returns the scroll that places address on the top row of a buffer view, or
+// as close as possible while keeping the cursor visible.
+//
+uint64_t buffer_follow(buffer_t *buffer, uint64_t address, int width, int height);
+// Sets address and size to the range of the buffer visible in a view.
+//
+void buffer_view(buffer_t *buffer, uint64_t scroll, int width, int height, uint64_t *address, uint64_t *size);
 
 void buffer_add_comment(buffer_t *buffer, uintptr_t address, char *message);
 void buffer_remove_comment(buffer_t *buffer, uintptr_t address);
 const char *buffer_lookup_comment(buffer_t *buffer, uintptr_t address);
+// Sets address to the comment named name, or to a bookmark for bm0 to bm7,
+// bm0 being the last pushed. Returns 1 if there is none.
+//
+int buffer_symbol(buffer_t *buffer, const char *name, uint64_t *address);
+// Adds a comment for each line of a file with a hex address first and a name
+// last, such as the output of nm. Returns the number of comments added, or -1
+// if the file cannot be read.
+//
+int buffer_import_symbols(buffer_t *buffer, const char *path);
 
 // If size is 0, remove the highlight.
 //
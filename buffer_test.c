@@ -0,0 +1,537 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#include "buffer.h"
+
+// Applies a block operation a byte at a time.
+//
+void
+block_reference(uint8_t *data, uint64_t size, block_t block, const uint8_t *key, size_t key_size)
+{
+    int width = block == BLOCK_SWAP16 ? 2 : block == BLOCK_SWAP32 ? 4 : 8;
+
+    switch (block) {
+    case BLOCK_FILL:
+    case BLOCK_XOR:
+    case BLOCK_ADD:
+        for (uint64_t i = 0; i < size; i++) {
+            uint8_t k = key[i % key_size];
+            data[i] = block == BLOCK_FILL ? k : block == BLOCK_XOR ? data[i] ^ k : data[i] + k;
+        }
+        break;
+    case BLOCK_SWAP16:
+    case BLOCK_SWAP32:
+    case BLOCK_SWAP64:
+        for (uint64_t i = 0; i + width <= size; i += width) {
+            uint8_t word[8];
+            memcpy(word, data + i, width);
+            for (int j = 0; j < width; j++) {
+                data[i + j] = word[width - 1 - j];
+            }
+        }
+        break;
+    case BLOCK_REVERSE:
+        for (uint64_t i = 0; i < size / 2; i++) {
+            uint8_t byte = data[i];
+            data[i] = data[size - 1 - i];
+            data[size - 1 - i] = byte;
+        }
+        break;
+    case BLOCK_INCREMENT:
+        for (uint64_t i = 0; i < size; i++) {
+            data[i]++;
+        }
+        break;
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    // Edits are pieces over the data, which is left unchanged, and are undone
+    // and redone whole.
+    //
+    {
+        uint8_t data[300];
+        for (int i = 0; i < sizeof(data); i++) {
+            data[i] = i;
+        }
+
+        buffer_t edited;
+        buffer_from_data(&edited, data, sizeof(data));
+
+        const uint8_t bytes[] = { 0xaa, 0xbb, 0xcc, 0xdd };
+        assert(buffer_write(&edited, 10, bytes, 4) == 0);
+        assert(buffer_write(&edited, 12, bytes, 4) == 0);
+        assert(data[12] == 12);
+
+        uint8_t read[8];
+        const uint8_t written[] = { 8, 9, 0xaa, 0xbb, 0xaa, 0xbb, 0xcc, 0xdd };
+        assert(buffer_read_at(&edited, 8, read, 8) == 0 && memcmp(read, written, 8) == 0);
+        uint64_t value;
+        edited.cursor = 8;
+        assert(buffer_read_bu64(&edited, &value) == 0 && value == 0x0809aabbaabbccdd);
+
+        uint64_t address;
+        const uint8_t undone[] = { 8, 9, 0xaa, 0xbb, 0xcc, 0xdd, 14, 15 };
+        assert(buffer_undo(&edited, &address) == 0 && address == 12);
+        assert(buffer_read_at(&edited, 8, read, 8) == 0 && memcmp(read, undone, 8) == 0);
+        assert(buffer_undo(&edited, &address) == 0 && address == 10);
+        assert(buffer_read_at(&edited, 8, read, 8) == 0 && memcmp(read, data + 8, 8) == 0);
+        assert(buffer_undo(&edited, &address) != 0);
+        assert(edited.pieces->len == 1);
+
+        assert(buffer_redo(&edited, &address) == 0 && address == 10);
+        assert(buffer_read_at(&edited, 8, read, 8) == 0 && memcmp(read, undone, 8) == 0);
+        assert(buffer_write(&edited, 0, bytes, 1) == 0);
+        assert(buffer_redo(&edited, &address) != 0);
+
+        // Block operations, from offsets and of sizes around the vector width,
+        // match those a byte at a time.
+        //
+        const uint8_t key[] = { 0x01, 0x80, 0xff, 0x7f, 0x10, 0x20, 0x30 };
+        const uint64_t sizes[] = { 0, 1, 7, 15, 16, 17, 31, 32, 33, 64, 255 };
+        for (block_t block = BLOCK_FILL; block <= BLOCK_INCREMENT; block++) {
+            for (int i = 0; i < sizeof(sizes) / sizeof(*sizes); i++) {
+                for (size_t key_size = 1; key_size <= sizeof(key); key_size += 3) {
+                    uint8_t expected[300];
+                    assert(buffer_read_at(&edited, 0, expected, sizeof(expected)) == 0);
+                    block_reference(expected + 3, sizes[i], block, key, key_size);
+
+                    assert(buffer_block(&edited, 3, sizes[i], block, key, key_size) == 0);
+
+                    uint8_t actual[300];
+                    assert(buffer_read_at(&edited, 0, actual, sizeof(actual)) == 0);
+                    assert(memcmp(actual, expected, sizeof(actual)) == 0);
+                }
+            }
+        }
+
+        assert(buffer_block(&edited, 290, 11, BLOCK_REVERSE, NULL, 0) != 0);
+        assert(buffer_block(&edited, 0, 8, BLOCK_XOR, key, 0) != 0);
+        assert(buffer_block(&edited, 0, 8, BLOCK_FILL, data, BLOCK_KEY_SIZE + 1) != 0);
+
+        // Undoing every edit restores the data.
+        //
+        while (buffer_undo(&edited, &address) == 0);
+        uint8_t restored[300];
+        assert(buffer_read_at(&edited, 0, restored, sizeof(restored)) == 0);
+        assert(memcmp(restored, data, sizeof(data)) == 0);
+
+        buffer_close(&edited);
+    }
+
+    // Pasted text is decoded as hex, or else base64, across lines.
+    //
+    {
+        size_t size;
+        uint8_t *data = buffer_decode("de ad\nBE ef\n", 12, &size);
+        assert(data != NULL && size == 4 && memcmp(data, "\xde\xad\xbe\xef", 4) == 0);
+        g_free(data);
+
+        data = buffer_decode("aGV4\neGVk", 9, &size);
+        assert(data != NULL && size == 6 && memcmp(data, "hexxed", 6) == 0);
+        g_free(data);
+
+        data = buffer_decode("aGV4eA==\n", 9, &size);
+        assert(data != NULL && size == 4 && memcmp(data, "hexx", 4) == 0);
+        g_free(data);
+
+        assert(buffer_decode("abc", 3, &size) == NULL);
+        assert(buffer_decode("aGV4e", 5, &size) == NULL);
+        assert(buffer_decode("aG==eA==", 8, &size) == NULL);
+        assert(buffer_decode(" \n", 2, &size) == NULL);
+
+        // A large paste is a single edit.
+        //
+        size_t text_size = 2 * 65536;
+        char *text = g_malloc(text_size);
+        for (size_t i = 0; i < text_size; i++) {
+            text[i] = "0123456789abcdef"[i % 16];
+        }
+
+        data = buffer_decode(text, text_size, &size);
+        assert(data != NULL && size == 65536 && data[0] == 0x01 && data[7] == 0xef);
+
+        uint8_t *bytes = g_malloc0(2 * size);
+        buffer_t pasted;
+        buffer_from_data(&pasted, bytes, 2 * size);
+        assert(buffer_write(&pasted, 100, data, size) == 0 && pasted.undo->len == 1);
+
+        uint8_t actual[8];
+        assert(buffer_read_at(&pasted, 100, actual, 8) == 0 && memcmp(actual, data, 8) == 0);
+
+        buffer_close(&pasted);
+        g_free(bytes);
+        g_free(data);
+        g_free(text);
+    }
+
+    // Snapshots are compared through their pieces: only the ranges edited
+    // since are read, and undoing back to a snapshot leaves no differences.
+    //
+    {
+        size_t size = 1 << 20;
+        uint8_t *data = g_malloc(size);
+        for (size_t i = 0; i < size; i++) {
+            data[i] = i * 7;
+        }
+
+        buffer_t compared;
+        buffer_from_data(&compared, data, size);
+        buffer_snapshot(&compared, "base");
+
+        GArray *extents = g_array_new(FALSE, FALSE, sizeof(extent_t));
+        const snapshot_t *base = &g_array_index(compared.snapshots, snapshot_t, 0);
+        assert(buffer_diff(&compared, base, 0, size, extents) == 0 && extents->len == 0);
+
+        // The same byte written again is in a differing range, but is not
+        // changed.
+        //
+        assert(buffer_write(&compared, 1000, (const uint8_t[]) { 0xaa, 0xbb }, 2) == 0);
+        assert(buffer_write(&compared, 999, data + 999, 1) == 0);
+        assert(buffer_write(&compared, 5000, data + 5000, 1) == 0);
+        buffer_snapshot(&compared, "written");
+        assert(compared.snapshots->len == 2);
+        base = &g_array_index(compared.snapshots, snapshot_t, 0);
+
+        assert(buffer_diff(&compared, base, 0, size, extents) == 0 && extents->len == 2);
+        extent_t first = g_array_index(extents, extent_t, 0);
+        extent_t second = g_array_index(extents, extent_t, 1);
+        assert(first.address == 999 && first.size == 3 && second.address == 5000 && second.size == 1);
+
+        uint8_t changed[16];
+        assert(buffer_compare(&compared, base, 996, sizeof(changed), changed) == 0);
+        for (int i = 0; i < sizeof(changed); i++) {
+            assert(changed[i] == (996 + i == 1000 || 996 + i == 1001));
+        }
+
+        // Inserting moves the bytes after it, which all differ in place, and
+        // bytes past the end of the snapshot are changed.
+        //
+        assert(buffer_insert(&compared, size - 4, (const uint8_t[]) { 1, 2 }, 2) == 0);
+        g_array_set_size(extents, 0);
+        assert(buffer_diff(&compared, base, size - 8, 10, extents) == 0 && extents->len == 1);
+        assert(g_array_index(extents, extent_t, 0).address == size - 4);
+        assert(buffer_compare(&compared, base, size - 8, 10, changed) == 0);
+        assert(changed[0] == 0 && changed[8] == 1 && changed[9] == 1);
+
+        uint64_t address;
+        while (buffer_undo(&compared, &address) == 0);
+        g_array_set_size(extents, 0);
+        assert(buffer_diff(&compared, base, 0, size, extents) == 0 && extents->len == 0);
+
+        const snapshot_t *written = &g_array_index(compared.snapshots, snapshot_t, 1);
+        assert(strcmp(written->name, "written") == 0);
+        assert(buffer_compare(&compared, written, 1000, 2, changed) == 0 && changed[0] && changed[1]);
+        assert(buffer_diff(&compared, written, size, 1, extents) != 0);
+
+        // Taking a snapshot of the same name replaces it.
+        //
+        buffer_snapshot(&compared, "base");
+        assert(compared.snapshots->len == 2);
+        assert(strcmp(g_array_index(compared.snapshots, snapshot_t, 1).name, "base") == 0);
+
+        g_array_free(extents, TRUE);
+        buffer_close(&compared);
+        g_free(data);
+    }
+
+    // The clipboard refers to the pieces copied, and keeps their bytes when
+    // saving overwrites them.
+    //
+    {
+        uint8_t data[256];
+        for (int i = 0; i < sizeof(data); i++) {
+            data[i] = i;
+        }
+
+        char path[] = "/tmp/buffer_test.XXXXXX";
+        int file = mkstemp(path);
+        assert(file >= 0);
+        assert(write(file, data, sizeof(data)) == sizeof(data));
+        close(file);
+
+        buffer_t saved;
+        assert(buffer_open(&saved, path) == 0);
+        assert(buffer_try_reopen(&saved) == 0);
+
+        const uint8_t bytes[] = { 0xaa, 0xbb, 0xcc, 0xdd };
+        assert(buffer_write(&saved, 18, bytes, 4) == 0);
+        assert(buffer_copy(&saved, 16, 16) == 0);
+        assert(saved.clipboard->len == 3);
+        assert(buffer_write(&saved, 24, bytes, 4) == 0);
+        assert(buffer_save(&saved) == 0);
+
+        uint8_t copied[16];
+        memcpy(copied, data + 16, 16);
+        memcpy(copied + 2, bytes, 4);
+
+        // Pasting over the bytes copied, and saving again.
+        //
+        uint8_t pasted[16];
+        assert(buffer_paste(&saved, 20, 0) == 0);
+        assert(buffer_paste(&saved, 250, 0) != 0);
+        assert(buffer_read_at(&saved, 20, pasted, 16) == 0 && memcmp(pasted, copied, 16) == 0);
+        assert(buffer_save(&saved) == 0);
+        assert(buffer_paste(&saved, 100, 0) == 0);
+        assert(buffer_save(&saved) == 0);
+        buffer_close(&saved);
+
+        uint8_t expected[256];
+        memcpy(expected, data, sizeof(data));
+        memcpy(expected + 18, bytes, 2);
+        memcpy(expected + 20, copied, 16);
+        memcpy(expected + 100, copied, 16);
+
+        uint8_t contents[256];
+        file = open(path, O_RDONLY);
+        assert(read(file, contents, sizeof(contents)) == sizeof(contents));
+        assert(memcmp(contents, expected, sizeof(expected)) == 0);
+        close(file);
+        unlink(path);
+    }
+
+    // Saving a file that cannot grow fails before anything is written, and
+    // leaves the buffer to save again.
+    //
+    {
+        uint8_t data[4096];
+        for (int i = 0; i < sizeof(data); i++) {
+            data[i] = i * 3;
+        }
+
+        char path[] = "/tmp/buffer_test.XXXXXX";
+        int file = mkstemp(path);
+        assert(file >= 0);
+        assert(write(file, data, sizeof(data)) == sizeof(data));
+        close(file);
+
+        buffer_t grown;
+        assert(buffer_open(&grown, path) == 0);
+        assert(buffer_try_reopen(&grown) == 0);
+        assert(buffer_insert(&grown, 16, data, 16) == 0);
+
+        struct rlimit limit, previous;
+        assert(getrlimit(RLIMIT_FSIZE, &previous) == 0);
+        limit = previous;
+        limit.rlim_cur = sizeof(data);
+        signal(SIGXFSZ, SIG_IGN);
+        assert(setrlimit(RLIMIT_FSIZE, &limit) == 0);
+
+        assert(buffer_save(&grown) != 0);
+        assert(!grown.failed && grown.editable && grown.modified);
+
+        uint8_t contents[sizeof(data) + 16];
+        file = open(path, O_RDONLY);
+        assert(read(file, contents, sizeof(contents)) == sizeof(data));
+        assert(memcmp(contents, data, sizeof(data)) == 0);
+        close(file);
+
+        assert(setrlimit(RLIMIT_FSIZE, &previous) == 0);
+        signal(SIGXFSZ, SIG_DFL);
+
+        assert(buffer_save(&grown) == 0);
+        assert(buffer_read_at(&grown, 16, contents, 16) == 0 && memcmp(contents, data, 16) == 0);
+        buffer_close(&grown);
+        unlink(path);
+    }
+
+    // Resizing saves the edits and cuts or extends the file in place. Zeroes
+    // are left to the file system, and other fills copied from the first
+    // chunk written.
+    //
+    {
+        uint8_t data[256];
+        for (int i = 0; i < sizeof(data); i++) {
+            data[i] = i;
+        }
+
+        char path[] = "/tmp/buffer_test.XXXXXX";
+        int file = mkstemp(path);
+        assert(file >= 0);
+        assert(write(file, data, sizeof(data)) == sizeof(data));
+        close(file);
+
+        buffer_t resized;
+        assert(buffer_open(&resized, path) == 0);
+        assert(buffer_try_reopen(&resized) == 0);
+
+        const uint8_t bytes[] = { 0xaa, 0xbb, 0xcc, 0xdd };
+        assert(buffer_write(&resized, 10, bytes, 4) == 0);
+        assert(buffer_copy(&resized, 200, 16) == 0);
+        assert(buffer_resize(&resized, 0, NULL, 0) != 0);
+
+        // The bytes cut are changed for results read from them.
+        //
+        uint64_t edits = resized.edits;
+        assert(buffer_resize(&resized, 100, NULL, 0) == 0);
+        assert(resized.size == 100 && resized.data_size == 100 && !resized.modified);
+        assert(buffer_changed(&resized, edits, 0, 100) == 0 && buffer_changed(&resized, edits, 150, 8) == 1);
+
+        uint8_t read[16];
+        assert(buffer_read_at(&resized, 10, read, 4) == 0 && memcmp(read, bytes, 4) == 0);
+        assert(buffer_read_at(&resized, 100, read, 1) != 0);
+
+        // The bytes copied past the cut are kept by the clipboard.
+        //
+        assert(buffer_paste(&resized, 20, 0) == 0);
+        assert(buffer_read_at(&resized, 20, read, 16) == 0 && memcmp(read, data + 200, 16) == 0);
+
+        // Copying again leaves the bytes pasted, and those the undo journal
+        // refers to.
+        //
+        assert(buffer_copy(&resized, 0, 4) == 0);
+        assert(buffer_read_at(&resized, 20, read, 16) == 0 && memcmp(read, data + 200, 16) == 0);
+        uint64_t address;
+        assert(buffer_undo(&resized, &address) == 0 && buffer_redo(&resized, &address) == 0);
+        assert(buffer_read_at(&resized, 20, read, 16) == 0 && memcmp(read, data + 200, 16) == 0);
+
+        uint64_t extended = 8 * 1024 * 1024;
+        assert(buffer_resize(&resized, extended, NULL, 0) == 0);
+        assert(resized.size == extended && !resized.modified);
+
+        // The zeroes take no space where the file system reports holes.
+        //
+        struct stat status;
+        assert(stat(path, &status) == 0 && status.st_size == extended);
+
+        file = open(path, O_RDONLY);
+        assert(file >= 0);
+        if (lseek(file, 0, SEEK_HOLE) < extended) {
+            assert(status.st_blocks * 512 < 1024 * 1024);
+        }
+        close(file);
+
+        const uint8_t zeroes[16] = { 0 };
+        assert(buffer_read_at(&resized, extended - 16, read, 16) == 0 && memcmp(read, zeroes, 16) == 0);
+        assert(buffer_read_at(&resized, 20, read, 16) == 0 && memcmp(read, data + 200, 16) == 0);
+
+        const uint8_t fill[] = { 1, 2, 3 };
+        uint64_t filled = 20 * 1024 * 1024 + 5;
+        assert(buffer_resize(&resized, 100, NULL, 0) == 0);
+        assert(buffer_resize(&resized, 100 + filled, fill, sizeof(fill)) == 0);
+        assert(resized.size == 100 + filled);
+
+        const uint64_t probes[] = { 0, 1, 8 * 1024 * 1024 - 1, 8 * 1024 * 1024, 12345678, filled - 1 };
+        for (int i = 0; i < sizeof(probes) / sizeof(*probes); i++) {
+            uint8_t byte;
+            assert(buffer_read_at(&resized, 100 + probes[i], &byte, 1) == 0 && byte == fill[probes[i] % 3]);
+        }
+
+        assert(buffer_read_at(&resized, 10, read, 4) == 0 && memcmp(read, bytes, 4) == 0);
+        buffer_close(&resized);
+        unlink(path);
+    }
+
+    // Inserts and deletes move the bytes after them, and saving moves them
+    // within the file, in chunks, in whichever order leaves the bytes to move.
+    //
+    {
+        size_t size = 20 * 1024 * 1024;
+        uint8_t *data = g_malloc(size);
+        for (size_t i = 0; i < size; i++) {
+            data[i] = i * 7 + (i >> 12);
+        }
+
+        char path[] = "/tmp/buffer_test.XXXXXX";
+        int file = mkstemp(path);
+        assert(file >= 0);
+        assert(write(file, data, size) == size);
+        close(file);
+
+        buffer_t moved;
+        assert(buffer_open(&moved, path) == 0);
+        assert(buffer_try_reopen(&moved) == 0);
+
+        const uint8_t header[] = { 'H', 'E', 'A', 'D' };
+        uint64_t middle = 12 * 1024 * 1024;
+        assert(buffer_insert(&moved, 0, header, 4) == 0);
+        assert(buffer_delete(&moved, middle, 3) == 0);
+        assert(buffer_insert(&moved, moved.size, header, 4) == 0);
+        assert(buffer_insert(&moved, moved.size + 1, header, 4) != 0);
+        assert(buffer_delete(&moved, 0, moved.size) != 0);
+        assert(moved.size == size + 5);
+
+        uint64_t address;
+        assert(buffer_undo(&moved, &address) == 0 && moved.size == size + 1);
+        assert(buffer_redo(&moved, &address) == 0 && moved.size == size + 5);
+
+        // The same edits, made to a copy.
+        //
+        uint8_t *expected = g_malloc(size + 5);
+        memcpy(expected, header, 4);
+        memcpy(expected + 4, data, middle - 4);
+        memcpy(expected + middle, data + middle - 1, size - middle + 1);
+        memcpy(expected + size + 1, header, 4);
+
+        assert(buffer_save(&moved) == 0);
+        assert(moved.data_size == size + 5 && !moved.modified);
+
+        // Pasting reorders the bytes of the file, which are then copied.
+        //
+        assert(buffer_copy(&moved, 0, 16) == 0);
+        assert(buffer_delete(&moved, 2 * 1024 * 1024, 8 * 1024 * 1024) == 0);
+        assert(buffer_paste(&moved, 1024 * 1024, 1) == 0);
+        assert(buffer_save(&moved) == 0);
+
+        size_t expected_size = size + 5 - 8 * 1024 * 1024 + 16;
+        memmove(expected + 2 * 1024 * 1024, expected + 10 * 1024 * 1024, size + 5 - 10 * 1024 * 1024);
+        memmove(expected + 1024 * 1024 + 16, expected + 1024 * 1024, expected_size - 1024 * 1024 - 16);
+        memcpy(expected + 1024 * 1024, header, 4);
+        memcpy(expected + 1024 * 1024 + 4, data, 12);
+        assert(moved.size == expected_size);
+        buffer_close(&moved);
+
+        uint8_t *contents = g_malloc(size + 5);
+        file = open(path, O_RDONLY);
+        assert(read(file, contents, size + 5) == expected_size);
+        assert(memcmp(contents, expected, expected_size) == 0);
+        close(file);
+
+        // A copy of the edited bytes leaves the file as it is.
+        //
+        assert(buffer_open(&moved, path) == 0);
+        assert(buffer_insert(&moved, 3, header, 4) == 0);
+        assert(buffer_delete(&moved, 1024 * 1024, 64 * 1024) == 0);
+
+        char copy_path[] = "/tmp/buffer_test.XXXXXX";
+        file = mkstemp(copy_path);
+        assert(file >= 0);
+        close(file);
+
+        assert(buffer_save_as(&moved, copy_path) == 0);
+        assert(buffer_save_as(&moved, path) == 2);
+        assert(moved.modified);
+        buffer_close(&moved);
+
+        memmove(expected + 1024 * 1024 - 4, expected + 1024 * 1024 - 4 + 64 * 1024,
+                expected_size - 1024 * 1024 + 4 - 64 * 1024);
+        memmove(expected + 7, expected + 3, expected_size - 64 * 1024 - 3);
+        memcpy(expected + 3, header, 4);
+
+        file = open(copy_path, O_RDONLY);
+        assert(read(file, contents, size + 5) == expected_size - 64 * 1024 + 4);
+        assert(memcmp(contents, expected, expected_size - 64 * 1024 + 4) == 0);
+        close(file);
+        unlink(copy_path);
+        unlink(path);
+
+        g_free(contents);
+        g_free(expected);
+        g_free(data);
+    }
+
+    return 0;
+}
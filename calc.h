@@ -0,0 +1,118 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "buffer.h"
+
+// Capacities of a compiled program, expressions that exceed them fail to
+// compile.
+//
+#define PROGRAM_CODE_SIZE 512
+#define PROGRAM_CONSTANTS_SIZE 128
+#define PROGRAM_STACK_SIZE 64
+
+// Program flags: the result depends on the cursor.
+//
+#define PROGRAM_CURSOR 0x01
+
+// Capacities of a lexer. Characters past the input size are lexed again after
+// every edit.
+//
+#define LEXER_INPUT_SIZE 256
+#define LEXER_TOKENS 256
+
+// The types of values, from narrowest to widest. Operands of different types
+// are converted to the widest.
+//
+typedef enum {
+    TYPE_I64,
+    TYPE_I128,
+    TYPE_F64,
+} type_t;
+
+typedef struct {
+    type_t type;
+    union {
+        int64_t i64;
+        __int128 i128;
+        double f64;
+    };
+} value_t;
+
+// An expression compiled to bytecode for a stack machine: each opcode is
+// followed by its operand byte, if any. Constants live in a separate table
+// indexed by the operand. Programs hold no pointers, and can be copied or
+// shared between threads freely.
+//
+// The stack holds 64-bit slots. Opcodes are specialized for the types of their
+// operands, known when compiling: doubles take a slot as their bits, and
+// 128-bit integers two.
+//
+typedef struct {
+    uint8_t code[PROGRAM_CODE_SIZE];
+    int64_t constants[PROGRAM_CONSTANTS_SIZE];
+    uint16_t code_size;
+    uint16_t constants_size;
+    // The type of the result.
+    //
+    uint8_t type;
+    uint8_t flags;
+} program_t;
+
+typedef struct {
+    int type;
+    int64_t value;
+    // Offsets into the input of the token, and of the end of the characters
+    // examined to lex it, both exclusive.
+    //
+    uint32_t start;
+    uint32_t end;
+    uint32_t examined;
+} token_t;
+
+// The tokens of an input, kept between edits so that only the tokens from the
+// first changed character are lexed again. MUST be zero-initialized.
+//
+typedef struct {
+    char input[LEXER_INPUT_SIZE];
+    size_t input_size;
+    token_t tokens[LEXER_TOKENS];
+    int tokens_size;
+} lexer_t;
+
+// Lexes an input, reusing the tokens of the previous input that are unchanged.
+// Returns 1 if the input has an invalid token, or too many.
+//
+int calculator_lex(lexer_t *lexer, const char *input);
+// Returns 1 if the tokens are not a valid expression, or too large for a
+// program. Names are resolved to the addresses of the comments and bookmarks
+// of buffer when compiling, and are invalid if buffer is NULL.
+//
+int calculator_parse(const lexer_t *lexer, buffer_t *buffer, program_t *program);
+// Lexes and parses an expression.
+//
+int calculator_compile(buffer_t *buffer, const char *input, program_t *program);
+// Evaluates a program, with buffer reads relative to cursor. Returns 1 if a
+// read is out of bounds. Does not allocate. Functions over ranges report their
+// progress if progress is not NULL. The result is converted as by
+// calculator_integer.
+//
+int calculator_run(const program_t *program, buffer_t *buffer, cursor_t cursor, const progress_t *progress,
+        int64_t *result);
+// Evaluates a program to a value of its type.
+//
+int calculator_run_value(const program_t *program, buffer_t *buffer, cursor_t cursor, const progress_t *progress,
+        value_t *result);
+// Evaluates a program, and sets start and end to the range of the bytes it
+// read, including those of functions over ranges. The range is empty if none
+// were.
+//
+int calculator_run_traced(const program_t *program, buffer_t *buffer, cursor_t cursor, const progress_t *progress,
+        value_t *result, uint64_t *start, uint64_t *end);
+// Converts a value to a 64-bit integer: 128-bit integers are truncated, and
+// doubles rounded toward zero, saturating.
+//
+int64_t calculator_integer(const value_t *value);
+// Compiles and evaluates an expression at the buffer cursor.
+//
+int calculator_eval(buffer_t *buffer, const char *input, const progress_t *progress, int64_t *result);
@@ -0,0 +1,526 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "buffer.h"
+#include "calc.h"
+
+#define BENCH_DATA_SIZE (64 * 1024)
+// Wall time spent on each measurement, in microseconds.
+//
+#define BENCH_TIME 200000
+
+// Expressions generated for the cross-check, and the depth of their trees.
+// Trees this deep stay within the capacities of a program.
+//
+#define REFERENCE_EXPRESSIONS 100000
+#define REFERENCE_DEPTH 5
+#define REFERENCE_NODES 256
+#define REFERENCE_INPUT_SIZE 4096
+
+static uint8_t g_data[BENCH_DATA_SIZE];
+static buffer_t g_buffer;
+
+// Allocations are counted by wrapping the allocator of the C library, which
+// glib also allocates through. ASan replaces the allocator itself.
+//
+static uint64_t g_allocations;
+
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+#define BENCH_ALLOCATIONS
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *pointer, size_t size);
+
+void*
+malloc(size_t size)
+{
+    g_allocations++;
+    return __libc_malloc(size);
+}
+
+void*
+calloc(size_t count, size_t size)
+{
+    g_allocations++;
+    return __libc_calloc(count, size);
+}
+
+void*
+realloc(void *pointer, size_t size)
+{
+    g_allocations++;
+    return __libc_realloc(pointer, size);
+}
+#endif
+
+static uint64_t g_seed = 0x9e3779b97f4a7c15;
+
+static uint64_t
+bench_random(void)
+{
+    // xorshift64.
+    //
+    g_seed ^= g_seed << 13;
+    g_seed ^= g_seed >> 7;
+    g_seed ^= g_seed << 17;
+    return g_seed;
+}
+
+// Binary operators in the calculator grammar, by increasing precedence level.
+// All operators are left associative.
+//
+static const struct {
+    const char *token;
+    int level;
+} REFERENCE_OPERATORS[] = {
+    { "&&", 0 }, { "||", 0 },
+    { "&", 1 }, { "^", 1 }, { "|", 1 },
+    { "==", 2 }, { "!=", 2 },
+    { ">", 3 }, { ">=", 3 }, { "<", 3 }, { "<=", 3 },
+    { "<<", 4 }, { ">>", 4 },
+    { "+", 5 }, { "-", 5 },
+    { "*", 6 }, { "/", 6 }, { "%", 6 },
+};
+
+#define REFERENCE_OPERATORS_SIZE (sizeof(REFERENCE_OPERATORS) / sizeof(*REFERENCE_OPERATORS))
+#define REFERENCE_UNARY_LEVEL 7
+
+typedef enum {
+    REFERENCE_INTEGER,
+    REFERENCE_CURSOR,
+    // A read at the cursor, or at its left child.
+    //
+    REFERENCE_READ,
+    REFERENCE_BIT_NOT,
+    REFERENCE_NOT,
+    REFERENCE_BINARY,
+    // sum8, xor8 or count over an in-bounds range.
+    //
+    REFERENCE_CALL,
+} reference_type_t;
+
+typedef struct {
+    reference_type_t type;
+    int left;
+    int right;
+    // The constant of integers, the operator of binaries, and the specifier
+    // character of reads. Calls use value as the function, and arguments for
+    // their range and byte.
+    //
+    int64_t value;
+    int is_signed;
+    uint64_t arguments[3];
+} reference_node_t;
+
+typedef struct {
+    reference_node_t nodes[REFERENCE_NODES];
+    int nodes_size;
+    cursor_t cursor;
+} reference_t;
+
+static const char *REFERENCE_FUNCTIONS[] = { "sum8", "xor8", "count" };
+
+static int
+reference_node(reference_t *reference, reference_type_t type)
+{
+    assert(reference->nodes_size < REFERENCE_NODES);
+
+    int i = reference->nodes_size++;
+    reference->nodes[i] = (reference_node_t) { .type = type, .left = -1, .right = -1 };
+    return i;
+}
+
+static int64_t
+reference_integer(void)
+{
+    // Mostly small values, with the edges of division and shifts.
+    //
+    static const int64_t EDGES[] = { 0, 1, -1, INT64_MIN, INT64_MAX, 0xff, 0x80 };
+
+    switch (bench_random() % 4) {
+    case 0:
+        return EDGES[bench_random() % (sizeof(EDGES) / sizeof(*EDGES))];
+    case 1:
+        return (int64_t) bench_random();
+    default:
+        return bench_random() % 0x100;
+    }
+}
+
+// Generates a random tree, returning its root. Addresses of reads and ranges of
+// calls are always in bounds, so that every expression evaluates.
+//
+static int
+reference_generate(reference_t *reference, int depth)
+{
+    int leaf = depth == 0 || bench_random() % 4 == 0;
+
+    if (leaf) {
+        int i;
+        switch (bench_random() % 8) {
+        case 0:
+            return reference_node(reference, REFERENCE_CURSOR);
+        case 1:
+        case 2: {
+            i = reference_node(reference, REFERENCE_READ);
+            reference->nodes[i].value = "bBsSiIlL"[bench_random() % 8];
+            reference->nodes[i].is_signed = bench_random() % 2;
+
+            // At the cursor, at a constant address, or relative to the cursor.
+            //
+            switch (bench_random() % 3) {
+            case 0:
+                break;
+            case 1: {
+                int address = reference_node(reference, REFERENCE_INTEGER);
+                reference->nodes[address].value = bench_random() % (BENCH_DATA_SIZE - 8);
+                reference->nodes[i].left = address;
+            } break;
+            case 2: {
+                int address = reference_node(reference, REFERENCE_BINARY);
+                reference->nodes[address].value = 13;
+                reference->nodes[address].left = reference_node(reference, REFERENCE_CURSOR);
+                reference->nodes[address].right = reference_node(reference, REFERENCE_INTEGER);
+                reference->nodes[reference->nodes[address].right].value =
+                        bench_random() % (BENCH_DATA_SIZE / 2 - 8);
+                reference->nodes[i].left = address;
+            } break;
+            }
+
+            return i;
+        }
+        case 3:
+            if (bench_random() % 4 == 0) {
+                i = reference_node(reference, REFERENCE_CALL);
+                reference->nodes[i].value = bench_random() % 3;
+                reference->nodes[i].arguments[0] = bench_random() % (BENCH_DATA_SIZE - 256);
+                reference->nodes[i].arguments[1] = bench_random() % 256;
+                reference->nodes[i].arguments[2] = bench_random() % 0x100;
+                return i;
+            }
+            // Fall through.
+        default:
+            i = reference_node(reference, REFERENCE_INTEGER);
+            reference->nodes[i].value = reference_integer();
+            return i;
+        }
+    }
+
+    int i;
+    switch (bench_random() % 8) {
+    case 0:
+        i = reference_node(reference, bench_random() % 2 ? REFERENCE_BIT_NOT : REFERENCE_NOT);
+        reference->nodes[i].left = reference_generate(reference, depth - 1);
+        return i;
+    default:
+        i = reference_node(reference, REFERENCE_BINARY);
+        reference->nodes[i].value = bench_random() % REFERENCE_OPERATORS_SIZE;
+        reference->nodes[i].left = reference_generate(reference, depth - 1);
+
+        // Shift by a constant in range, larger shifts are undefined.
+        //
+        if (REFERENCE_OPERATORS[reference->nodes[i].value].level == 4) {
+            reference->nodes[i].right = reference_node(reference, REFERENCE_INTEGER);
+            reference->nodes[reference->nodes[i].right].value = bench_random() % 64;
+        } else {
+            reference->nodes[i].right = reference_generate(reference, depth - 1);
+        }
+
+        return i;
+    }
+}
+
+// Prints a tree with the fewest parentheses the grammar needs, and some more
+// at random.
+//
+static void
+reference_print(reference_t *reference, int i, int level, int is_right, GString *output)
+{
+    reference_node_t *node = &reference->nodes[i];
+
+    int node_level = node->type == REFERENCE_BINARY ? REFERENCE_OPERATORS[node->value].level : REFERENCE_UNARY_LEVEL + 1;
+    int parens = node_level < level || (node_level == level && is_right) || bench_random() % 16 == 0;
+
+    if (parens) {
+        g_string_append_c(output, '(');
+    }
+
+    switch (node->type) {
+    case REFERENCE_INTEGER:
+        g_string_append_printf(output, "0x%" PRIx64, (uint64_t) node->value);
+        break;
+    case REFERENCE_CURSOR:
+        g_string_append_c(output, '.');
+        break;
+    case REFERENCE_READ:
+        g_string_append_printf(output, "%c%c", node->is_signed ? '#' : '@', (char) node->value);
+        if (node->left != -1) {
+            int brackets = bench_random() % 2;
+            g_string_append_c(output, brackets ? '[' : '(');
+            reference_print(reference, node->left, 0, 0, output);
+            g_string_append_c(output, brackets ? ']' : ')');
+        }
+        break;
+    case REFERENCE_BIT_NOT:
+    case REFERENCE_NOT:
+        g_string_append_c(output, node->type == REFERENCE_NOT ? '!' : '~');
+        reference_print(reference, node->left, REFERENCE_UNARY_LEVEL, 0, output);
+        break;
+    case REFERENCE_BINARY:
+        reference_print(reference, node->left, node_level, 0, output);
+        g_string_append_printf(output, " %s ", REFERENCE_OPERATORS[node->value].token);
+        reference_print(reference, node->right, node_level, 1, output);
+        break;
+    case REFERENCE_CALL:
+        g_string_append_printf(output, "%s(0n%" PRIu64 ", 0n%" PRIu64, REFERENCE_FUNCTIONS[node->value],
+                node->arguments[0], node->arguments[1]);
+        if (node->value == 2) {
+            g_string_append_printf(output, ", %" PRIx64, node->arguments[2]);
+        }
+        g_string_append_c(output, ')');
+        break;
+    }
+
+    if (parens) {
+        g_string_append_c(output, ')');
+    }
+}
+
+// Evaluates a tree directly, with the semantics of the calculator: 64-bit
+// two's complement, and division by zero is zero.
+//
+static int64_t
+reference_eval(reference_t *reference, int i)
+{
+    reference_node_t *node = &reference->nodes[i];
+
+    switch (node->type) {
+    case REFERENCE_INTEGER:
+        return node->value;
+    case REFERENCE_CURSOR:
+        return reference->cursor;
+    case REFERENCE_READ: {
+        uint64_t address = node->left != -1 ? reference_eval(reference, node->left) : reference->cursor;
+        char specifier = node->value;
+        int size = specifier == 'b' || specifier == 'B' ? 1
+                : specifier == 's' || specifier == 'S' ? 2
+                : specifier == 'i' || specifier == 'I' ? 4 : 8;
+        int big_endian = specifier == 'S' || specifier == 'I' || specifier == 'L';
+
+        uint64_t value = 0;
+        for (int j = 0; j < size; j++) {
+            value = value << 8 | g_data[address + (big_endian ? j : size - 1 - j)];
+        }
+
+        if (node->is_signed && size < 8) {
+            uint64_t sign = (uint64_t) 1 << (size * 8 - 1);
+            value = (value ^ sign) - sign;
+        }
+
+        return value;
+    }
+    case REFERENCE_BIT_NOT:
+        return ~reference_eval(reference, node->left);
+    case REFERENCE_NOT:
+        return !reference_eval(reference, node->left);
+    case REFERENCE_BINARY: {
+        const char *token = REFERENCE_OPERATORS[node->value].token;
+        int64_t b = reference_eval(reference, node->left);
+
+        // Short-circuit, the right operand may not be evaluated.
+        //
+        if (strcmp(token, "&&") == 0) {
+            return b && reference_eval(reference, node->right);
+        }
+
+        if (strcmp(token, "||") == 0) {
+            return b || reference_eval(reference, node->right);
+        }
+
+        int64_t c = reference_eval(reference, node->right);
+        uint64_t ub = b, uc = c;
+
+        if (strcmp(token, "&") == 0) return b & c;
+        if (strcmp(token, "^") == 0) return b ^ c;
+        if (strcmp(token, "|") == 0) return b | c;
+        if (strcmp(token, "==") == 0) return b == c;
+        if (strcmp(token, "!=") == 0) return b != c;
+        if (strcmp(token, ">") == 0) return b > c;
+        if (strcmp(token, ">=") == 0) return b >= c;
+        if (strcmp(token, "<") == 0) return b < c;
+        if (strcmp(token, "<=") == 0) return b <= c;
+        if (strcmp(token, "<<") == 0) return ub << c;
+        if (strcmp(token, ">>") == 0) return b >> c;
+        if (strcmp(token, "+") == 0) return ub + uc;
+        if (strcmp(token, "-") == 0) return ub - uc;
+        if (strcmp(token, "*") == 0) return ub * uc;
+        if (strcmp(token, "/") == 0) return c == 0 ? 0 : c == -1 ? 0 - ub : b / c;
+        if (strcmp(token, "%") == 0) return c == 0 || c == -1 ? 0 : b % c;
+
+        assert(0 && "unreachable");
+    }
+    case REFERENCE_CALL: {
+        uint64_t sum = 0, count = 0;
+        uint8_t xor = 0;
+        for (uint64_t j = node->arguments[0]; j < node->arguments[0] + node->arguments[1]; j++) {
+            sum += g_data[j];
+            xor ^= g_data[j];
+            count += g_data[j] == node->arguments[2];
+        }
+
+        return node->value == 0 ? (int64_t) sum : node->value == 1 ? xor : (int64_t) count;
+    }
+    }
+
+    assert(0 && "unreachable");
+}
+
+// Evaluates random expressions with the calculator and the reference, and
+// reports the ones that differ. Returns the number of mismatches.
+//
+static int
+reference_check(int expressions)
+{
+    int mismatches = 0;
+    GString *input = g_string_sized_new(REFERENCE_INPUT_SIZE);
+
+    for (int i = 0; i < expressions; i++) {
+        reference_t reference = { .cursor = bench_random() % (BENCH_DATA_SIZE / 2) };
+        int root = reference_generate(&reference, REFERENCE_DEPTH);
+
+        g_string_truncate(input, 0);
+        reference_print(&reference, root, 0, 0, input);
+
+        int64_t expected = reference_eval(&reference, root);
+
+        program_t program;
+        int64_t result;
+        if (calculator_compile(NULL, input->str, &program)) {
+            printf("does not compile: %s\n", input->str);
+            mismatches++;
+            continue;
+        }
+
+        if (calculator_run(&program, &g_buffer, reference.cursor, NULL, &result) || result != expected) {
+            printf("at .%" PRIx64 ": %s\n    expected %" PRId64 ", got %" PRId64 "\n",
+                    (uint64_t) reference.cursor, input->str, expected, result);
+            mismatches++;
+        }
+    }
+
+    g_string_free(input, TRUE);
+    printf("%d random expressions, %d mismatches\n", expressions, mismatches);
+    return mismatches;
+}
+
+// Reports the cost of an expression compiled each time, as by the dialogs, and
+// compiled once, as by Find.
+//
+static void
+bench_expression(const char *name, const char *input)
+{
+    int64_t result, start, elapsed;
+    uint64_t evaluations = 0, allocations = g_allocations;
+
+    start = g_get_monotonic_time();
+    do {
+        for (int i = 0; i < 1000; i++) {
+            assert(calculator_eval(&g_buffer, input, NULL, &result) == 0);
+        }
+
+        evaluations += 1000;
+    } while ((elapsed = g_get_monotonic_time() - start) < BENCH_TIME);
+
+    double compiled = elapsed * 1e3 / evaluations;
+    double compiled_allocations = (double) (g_allocations - allocations) / evaluations;
+
+    program_t program;
+    assert(calculator_compile(NULL, input, &program) == 0);
+
+    evaluations = 0;
+    allocations = g_allocations;
+    start = g_get_monotonic_time();
+    do {
+        for (int i = 0; i < 1000; i++) {
+            assert(calculator_run(&program, &g_buffer, 0, NULL, &result) == 0);
+        }
+
+        evaluations += 1000;
+    } while ((elapsed = g_get_monotonic_time() - start) < BENCH_TIME);
+
+    double run = elapsed * 1e3 / evaluations;
+    double run_allocations = (double) (g_allocations - allocations) / evaluations;
+
+    printf("%-16s %12.1f %12.2f %12.1f %12.2f\n", name, compiled, compiled_allocations, run, run_allocations);
+}
+
+int
+main(int argc, char *argv[])
+{
+    uint32_t seed = 1;
+    for (int i = 0; i < sizeof(g_data); i++) {
+        seed = seed * 1103515245 + 12345;
+        g_data[i] = seed >> 16;
+    }
+
+    buffer_from_data(&g_buffer, g_data, sizeof(g_data));
+
+    // With --check, only cross-check against the reference, as a test.
+    //
+    int check = argc > 1 && strcmp(argv[1], "--check") == 0;
+    if (check) {
+        int mismatches = reference_check(REFERENCE_EXPRESSIONS);
+        buffer_close(&g_buffer);
+        return mismatches != 0;
+    }
+
+    GString *deep = g_string_new(NULL);
+    GString *chain = g_string_new(NULL);
+    GString *reads = g_string_new(NULL);
+
+    // Nested as deep as the parser allows.
+    //
+    for (int i = 0; i < 30; i++) {
+        g_string_append_printf(deep, "%x + (", i + 1);
+    }
+    g_string_append(deep, "@b");
+    for (int i = 0; i < 30; i++) {
+        g_string_append_c(deep, ')');
+    }
+
+    // A chain that holds, so that every operand is evaluated.
+    //
+    for (int i = 0; i < 32; i++) {
+        g_string_append_printf(chain, "%s@b[%x] == %x", i > 0 ? " && " : "", i * 7, g_data[i * 7]);
+    }
+
+    // Reads spread over several cache windows, and reads at computed addresses.
+    //
+    for (int i = 0; i < 16; i++) {
+        g_string_append_printf(reads, "%s@l[%x] ^ @I(. + %x)", i > 0 ? " + " : "", i * 0xf01, i * 0x313);
+    }
+    g_string_append(reads, " + @l[@s[@b]]");
+
+    printf("%-16s %12s %12s %12s %12s\n", "", "ns/eval", "allocs/eval", "ns/run", "allocs/run");
+    bench_expression("arithmetic", "~0b00 + 0n10 * 0x20 << ((030 != 40) < 50)");
+    bench_expression("deep", deep->str);
+    bench_expression("chain", chain->str);
+    bench_expression("reads", reads->str);
+    bench_expression("typed", "@d[8] * float(@l) + @f[10] > 0n1.5 && @q[20] != u128(@l)");
+    bench_expression("function", "crc32(0, 0n4096) != 0 && sum8(0, 0n256) != 0");
+#ifndef BENCH_ALLOCATIONS
+    printf("Allocations are not counted in this build.\n");
+#endif
+
+    g_string_free(deep, TRUE);
+    g_string_free(chain, TRUE);
+    g_string_free(reads, TRUE);
+
+    int mismatches = reference_check(REFERENCE_EXPRESSIONS);
+    buffer_close(&g_buffer);
+    return mismatches != 0;
+}
@@ -1,7 +1,13 @@
+#include <stdio.h>
 #include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
 #include <assert.h>
+#include <stdlib.h>
+#include <unistd.h>
 
 #include "buffer.h"
+#include "calc.h"
 
 const uint8_t TEST_DATA[] = {
     0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef,
@@ -9,13 +15,11 @@ const uint8_t TEST_DATA[] = {
 
 buffer_t g_buffer;
 
-int calculator_eval(buffer_t *buffer, const char *input, int64_t *result);
-
 void
 calculator_assert(const char *input, int64_t expected)
 {
     int64_t result;
-    assert(calculator_eval(&g_buffer, input, &result) == 0);
+    assert(calculator_eval(&g_buffer, input, NULL, &result) == 0);
     assert(result == expected);
 }
 
@@ -23,7 +27,51 @@ void
 calculator_err(const char *input)
 {
     int64_t result;
-    assert(calculator_eval(&g_buffer, input, &result) != 0);
+    assert(calculator_eval(&g_buffer, input, NULL, &result) != 0);
+}
+
+void
+value_assert(buffer_t *buffer, const char *input, value_t expected)
+{
+    program_t program;
+    value_t result;
+    assert(calculator_compile(NULL, input, &program) == 0);
+    assert(calculator_run_value(&program, buffer, 0, NULL, &result) == 0);
+    assert(result.type == expected.type);
+
+    switch (expected.type) {
+    case TYPE_I64:
+        assert(result.i64 == expected.i64);
+        break;
+    case TYPE_I128:
+        assert(result.i128 == expected.i128);
+        break;
+    case TYPE_F64:
+        assert(result.f64 == expected.f64);
+        break;
+    }
+}
+
+#define I64(value) ((value_t) { .type = TYPE_I64, .i64 = (value) })
+#define I128(high, low) ((value_t) { .type = TYPE_I128, .i128 = (__int128) ((unsigned __int128) (high) << 64 | (low)) })
+#define F64(value) ((value_t) { .type = TYPE_F64, .f64 = (value) })
+
+// Lexes an edit incrementally, and checks the tokens match lexing from scratch.
+//
+void
+lexer_assert(lexer_t *lexer, const char *input)
+{
+    lexer_t fresh = {};
+    int error = calculator_lex(&fresh, input);
+    assert(calculator_lex(lexer, input) == error);
+    assert(lexer->tokens_size == fresh.tokens_size);
+
+    for (int i = 0; i < fresh.tokens_size; i++) {
+        assert(lexer->tokens[i].type == fresh.tokens[i].type);
+        assert(lexer->tokens[i].value == fresh.tokens[i].value);
+        assert(lexer->tokens[i].start == fresh.tokens[i].start);
+        assert(lexer->tokens[i].end == fresh.tokens[i].end);
+    }
 }
 
 int
@@ -66,6 +114,7 @@ main(int argc, char *argv[])
     calculator_assert("0 / 0", 0);
     calculator_assert("42 / 100", 0);
     calculator_assert("84 / 42", 2);
+    calculator_assert("8000000000000000 / ffffffffffffffff", INT64_MIN);
 
     calculator_assert("1 % 1", 0);
     calculator_assert("0 % 1", 0);
@@ -73,6 +122,7 @@ main(int argc, char *argv[])
     calculator_assert("0 % 0", 0);
     calculator_assert("2 % 100", 2);
     calculator_assert("20 % 2", 0);
+    calculator_assert("8000000000000000 % ffffffffffffffff", 0);
 
     // Bit operators.
     //
@@ -129,6 +179,7 @@ main(int argc, char *argv[])
     calculator_assert("~0b00 + 0n10 * 0x20 << 030 != 40 < 50", 1);
     calculator_assert("~0b00 + 0n10 * 0x20 << ((030 != 40) < 50)", 638);
     calculator_assert("(1) + (2) + (3)", 6);
+    calculator_assert("(0)+0*2", 0);
 
     // Buffer read.
     //
@@ -150,11 +201,360 @@ main(int argc, char *argv[])
     calculator_assert("#l", -1167088121787636991);
     calculator_assert("#L", 81985529216486895);
 
+    // Buffer read at an address, and the cursor.
+    //
+    calculator_assert(".", 0);
+    calculator_assert("@b(4)", 0x89);
+    calculator_assert("@i(. + 4)", 0xefcdab89);
+    calculator_assert("#b(@b(2) - 40)", -85);
+
+    // Dereferences, reads of computed addresses.
+    //
+    calculator_assert("@b[4]", 0x89);
+    calculator_assert("@b[@b[0] + 2]", 0x67);
+    calculator_assert("@s[@b[@b[0] - 1] + 1] == @s(1)", 0);
+    calculator_assert("@s[@b[@b[0] - 1]] == @s(1)", 1);
+    calculator_err("@b[@b[1]]");
+    calculator_err("@b[1)");
+
+    // Functions over ranges.
+    //
+    calculator_assert("sum8(0, 8)", 960);
+    calculator_assert("xor8(0, 8)", 0);
+    calculator_assert("xor8(1, 2)", 0x66);
+    calculator_assert("count(0, 8, 23)", 1);
+    calculator_assert("count(0, 8, 0)", 0);
+    calculator_assert("entropy(0, 8)", 3000);
+    calculator_assert("entropy(0, 0)", 0);
+    calculator_assert("crc32(0, 0)", 0);
+    calculator_assert("crc32(0, 8) == crc32(0, 4) || 1", 1);
+    calculator_assert("count(., 8 - ., @b(1))", 1);
+    calculator_err("crc32(0, 9)");
+    calculator_err("crc32(0)");
+    calculator_err("count(0, 1)");
+    calculator_err("crc(0, 1)");
+    calculator_err("Crc32(0, 1)");
+
+    // Short-circuit logic, operands past the end of the buffer are not read.
+    //
+    calculator_assert("0 && @l(100)", 0);
+    calculator_assert("1 || @l(100)", 1);
+    calculator_assert("@l(100) == 0 && @b == 2", 0);
+    calculator_assert("@b == 1 && @s == 2301 && @i(4) == efcdab89", 1);
+    calculator_assert("@b == 2 || @s == 2301 || 5", 1);
+    calculator_assert("@b && 5 && @s", 1);
+    calculator_assert("5 || 0 && 0", 0);
+    calculator_err("@l(100) == 0 && @b == 1");
+
     // Buffer reading off end of file.
     //
     g_buffer.cursor = 6;
     calculator_err("@l");
 
+    // Invalid expressions.
+    //
+    calculator_err("");
+    calculator_err("1 +");
+    calculator_err("(1");
+    calculator_err("@x");
+    calculator_err("1 = 1");
+
+    // Names of comments and bookmarks.
+    //
+    buffer_add_comment(&g_buffer, 4, "main");
+    buffer_add_comment(&g_buffer, 5, "face");
+    buffer_add_comment(&g_buffer, 6, "not a name");
+    calculator_assert("main", 4);
+    calculator_assert("main + 40", 0x44);
+    calculator_assert("@b[main]", 0x89);
+    calculator_assert("$main", 4);
+    calculator_assert("face", 0xface);
+    calculator_assert("$face", 5);
+    calculator_err("mian");
+    calculator_err("$");
+    calculator_err("$bm0");
+
+    buffer_add_comment(&g_buffer, 4, "start");
+    calculator_err("main");
+    calculator_assert("start", 4);
+    buffer_add_comment(&g_buffer, 7, "start");
+    buffer_remove_comment(&g_buffer, 4);
+    calculator_assert("start", 7);
+    buffer_remove_comment(&g_buffer, 7);
+    calculator_err("start");
+
+    buffer_bookmark_push(&g_buffer, 2);
+    buffer_bookmark_push(&g_buffer, 3);
+    calculator_assert("$bm0", 3);
+    calculator_assert("bm1", 2);
+    calculator_err("$bm2");
+
+    char symbols_path[] = "/tmp/calculator_test.XXXXXX";
+    int symbols_file = mkstemp(symbols_path);
+    assert(symbols_file >= 0);
+    const char symbols[] = "0000000000000002 T entry\n1\tnext\nzz bad\n100 past_the_end\n3\n";
+    assert(write(symbols_file, symbols, sizeof(symbols) - 1) == sizeof(symbols) - 1);
+    close(symbols_file);
+
+    assert(buffer_import_symbols(&g_buffer, symbols_path) == 2);
+    unlink(symbols_path);
+    calculator_assert("entry - next", 1);
+    calculator_err("past_the_end");
+
+    // Compiled programs are evaluated at any cursor.
+    //
+    program_t program;
+    assert(calculator_compile(NULL, "@b + #b * 2 == 3 * @b", &program) == 0);
+
+    for (cursor_t cursor = 0; cursor < sizeof(TEST_DATA); cursor++) {
+        int64_t result;
+        assert(calculator_run(&program, &g_buffer, cursor, NULL, &result) == 0);
+        assert(result == ((int8_t) TEST_DATA[cursor] >= 0));
+    }
+
+    int64_t result;
+    assert(calculator_run(&program, &g_buffer, sizeof(TEST_DATA), NULL, &result) != 0);
+
+    // Reads across the windows cached during an evaluation.
+    //
+    uint8_t pages[8192];
+    for (int i = 0; i < sizeof(pages); i++) {
+        pages[i] = i;
+    }
+
+    buffer_t buffer;
+    buffer_from_data(&buffer, pages, sizeof(pages));
+    assert(calculator_compile(NULL, "@l[ffc] + @b[ffb] + @S[fff] + @b[1ff0]", &program) == 0);
+    assert(calculator_run(&program, &buffer, 0, NULL, &result) == 0);
+    assert(result == 0x03020100fffefdfcLL + 0xfb + 0xff00 + 0xf0);
+    buffer_close(&buffer);
+
+    // Functions agree with their definitions over larger ranges, unaligned.
+    //
+    static uint8_t random[(1 << 20) + 37];
+    uint32_t seed = 1;
+    for (int i = 0; i < sizeof(random); i++) {
+        seed = seed * 1103515245 + 12345;
+        random[i] = seed >> 16;
+    }
+
+    memcpy(random, "123456789", 9);
+    buffer_from_data(&buffer, random, sizeof(random));
+    assert(calculator_compile(NULL, "crc32(0, 9)", &program) == 0);
+    assert(calculator_run(&program, &buffer, 0, NULL, &result) == 0);
+    assert(result == 0xcbf43926);
+
+    uint64_t ranges[][2] = { { 0, sizeof(random) }, { 3, 64 }, { 5, 1000 }, { 7, sizeof(random) - 7 } };
+    for (int i = 0; i < sizeof(ranges) / sizeof(*ranges); i++) {
+        uint64_t address = ranges[i][0], size = ranges[i][1];
+
+        uint32_t crc = 0xffffffff;
+        uint64_t sum = 0, count = 0;
+        uint8_t xor = 0;
+        for (uint64_t j = address; j < address + size; j++) {
+            crc ^= random[j];
+            for (int k = 0; k < 8; k++) {
+                crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+            }
+
+            sum += random[j];
+            xor ^= random[j];
+            count += random[j] == 0x5a;
+        }
+
+        char input[128];
+        snprintf(input, sizeof(input), "crc32(0n%" PRIu64 ", 0n%" PRIu64 ")", address, size);
+        assert(calculator_compile(NULL, input, &program) == 0);
+        assert(calculator_run(&program, &buffer, 0, NULL, &result) == 0);
+        assert(result == (crc ^ 0xffffffff));
+
+        snprintf(input, sizeof(input), "sum8(0n%" PRIu64 ", 0n%" PRIu64 ")", address, size);
+        assert(calculator_compile(NULL, input, &program) == 0);
+        assert(calculator_run(&program, &buffer, 0, NULL, &result) == 0);
+        assert(result == sum);
+
+        snprintf(input, sizeof(input), "xor8(0n%" PRIu64 ", 0n%" PRIu64 ")", address, size);
+        assert(calculator_compile(NULL, input, &program) == 0);
+        assert(calculator_run(&program, &buffer, 0, NULL, &result) == 0);
+        assert(result == xor);
+
+        snprintf(input, sizeof(input), "count(0n%" PRIu64 ", 0n%" PRIu64 ", 5a)", address, size);
+        assert(calculator_compile(NULL, input, &program) == 0);
+        assert(calculator_run(&program, &buffer, 0, NULL, &result) == 0);
+        assert(result == count);
+    }
+
+    buffer_close(&buffer);
+
+    // Typed values, 1.5f little and big-endian, 2.25 and a 128-bit integer.
+    //
+    const uint8_t typed_data[] = {
+        0x00, 0x00, 0xc0, 0x3f, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x40, 0x3f, 0xc0, 0x00, 0x00,
+        0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10,
+    };
+    buffer_from_data(&buffer, typed_data, sizeof(typed_data));
+
+    value_assert(&buffer, "@f", F64(1.5));
+    value_assert(&buffer, "@F[c]", F64(1.5));
+    value_assert(&buffer, "@d[4]", F64(2.25));
+    value_assert(&buffer, "@q[10]", I128(0x100f0e0d0c0b0a09, 0x0807060504030201));
+    value_assert(&buffer, "#q[10]", I128(0x100f0e0d0c0b0a09, 0x0807060504030201));
+    value_assert(&buffer, "@Q[10]", I128(0x0102030405060708, 0x090a0b0c0d0e0f10));
+    value_assert(&buffer, "@q(@f + 0n14.5)", I128(0x100f0e0d0c0b0a09, 0x0807060504030201));
+
+    // Operands are converted to the widest type.
+    //
+    value_assert(&buffer, "@f + 1", F64(2.5));
+    value_assert(&buffer, "@f * @d[4]", F64(3.375));
+    value_assert(&buffer, "float(0n3) / 2", F64(1.5));
+    value_assert(&buffer, "0n1.5 * 2", F64(3));
+    value_assert(&buffer, "0n0.1", F64(0.1));
+    value_assert(&buffer, "0n1.0 / 0 > 0n1000.0", I64(1));
+    value_assert(&buffer, "@q[10] - @q[10] + 1", I128(0, 1));
+    value_assert(&buffer, "@q[10] >> 0n64", I128(0, 0x100f0e0d0c0b0a09));
+    value_assert(&buffer, "@q[10] == @Q[10]", I64(0));
+    value_assert(&buffer, "u128(ffffffffffffffff) + 1", I128(1, 0));
+    value_assert(&buffer, "i128(ffffffffffffffff) + 1", I128(0, 0));
+    value_assert(&buffer, "u128(1) << 0n100", I128(1ULL << 36, 0));
+    value_assert(&buffer, "~u128(0) / i128(0 - 1)", I128(0, 1));
+    value_assert(&buffer, "(u128(1) << 0n127) / (0 - 1)", I128(1ULL << 63, 0));
+    value_assert(&buffer, "float(u128(1) << 0n64)", F64(18446744073709551616.0));
+
+    // Conversions and reinterpretations.
+    //
+    value_assert(&buffer, "i64(0n2.9)", I64(2));
+    value_assert(&buffer, "i64(float(7fffffffffffffff) * 2)", I64(INT64_MAX));
+    value_assert(&buffer, "i64(@q[10])", I64(0x0807060504030201));
+    value_assert(&buffer, "bits(0n1.0)", I64(0x3ff0000000000000));
+    value_assert(&buffer, "bits(@d[4])", I64(0x4002000000000000));
+    value_assert(&buffer, "asf64(3ff0000000000000)", F64(1));
+    value_assert(&buffer, "asf32(3fc00000)", F64(1.5));
+    value_assert(&buffer, "asf32(@i)", F64(1.5));
+
+    // Logical operators test any type.
+    //
+    value_assert(&buffer, "@f > 1 && @d[4] < 3", I64(1));
+    value_assert(&buffer, "!0n0.0 || @q[10]", I64(1));
+    value_assert(&buffer, "count(u128(0), float(4), 0)", I64(2));
+
+    program_t typed_program;
+    int64_t integer;
+    assert(calculator_compile(NULL, "@d[4] * 2", &typed_program) == 0);
+    assert(calculator_run(&typed_program, &buffer, 0, NULL, &integer) == 0);
+    assert(integer == 4);
+
+    calculator_err("0n1.5 & 1");
+    calculator_err("0n1.5 << 1");
+    calculator_err("~@d");
+    calculator_err("#f");
+    calculator_err("i64(1, 2)");
+
+    buffer_close(&buffer);
+
+    // Incremental lexing, typing and editing expressions.
+    //
+    const char *typed[] = {
+        "crc32(0, 10) + 0n123 << @l[. + 8]",
+        "0x1f >= 0b101 && 0 != 017",
+        "0n1.5 * @d[0n1.25] + float(0n12)",
+    };
+    for (int i = 0; i < sizeof(typed) / sizeof(*typed); i++) {
+        static lexer_t lexer;
+        char input[64] = {};
+        for (int j = 0; typed[i][j] != '\0'; j++) {
+            input[j] = typed[i][j];
+            lexer_assert(&lexer, input);
+        }
+
+        for (int j = strlen(input) - 1; j >= 0; j--) {
+            input[j] = '\0';
+            lexer_assert(&lexer, input);
+        }
+    }
+
+    static lexer_t lexer;
+    lexer_assert(&lexer, "crc3(0, 1)");
+    lexer_assert(&lexer, "crc32(0, 1)");
+    lexer_assert(&lexer, "crc3(0, 1)");
+    lexer_assert(&lexer, "1 < 2 + 3");
+    lexer_assert(&lexer, "1 << 2 + 3");
+    lexer_assert(&lexer, "1 << $ + 3");
+    lexer_assert(&lexer, "1 << 2 + 3");
+    lexer_assert(&lexer, "0 + 3");
+    lexer_assert(&lexer, "0x + 3");
+    lexer_assert(&lexer, "0x1 + 3");
+
+    // The bytes read by an evaluation, and writes since.
+    //
+    {
+        uint8_t data[64] = { 1, 2, 3, 4 };
+        buffer_t edited;
+        buffer_from_data(&edited, data, sizeof(data));
+
+        program_t traced;
+        value_t value;
+        uint64_t start, end;
+        assert(calculator_compile(&edited, "@b[4] + @l[8] + sum8(10, 8)", &traced) == 0);
+        assert(!(traced.flags & PROGRAM_CURSOR));
+        assert(calculator_run_traced(&traced, &edited, 0, NULL, &value, &start, &end) == 0);
+        assert(start == 4 && end == 24);
+
+        assert(calculator_compile(&edited, "1 + 2", &traced) == 0);
+        assert(calculator_run_traced(&traced, &edited, 0, NULL, &value, &start, &end) == 0);
+        assert(start == end);
+
+        assert(calculator_compile(&edited, "@b + 1", &traced) == 0);
+        assert(traced.flags & PROGRAM_CURSOR);
+
+        uint64_t edits = edited.edits;
+        uint8_t byte = 0xff;
+        assert(buffer_write(&edited, 2, &byte, 1) == 0);
+        assert(buffer_write(&edited, 64, &byte, 1) != 0);
+        assert(data[2] == 3);
+        assert(!buffer_changed(&edited, edits, 4, 20));
+        assert(buffer_changed(&edited, edits, 0, 3));
+        assert(!buffer_changed(&edited, edited.edits, 0, 3));
+
+        for (int i = 0; i < BUFFER_EDITS; i++) {
+            assert(buffer_write(&edited, 63, &byte, 1) == 0);
+        }
+        assert(buffer_changed(&edited, edits, 4, 20));
+
+        buffer_close(&edited);
+    }
+
+    // Expressions deeper than the parser stack fail to compile, though they
+    // have few enough tokens to lex.
+    //
+    char deep[512] = {};
+    for (int depth = 0; depth < 60; depth++) {
+        strcat(deep, "1+(");
+    }
+    strcat(deep, "1");
+    memset(deep + strlen(deep), ')', 60);
+
+    static lexer_t deep_lexer;
+    assert(calculator_lex(&deep_lexer, deep) == 0);
+    assert(calculator_compile(NULL, deep, &program) != 0);
+
+    memset(deep, 0, sizeof(deep));
+    for (int depth = 0; depth < 20; depth++) {
+        strcat(deep, "1+(");
+    }
+    strcat(deep, "1");
+    memset(deep + strlen(deep), ')', 20);
+    calculator_assert(deep, 21);
+
+    // Expressions of more than LEXER_TOKENS tokens fail to lex.
+    //
+    char long_input[LEXER_TOKENS + 2] = {};
+    for (int i = 0; i < LEXER_TOKENS + 1; i++) {
+        long_input[i] = i % 2 == 0 ? '1' : '+';
+    }
+    assert(calculator_lex(&deep_lexer, long_input) != 0);
+    long_input[LEXER_TOKENS - 1] = '\0';
+    assert(calculator_lex(&deep_lexer, long_input) == 0);
+
     buffer_close(&g_buffer);
     return 0;
 }
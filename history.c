@@ -0,0 +1,193 @@
+#include "history.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static history_entry_t*
+history_entry(history_t *history, int index)
+{
+    return &history->entries[(history->first + index) % HISTORY_SIZE];
+}
+
+// Returns the index of an input, which has no surrounding spaces, or -1.
+//
+static int
+history_find(history_t *history, const char *input)
+{
+    for (int i = history->size - 1; i >= 0; i--) {
+        if (strcmp(history_entry(history, i)->input, input) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// Adds an input, which has no surrounding spaces, and returns its entry.
+//
+static history_entry_t*
+history_push(history_t *history, const char *input)
+{
+    int index = history_find(history, input);
+
+    // Moving an entry keeps its program and result.
+    //
+    history_entry_t entry;
+    if (index != -1) {
+        entry = *history_entry(history, index);
+        for (int i = index; i < history->size - 1; i++) {
+            *history_entry(history, i) = *history_entry(history, i + 1);
+        }
+        history->size--;
+    } else {
+        entry = (history_entry_t) { .input = g_strdup(input) };
+    }
+
+    if (history->size == HISTORY_SIZE) {
+        g_free(history_entry(history, 0)->input);
+        history->first = (history->first + 1) % HISTORY_SIZE;
+        history->size--;
+    }
+
+    history_entry_t *last = history_entry(history, history->size++);
+    *last = entry;
+    return last;
+}
+
+// Writes the inputs one per line, oldest first. History is a convenience, so
+// failing to save it is not reported.
+//
+static void
+history_save(history_t *history)
+{
+    if (history->path == NULL) {
+        return;
+    }
+
+    GString *contents = g_string_new(NULL);
+    for (int i = 0; i < history->size; i++) {
+        g_string_append(contents, history_entry(history, i)->input);
+        g_string_append_c(contents, '\n');
+    }
+
+    char *directory = g_path_get_dirname(history->path);
+    if (g_mkdir_with_parents(directory, 0700) == 0) {
+        g_file_set_contents(history->path, contents->str, contents->len, NULL);
+    }
+
+    g_free(directory);
+    g_string_free(contents, TRUE);
+}
+
+history_t*
+history_open(const char *path)
+{
+    history_t *history = g_malloc0(sizeof(history_t));
+    if (path == NULL) {
+        return history;
+    }
+
+    // Each file has its own history, named by a hash of its absolute path.
+    //
+    char *absolute = realpath(path, NULL);
+    char *hash = g_compute_checksum_for_string(G_CHECKSUM_SHA1, absolute != NULL ? absolute : path, -1);
+    history->path = g_build_filename(g_get_user_data_dir(), "hexxed", "history", hash, NULL);
+    g_free(hash);
+    free(absolute);
+
+    char *contents;
+    if (g_file_get_contents(history->path, &contents, NULL, NULL)) {
+        char **lines = g_strsplit(contents, "\n", -1);
+        for (char **line = lines; *line != NULL; line++) {
+            g_strstrip(*line);
+            if (**line != '\0') {
+                history_push(history, *line);
+            }
+        }
+
+        g_strfreev(lines);
+        g_free(contents);
+    }
+
+    return history;
+}
+
+void
+history_close(history_t *history)
+{
+    for (int i = 0; i < history->size; i++) {
+        g_free(history_entry(history, i)->input);
+    }
+
+    g_free(history->path);
+    g_free(history);
+}
+
+void
+history_add(history_t *history, const char *input)
+{
+    char *stripped = g_strstrip(g_strdup(input));
+    if (*stripped != '\0') {
+        history_push(history, stripped);
+        history_save(history);
+    }
+
+    g_free(stripped);
+}
+
+const char*
+history_get(history_t *history, int age)
+{
+    if (age < 0 || age >= history->size) {
+        return NULL;
+    }
+
+    return history_entry(history, history->size - 1 - age)->input;
+}
+
+int
+history_eval(history_t *history, buffer_t *buffer, const char *input, cursor_t cursor,
+        const progress_t *progress, value_t *result)
+{
+    char *stripped = g_strstrip(g_strdup(input));
+    int index = history_find(history, stripped);
+    g_free(stripped);
+
+    if (index == -1) {
+        return -1;
+    }
+
+    history_entry_t *entry = history_entry(history, index);
+
+    // Names are resolved when compiling.
+    //
+    if (!entry->compiled || entry->names != buffer->names) {
+        entry->evaluated = 0;
+        entry->compiled = calculator_compile(buffer, entry->input, &entry->program) == 0;
+        entry->names = buffer->names;
+        if (!entry->compiled) {
+            return 1;
+        }
+    }
+
+    if (entry->evaluated && (!(entry->program.flags & PROGRAM_CURSOR) || entry->cursor == cursor)
+            && !buffer_changed(buffer, entry->edits, entry->read_start, entry->read_end - entry->read_start)) {
+        // The result holds for the writes made since.
+        //
+        entry->edits = buffer->edits;
+        *result = entry->result;
+        return 0;
+    }
+
+    entry->evaluated = 0;
+    if (calculator_run_traced(&entry->program, buffer, cursor, progress, &entry->result, &entry->read_start,
+                &entry->read_end)) {
+        return 2;
+    }
+
+    entry->evaluated = 1;
+    entry->cursor = cursor;
+    entry->edits = buffer->edits;
+    *result = entry->result;
+    return 0;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+#include <gmodule.h>
+
+#include "buffer.h"
+#include "calc.h"
+
+// Expressions kept, the oldest are dropped.
+//
+#define HISTORY_SIZE 64
+
+typedef struct {
+    char *input;
+    // The program compiled from the input, if compiled, when the names of the
+    // buffer had changed names times.
+    //
+    int compiled;
+    uint64_t names;
+    program_t program;
+    // The last result, if evaluated, at cursor and when the buffer had made
+    // edits writes. It holds until a byte of the range read is written, or the
+    // cursor moves if the program reads relative to it.
+    //
+    int evaluated;
+    value_t result;
+    cursor_t cursor;
+    uint64_t edits;
+    uint64_t read_start;
+    uint64_t read_end;
+} history_entry_t;
+
+// The expressions entered in Goto and the calculator, in a ring from the oldest
+// to the newest. Each is kept with its compiled program and last result, so
+// that going back to a computed offset evaluates nothing unless the bytes it
+// depends on changed.
+//
+typedef struct {
+    history_entry_t entries[HISTORY_SIZE];
+    int first;
+    int size;
+    // The file the inputs are saved to, or NULL.
+    //
+    char *path;
+} history_t;
+
+// Loads the history of the file at path, or starts an empty one that is not
+// saved if path is NULL.
+//
+history_t *history_open(const char *path);
+void history_close(history_t *history);
+// Adds an input as the newest, moving it if it is already kept, and saves the
+// history. Surrounding spaces are ignored.
+//
+void history_add(history_t *history, const char *input);
+// Returns the input added age inputs before the newest, or NULL if there is
+// none.
+//
+const char *history_get(history_t *history, int age);
+// Evaluates an input at cursor, reusing its program and result if they are
+// still valid. Returns -1 if the input is not kept, 1 if it is not a valid
+// expression, and 2 if a read is out of bounds.
+//
+int history_eval(history_t *history, buffer_t *buffer, const char *input, cursor_t cursor,
+        const progress_t *progress, value_t *result);
@@ -7,12 +7,83 @@
 #include <string.h>
 #include <assert.h>
 #include <ctype.h>
+#include <unistd.h>
+#include <inttypes.h>
 
 #include "buffer.h"
+#include "calc.h"
+#include "history.h"
+#include "overview.h"
 #include "panes.h"
+#include "patch.h"
+#include "recovery.h"
 #include "render.h"
+#include "scan.h"
 
-int calculator_eval(buffer_t *buffer, const char *input, int64_t *result);
+// Smallest screen that the status and options bars fit on.
+//
+#define MIN_WIDTH 80
+#define MIN_HEIGHT 12
+
+// How long to wait for further resize events before laying the screen out.
+//
+#define RESIZE_SETTLE_MS 50
+
+// Narrowest text pane in a split.
+//
+#define SPLIT_MIN_TEXT_WIDTH 16
+
+// How often to redraw while a background job runs.
+//
+#define JOB_REFRESH_MS 100
+
+// Both panes are posted for the lifetime of the editor, indexed by their type.
+// In a split the hex pane is on the left and the text pane on the right,
+// otherwise only the focused pane is visible.
+//
+typedef struct {
+    int width;
+    int height;
+    pane_t *panes[2];
+    // Type of the pane receiving input.
+    //
+    pane_type_t focus;
+    // If both panes are visible, != 0.
+    //
+    int split;
+    // Column of the separator between the panes, if split.
+    //
+    int separator;
+    // Started the first time the overview strip is shown. The selected row is
+    // -1 unless the strip has the focus.
+    //
+    overview_t *overview;
+    int overview_visible;
+    int overview_selected;
+    // The running Find, if any. Its matches are listed once it completes, or
+    // replaced with replacement if replacing, unless the buffer made edits
+    // since it started.
+    //
+    scan_t *scan;
+    int replacing;
+    uint8_t replacement[BLOCK_KEY_SIZE];
+    size_t replacement_size;
+    uint64_t edits;
+    // Expressions entered in Goto and the calculator.
+    //
+    history_t *history;
+    // Bytes read for the current frame, and which of them differ from the
+    // snapshot compared with, if its index is not -1.
+    //
+    uint8_t *frame;
+    uint8_t *changed;
+    size_t frame_capacity;
+    int compare;
+    // The log of the edits, if recorded. It is started again whenever the
+    // file changes under it.
+    //
+    recovery_t *recovery;
+} screen_t;
 
 static char*
 trim(char *str)
@@ -41,25 +112,525 @@ trim(char *str)
 	return str;
 }
 
-static pane_t*
-next_pane(pane_type_t type, buffer_t *buffer, int width, int height)
+// Layout of every hex pane, changed from the command line or the Layout dialog.
+//
+static layout_t layout = {
+    .columns = 16,
+    .group = 4,
+};
+
+// Offered for the edits left by an editor that was killed.
+//
+static const char *RECOVERY_CHOICES[] = {
+    "Recover them",
+    "Discard them",
+};
+
+static const char *LAYOUT_COLUMNS[] = {
+    "Fit to screen",
+    "8 bytes per row",
+    "16 bytes per row",
+    "24 bytes per row",
+    "32 bytes per row",
+    "64 bytes per row",
+};
+
+static const int LAYOUT_COLUMNS_VALUES[] = { 0, 8, 16, 24, 32, 64 };
+
+static const char *LAYOUT_GROUPS[] = {
+    "No groups",
+    "Groups of 2",
+    "Groups of 4",
+    "Groups of 8",
+    "Groups of 16",
+};
+
+static const int LAYOUT_GROUPS_VALUES[] = { 0, 2, 4, 8, 16 };
+
+static const char *FIND_ALIGNMENTS[] = {
+    "Every offset",
+    "2-byte aligned",
+    "4-byte aligned",
+    "8-byte aligned",
+    "16-byte aligned",
+};
+
+static const int FIND_ALIGNMENTS_VALUES[] = { 1, 2, 4, 8, 16 };
+
+// Indexed by block_t.
+//
+static const char *BLOCK_OPERATIONS[] = {
+    "Fill with key",
+    "Xor with key",
+    "Add key",
+    "Swap 16-bit words",
+    "Swap 32-bit words",
+    "Swap 64-bit words",
+    "Reverse",
+    "Increment",
+};
+
+// Resizing the file in place saves the edits first.
+//
+static const char *RESIZE_OPERATIONS[] = {
+    "Truncate at cursor",
+    "Extend with fill",
+};
+
+// In the order of patch_format_t.
+//
+static const char *PATCH_FORMATS[] = {
+    "IPS",
+    "BPS",
+    "Native",
+};
+
+// Parses pairs of hex digits, spaces between them are ignored. Returns 1 if
+// the input has other characters, an odd digit, or more than BLOCK_KEY_SIZE
+// bytes.
+//
+static int
+parse_key(const char *input, uint8_t key[BLOCK_KEY_SIZE], size_t *key_size)
 {
-    if (type == PANE_HEX) {
-        return text_post(buffer, width, height);
-    } else if (type == PANE_TEXT) {
-        return hex_post(buffer, width, height);
+    *key_size = 0;
+
+    while (*input != '\0') {
+        if (*input == ' ') {
+            input++;
+            continue;
+        }
+
+        if (!isxdigit(input[0]) || !isxdigit(input[1]) || *key_size == BLOCK_KEY_SIZE) {
+            return 1;
+        }
+
+        char digits[3] = { input[0], input[1], '\0' };
+        key[(*key_size)++] = strtoul(digits, NULL, 16);
+        input += 2;
+    }
+
+    return 0;
+}
+
+static int
+layout_index(const int *values, size_t values_size, int value)
+{
+    for (int i = 0; i < values_size; i++) {
+        if (values[i] == value) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// Lays the panes out for the current screen size and split.
+//
+static void
+layout_screen(screen_t *screen)
+{
+    int width = screen->width, height = screen->height;
+
+    if (screen->overview_visible) {
+        width -= OVERVIEW_WIDTH;
+    }
+
+    if (!screen->split) {
+        pane_resize(screen->panes[PANE_HEX], 0, width, height);
+        pane_resize(screen->panes[PANE_TEXT], 0, width, height);
+        return;
+    }
+
+    // Give the hex pane as many columns as the layout wants, and the text
+    // pane the rest of the screen.
+    //
+    int hex_width = 22 + 4 * hex_columns(&layout, width - 1 - SPLIT_MIN_TEXT_WIDTH);
+    screen->separator = hex_width;
+
+    pane_resize(screen->panes[PANE_HEX], 0, hex_width, height);
+    pane_resize(screen->panes[PANE_TEXT], hex_width + 1, width - hex_width - 1, height);
+}
+
+// Draws the visible panes. The unfocused pane follows the focused one, and the
+// bytes visible in both are read from the buffer once.
+//
+static void
+draw_panes(screen_t *screen, buffer_t *buffer)
+{
+    pane_t *focused = screen->panes[screen->focus];
+    pane_t *other = screen->panes[!screen->focus];
+
+    uint64_t start, size;
+    pane_view(focused, &start, &size);
+    uint64_t end = start + size;
+
+    if (screen->split) {
+        pane_follow(other, start);
+
+        uint64_t other_start, other_size;
+        pane_view(other, &other_start, &other_size);
+        if (other_start < start) {
+            start = other_start;
+        }
+
+        if (other_start + other_size > end) {
+            end = other_start + other_size;
+        }
+    }
+
+    if (end - start > screen->frame_capacity) {
+        screen->frame_capacity = end - start;
+        screen->frame = g_realloc(screen->frame, screen->frame_capacity);
+        screen->changed = g_realloc(screen->changed, screen->frame_capacity);
+    }
+
+    frame_t frame = {
+        .address = start,
+        .size = end - start,
+        .data = screen->frame,
+    };
+    (void) buffer_read_at(buffer, frame.address, screen->frame, frame.size);
+
+    // Snapshots are dropped when saving.
+    //
+    if (screen->compare >= (int) buffer->snapshots->len) {
+        screen->compare = -1;
+    }
+
+    if (screen->compare != -1) {
+        const snapshot_t *snapshot = &g_array_index(buffer->snapshots, snapshot_t, screen->compare);
+        if (buffer_compare(buffer, snapshot, frame.address, frame.size, screen->changed) == 0) {
+            frame.changed = screen->changed;
+        }
+    }
+
+    pane_draw(focused, &frame);
+    if (screen->split) {
+        pane_draw(other, &frame);
+
+        static const cchar_t SEPARATOR = { 0, { L'│' } };
+
+        attrset(COLOR_PAIR(COLOR_STANDARD));
+        mvvline_set(1, screen->separator, &SEPARATOR, screen->height - 2);
+    }
+
+    // Edits change the bytes the overview summarized, and inserts and deletes
+    // their size.
+    //
+    if (screen->overview != NULL
+            && (screen->overview->size != buffer->size || screen->overview->edits != buffer->edits)) {
+        overview_stop(screen->overview);
+        screen->overview = overview_start(buffer);
+    }
+
+    if (screen->overview_visible) {
+        render_overview(screen->overview, screen->width - OVERVIEW_WIDTH, screen->height,
+                buffer->cursor, screen->overview_selected);
+    }
+}
+
+static int
+overview_running(screen_t *screen)
+{
+    return screen->overview != NULL && overview_progress(screen->overview) < 100;
+}
+
+// Handles an input while the overview strip has the focus. Returns 0 if the
+// input was not for the strip.
+//
+static int
+overview_driver(int input, screen_t *screen, buffer_t *buffer)
+{
+    int rows = screen->height - 2;
+    uint64_t cell = overview_cell_size(buffer->size, rows);
+    int last = buffer->size > 0 ? (buffer->size - 1) / cell : 0;
+
+    switch (input) {
+    case 'j':
+    case KEY_DOWN:
+        if (screen->overview_selected < last) {
+            screen->overview_selected++;
+        }
+        break;
+    case 'k':
+    case KEY_UP:
+        if (screen->overview_selected > 0) {
+            screen->overview_selected--;
+        }
+        break;
+    case KEY_HOME:
+        screen->overview_selected = 0;
+        break;
+    case KEY_END:
+        screen->overview_selected = last;
+        break;
+    case '\x0a':
+    case KEY_ENTER:
+        pane_scroll(screen->panes[screen->focus], screen->overview_selected * cell);
+        screen->overview_selected = -1;
+        break;
+    case 'O':
+    case '\x1b':
+        screen->overview_selected = -1;
+        break;
+    case ERR:
+        break;
+    default:
+        return 0;
+    }
+
+    return 1;
+}
+
+// Time taken to draw the last frame, shown in the status bar.
+//
+static int64_t frame_time;
+
+static void
+draw_status(screen_t *screen, buffer_t *buffer)
+{
+    status_t status = {
+        .path = buffer->path,
+        .cursor = buffer->cursor,
+        .frame_time = frame_time,
+    };
+
+    if (screen->scan != NULL) {
+        status.job = screen->replacing ? "Replace" : "Find";
+        status.job_progress = scan_progress(screen->scan);
+    } else if (overview_running(screen)) {
+        status.job = "Overview";
+        status.job_progress = overview_progress(screen->overview);
+    }
+
+    uint64_t address;
+    (void) buffer_selection(buffer, &address, &status.selection);
+
+    render_status(&status);
+}
+
+// Swallows a burst of resize events, as sent while dragging a window edge or
+// retiling, so the screen is only laid out and painted once it settles.
+//
+static void
+settle_resize(void)
+{
+    int input;
+
+    timeout(RESIZE_SETTLE_MS);
+    while ((input = getch()) == KEY_RESIZE);
+    timeout(-1);
+
+    if (input != ERR) {
+        ungetch(input);
+    }
+}
+
+// Blocks until the screen is large enough to draw on, setting width and height
+// to its size. Returns 0 if the user quit while waiting.
+//
+static int
+wait_for_screen(int *width, int *height)
+{
+    for (;;) {
+        getmaxyx(stdscr, *height, *width);
+        if (*width >= MIN_WIDTH && *height >= MIN_HEIGHT) {
+            return 1;
+        }
+
+        char message[64];
+        snprintf(message, sizeof(message), "Screen must be >=%dx%d", MIN_WIDTH, MIN_HEIGHT);
+        render_message(message);
+
+        int input = getch();
+        if (input == KEY_F(10)) {
+            return 0;
+        } else if (input == KEY_RESIZE) {
+            settle_resize();
+        }
+    }
+}
+
+typedef struct {
+    screen_t *screen;
+    buffer_t *buffer;
+    // The cursor when the prompt opened, expressions are evaluated relative to
+    // it.
+    //
+    cursor_t cursor;
+    lexer_t lexer;
+    char line[72];
+} goto_preview_t;
+
+static const char*
+goto_preview(const char *input, void *user_data)
+{
+    goto_preview_t *preview = (goto_preview_t*) user_data;
+    buffer_t *buffer = preview->buffer;
+
+    progress_t progress = render_progress("Goto");
+
+    // Inputs of the history reuse their last result, others are lexed again
+    // from the first edit.
+    //
+    value_t value;
+    int error = history_eval(preview->screen->history, buffer, input, preview->cursor, &progress, &value);
+    if (error == -1) {
+        program_t program;
+        if (calculator_lex(&preview->lexer, input) || calculator_parse(&preview->lexer, preview->buffer, &program)) {
+            error = 1;
+        } else {
+            error = calculator_run_value(&program, buffer, preview->cursor, &progress, &value) ? 2 : 0;
+        }
+    }
+
+    if (error == 1) {
+        return "Invalid expression.";
+    }
+
+    if (error == 2) {
+        return "Read out of bounds.";
+    }
+
+    int64_t result = calculator_integer(&value);
+    if (result < 0 || result >= buffer->size) {
+        snprintf(preview->line, sizeof(preview->line), "Offset .%08x`%08x is past the end.",
+                (uint32_t) ((uint64_t) result >> 32), (uint32_t) result);
+        return preview->line;
+    }
+
+    snprintf(preview->line, sizeof(preview->line), "Offset .%08x`%08x",
+            (uint32_t) ((uint64_t) result >> 32), (uint32_t) result);
+
+    pane_scroll(preview->screen->panes[preview->screen->focus], result);
+    draw_panes(preview->screen, buffer);
+    draw_status(preview->screen, buffer);
+    refresh();
+
+    return preview->line;
+}
+
+// Lists the matches of the completed Find, and goes to the selected one.
+//
+static void
+show_matches(screen_t *screen, buffer_t *buffer)
+{
+    int truncated;
+    GArray *matches = scan_matches(screen->scan, &truncated);
+
+    if (matches->len == 0) {
+        prompt_error("No matches.");
+    } else {
+        char **matches_data = malloc(sizeof(char*) * matches->len);
+        for (int i = 0; i < matches->len; i++) {
+            uint64_t address = g_array_index(matches, uint64_t, i);
+            asprintf(&matches_data[i], "%08x`%08x",
+                    (uint32_t) (address >> 32), (uint32_t) (address & 0x00000000ffffffff));
+        }
+
+        char title[32];
+        snprintf(title, sizeof(title), truncated ? "First %u matches" : "%u matches", matches->len);
+
+        int selected = prompt_menu(title, (const char**) matches_data, matches->len, 32, 0);
+        if (selected >= 0) {
+            pane_scroll(screen->panes[screen->focus], g_array_index(matches, uint64_t, selected));
+        }
+
+        for (int i = 0; i < matches->len; i++) {
+            free(matches_data[i]);
+        }
+
+        free(matches_data);
+    }
+
+    scan_stop(screen->scan);
+    screen->scan = NULL;
+}
+
+// Differences listed after choosing a snapshot to compare with.
+//
+#define COMPARE_MAX_RANGES 4096
+
+// Lists the ranges that differ from the snapshot compared with, and goes to the
+// selected one.
+//
+static void
+show_differences(screen_t *screen, buffer_t *buffer)
+{
+    const snapshot_t *snapshot = &g_array_index(buffer->snapshots, snapshot_t, screen->compare);
+    GArray *extents = g_array_new(FALSE, FALSE, sizeof(extent_t));
+    (void) buffer_diff(buffer, snapshot, 0, buffer->size, extents);
+
+    if (extents->len == 0) {
+        prompt_message("Compare", snapshot->size == buffer->size ? "No differences." : "Only the end was deleted.");
     } else {
-        __builtin_unreachable();
+        guint ranges_size = MIN(extents->len, COMPARE_MAX_RANGES);
+        char **ranges_data = malloc(sizeof(char*) * ranges_size);
+        for (int i = 0; i < ranges_size; i++) {
+            extent_t extent = g_array_index(extents, extent_t, i);
+            asprintf(&ranges_data[i], "%08x`%08x  %" PRIu64 " bytes",
+                    (uint32_t) (extent.address >> 32), (uint32_t) (extent.address & 0x00000000ffffffff),
+                    extent.size);
+        }
+
+        char title[32];
+        snprintf(title, sizeof(title), ranges_size < extents->len ? "First %u ranges" : "%u ranges", ranges_size);
+
+        int selected = prompt_menu(title, (const char**) ranges_data, ranges_size, 48, 0);
+        if (selected >= 0) {
+            pane_scroll(screen->panes[screen->focus], g_array_index(extents, extent_t, selected).address);
+        }
+
+        for (int i = 0; i < ranges_size; i++) {
+            free(ranges_data[i]);
+        }
+
+        free(ranges_data);
+    }
+
+    g_array_free(extents, TRUE);
+}
+
+// Replaces every match of a completed Replace as one edit.
+//
+static void
+replace_matches(screen_t *screen, buffer_t *buffer)
+{
+    int truncated;
+    GArray *matches = scan_matches(screen->scan, &truncated);
+
+    size_t replaced;
+    if (buffer->edits != screen->edits) {
+        prompt_error("The file changed during the search.");
+    } else if (matches->len == 0) {
+        prompt_error("No matches.");
+    } else if (buffer_replace(buffer, (const uint64_t*) matches->data, matches->len, screen->scan->pattern_size,
+                screen->replacement, screen->replacement_size, &replaced)) {
+        prompt_error("The whole file cannot be replaced.");
+    } else {
+        char message[64];
+        snprintf(message, sizeof(message), "%zu replaced.", replaced);
+        prompt_message("Replace", message);
     }
+
+    scan_stop(screen->scan);
+    screen->scan = NULL;
+    screen->replacing = 0;
 }
 
 static void
-driver(int input, int width, int height, pane_t **pane, buffer_t *buffer)
+driver(int input, screen_t *screen, buffer_t *buffer)
 {
+    pane_t *pane = screen->panes[screen->focus];
+
+    if (screen->overview_selected != -1 && overview_driver(input, screen, buffer)) {
+        goto draw;
+    }
+
     switch (input) {
     case '=':
         render_options(&EMPTY_OPT);
-        prompt_calculator(buffer);
+        prompt_calculator(buffer, screen->history);
         goto reset;
     case ';': {
         render_options(&EMPTY_OPT);
@@ -90,17 +661,453 @@ driver(int input, int width, int height, pane_t **pane, buffer_t *buffer)
     case KEY_F(5): {
         render_options(&EMPTY_OPT);
 
+        // The pane is scrolled to the target as the expression is typed, and
+        // restored once the prompt closes.
+        //
+        goto_preview_t preview = {
+            .screen = screen,
+            .buffer = buffer,
+            .cursor = buffer->cursor,
+        };
+
+        uint64_t top, size;
+        pane_view(pane, &top, &size);
+
         char *user_input = NULL;
-        prompt_input("Goto", NULL, &user_input);
+        prompt_input_preview("Goto", NULL, goto_preview, &preview, screen->history, &user_input);
+
+        buffer->cursor = preview.cursor;
+        pane_follow(pane, top);
+
+        value_t result;
+        progress_t progress = render_progress("Goto");
+        if (user_input != NULL) {
+            history_add(screen->history, user_input);
+            if (history_eval(screen->history, buffer, user_input, buffer->cursor, &progress, &result) == 0
+                    && calculator_integer(&result) >= 0) {
+                pane_scroll(pane, (uint64_t) calculator_integer(&result));
+            }
+        }
+
+        free(user_input);
+        goto reset;
+    }
+    case KEY_F(6): {
+        if (pane->type != PANE_HEX) {
+            goto drive;
+        }
+
+        render_options(&EMPTY_OPT);
+
+        size_t columns_size = sizeof(LAYOUT_COLUMNS) / sizeof(*LAYOUT_COLUMNS);
+        int columns = prompt_menu("Columns", LAYOUT_COLUMNS, columns_size, 32,
+                layout_index(LAYOUT_COLUMNS_VALUES, columns_size, layout.columns));
+        if (columns < 0) {
+            goto reset;
+        }
+
+        size_t groups_size = sizeof(LAYOUT_GROUPS) / sizeof(*LAYOUT_GROUPS);
+        int group = prompt_menu("Groups", LAYOUT_GROUPS, groups_size, 32,
+                layout_index(LAYOUT_GROUPS_VALUES, groups_size, layout.group));
+        if (group < 0) {
+            goto reset;
+        }
+
+        layout.columns = LAYOUT_COLUMNS_VALUES[columns];
+        layout.group = LAYOUT_GROUPS_VALUES[group];
+
+        // Re-centre the cursor, the scroll is measured in rows of the previous
+        // layout.
+        //
+        layout_screen(screen);
+        pane_scroll(pane, buffer->cursor);
+        goto reset;
+    }
+    case KEY_F(7): {
+        if (screen->scan != NULL) {
+            scan_stop(screen->scan);
+            screen->scan = NULL;
+            screen->replacing = 0;
+            prompt_error("Find cancelled.");
+            goto reset;
+        }
+
+        render_options(&EMPTY_OPT);
 
-        int64_t result = -1;
-        if (user_input != NULL && calculator_eval(buffer, user_input, &result) == 0 && result >= 0) {
-            pane_scroll(*pane, (uint64_t) result);
+        char *user_input = NULL;
+        prompt_input("Find where", NULL, &user_input);
+        if (user_input == NULL) {
+            goto reset;
         }
 
+        program_t program;
+        int error = calculator_compile(buffer, user_input, &program);
         free(user_input);
+
+        if (error) {
+            prompt_error("Invalid expression.");
+            goto reset;
+        }
+
+        size_t alignments_size = sizeof(FIND_ALIGNMENTS) / sizeof(*FIND_ALIGNMENTS);
+        int alignment = prompt_menu("Alignment", FIND_ALIGNMENTS, alignments_size, 32, 0);
+        if (alignment < 0) {
+            goto reset;
+        }
+
+        // Search the selection, or the whole buffer if there is none.
+        //
+        uint64_t address, size;
+        if (buffer_selection(buffer, &address, &size)) {
+            address = 0;
+            size = buffer->size;
+        }
+
+        screen->scan = scan_start(buffer, &program, address, size, FIND_ALIGNMENTS_VALUES[alignment]);
         goto reset;
     }
+    case 'R': {
+        render_options(&EMPTY_OPT);
+
+        if (screen->scan != NULL) {
+            prompt_error("A search is running.");
+            goto reset;
+        }
+
+        if (!buffer->editable && buffer_try_reopen(buffer)) {
+            prompt_error("The file could not be opened as writable.");
+            goto reset;
+        }
+
+        // The pattern and its replacement are entered as pairs of hex
+        // digits. An empty replacement deletes the occurrences.
+        //
+        uint8_t pattern[BLOCK_KEY_SIZE];
+        size_t pattern_size = 0;
+        char *user_input = NULL;
+        prompt_input("Replace hex", NULL, &user_input);
+        if (user_input == NULL) {
+            goto reset;
+        }
+
+        int error = parse_key(user_input, pattern, &pattern_size) || pattern_size == 0;
+        free(user_input);
+
+        user_input = NULL;
+        if (!error) {
+            prompt_input("With hex", NULL, &user_input);
+            if (user_input == NULL) {
+                goto reset;
+            }
+
+            error = parse_key(user_input, screen->replacement, &screen->replacement_size);
+            free(user_input);
+        }
+
+        if (error) {
+            prompt_error("Invalid key.");
+            goto reset;
+        }
+
+        // Replace in the selection, or the whole buffer if there is none.
+        //
+        uint64_t address, size;
+        if (buffer_selection(buffer, &address, &size)) {
+            address = 0;
+            size = buffer->size;
+        }
+
+        screen->scan = scan_start_pattern(buffer, pattern, pattern_size, address, size);
+        screen->replacing = 1;
+        screen->edits = buffer->edits;
+        goto reset;
+    }
+    case KEY_F(8): {
+        render_options(&EMPTY_OPT);
+
+        uint64_t address, size;
+        if (buffer_selection(buffer, &address, &size)) {
+            prompt_error("No selection.");
+            goto reset;
+        }
+
+        if (!buffer->editable && buffer_try_reopen(buffer)) {
+            prompt_error("The file could not be opened as writable.");
+            goto reset;
+        }
+
+        size_t operations_size = sizeof(BLOCK_OPERATIONS) / sizeof(*BLOCK_OPERATIONS);
+        int block = prompt_menu("Block", BLOCK_OPERATIONS, operations_size, 32, 0);
+        if (block < 0) {
+            goto reset;
+        }
+
+        uint8_t key[BLOCK_KEY_SIZE];
+        size_t key_size = 0;
+        if (block == BLOCK_FILL || block == BLOCK_XOR || block == BLOCK_ADD) {
+            char *user_input = NULL;
+            prompt_input("Key in hex", NULL, &user_input);
+            if (user_input == NULL) {
+                goto reset;
+            }
+
+            int error = parse_key(user_input, key, &key_size) || key_size == 0;
+            free(user_input);
+
+            if (error) {
+                prompt_error("Invalid key.");
+                goto reset;
+            }
+        }
+
+        buffer_block(buffer, address, size, block, key, key_size);
+        goto reset;
+    }
+    case 'y': {
+        uint64_t address, size;
+        if (buffer_selection(buffer, &address, &size)) {
+            render_options(&EMPTY_OPT);
+            prompt_error("No selection.");
+            goto reset;
+        }
+
+        buffer_copy(buffer, address, size);
+        goto draw;
+    }
+    case 'x': {
+        render_options(&EMPTY_OPT);
+
+        uint64_t address, size;
+        if (buffer_selection(buffer, &address, &size)) {
+            prompt_error("No selection.");
+            goto reset;
+        }
+
+        if (!buffer->editable && buffer_try_reopen(buffer)) {
+            prompt_error("The file could not be opened as writable.");
+            goto reset;
+        }
+
+        if (size == buffer->size) {
+            prompt_error("The whole file cannot be cut.");
+            goto reset;
+        }
+
+        buffer_copy(buffer, address, size);
+        buffer_delete(buffer, address, size);
+        buffer->start_mark = -1;
+        buffer->end_mark = -1;
+        pane_scroll(pane, MIN(address, buffer->size - 1));
+        goto reset;
+    }
+    case 'p':
+    case 'P':
+        render_options(&EMPTY_OPT);
+
+        if (!buffer->editable && buffer_try_reopen(buffer)) {
+            prompt_error("The file could not be opened as writable.");
+            goto reset;
+        }
+
+        if (buffer_paste(buffer, buffer->cursor, input == 'P')) {
+            prompt_error(buffer->clipboard_size == 0 ? "Nothing copied." : "The copy does not fit.");
+            goto reset;
+        }
+        goto draw;
+    case 'u':
+    case 'U': {
+        // Go to the edit undone or redone.
+        //
+        uint64_t address;
+        if ((input == 'u' ? buffer_undo : buffer_redo)(buffer, &address) == 0) {
+            pane_scroll(pane, address);
+        }
+        goto draw;
+    }
+    case KEY_F(2): {
+        render_options(&EMPTY_OPT);
+
+        char *user_input = NULL;
+        prompt_input("Save as", NULL, &user_input);
+        if (user_input == NULL) {
+            goto reset;
+        }
+
+        char *path = g_strstrip(user_input);
+        int status = *path != '\0' ? buffer_save_as(buffer, path) : 0;
+        if (status != 0) {
+            prompt_error(status == 2 ? "That is the file itself, saved with F10." : "The copy could not be saved.");
+        }
+
+        free(user_input);
+        goto reset;
+    }
+    case 'E': {
+        render_options(&EMPTY_OPT);
+
+        size_t formats_size = sizeof(PATCH_FORMATS) / sizeof(*PATCH_FORMATS);
+        int format = prompt_menu("Export patch", PATCH_FORMATS, formats_size, 32, 0);
+        if (format < 0) {
+            goto reset;
+        }
+
+        char *user_input = NULL;
+        prompt_input("Patch path", NULL, &user_input);
+        if (user_input == NULL) {
+            goto reset;
+        }
+
+        char *path = g_strstrip(user_input);
+        if (*path != '\0') {
+            int status = patch_export(buffer, format, path);
+            if (status != 0) {
+                prompt_error(status == 2 ? "The changes do not fit the format." : "The patch could not be saved.");
+            }
+        }
+
+        free(user_input);
+        goto reset;
+    }
+    case 'S': {
+        render_options(&EMPTY_OPT);
+
+        char *user_input = NULL;
+        prompt_input("Snapshot name", NULL, &user_input);
+        if (user_input == NULL) {
+            goto reset;
+        }
+
+        char *name = g_strstrip(user_input);
+        if (*name != '\0') {
+            buffer_snapshot(buffer, name);
+        }
+
+        free(user_input);
+        goto reset;
+    }
+    case 'D': {
+        render_options(&EMPTY_OPT);
+
+        if (buffer->snapshots->len == 0) {
+            prompt_error("No snapshots.");
+            goto reset;
+        }
+
+        // The first item stops comparing.
+        //
+        size_t names_size = buffer->snapshots->len + 1;
+        const char **names = malloc(sizeof(char*) * names_size);
+        names[0] = "None";
+        for (guint i = 0; i < buffer->snapshots->len; i++) {
+            names[i + 1] = g_array_index(buffer->snapshots, snapshot_t, i).name;
+        }
+
+        int selected = prompt_menu("Compare with", names, names_size, 64, screen->compare + 1);
+        free(names);
+
+        if (selected > 0) {
+            // Draw the differences highlighted behind their list.
+            //
+            screen->compare = selected - 1;
+            clear();
+            render_status_invalidate();
+            draw_panes(screen, buffer);
+            draw_status(screen, buffer);
+            refresh();
+            show_differences(screen, buffer);
+        } else if (selected == 0) {
+            screen->compare = -1;
+        }
+        goto reset;
+    }
+    case 'T': {
+        render_options(&EMPTY_OPT);
+
+        if (screen->scan != NULL) {
+            prompt_error("A search is running.");
+            goto reset;
+        }
+
+        if (!buffer->editable && buffer_try_reopen(buffer)) {
+            prompt_error("The file could not be opened as writable.");
+            goto reset;
+        }
+
+        size_t operations_size = sizeof(RESIZE_OPERATIONS) / sizeof(*RESIZE_OPERATIONS);
+        int operation = prompt_menu("Resize file", RESIZE_OPERATIONS, operations_size, 32, 0);
+        if (operation < 0) {
+            goto reset;
+        }
+
+        // The file ends before the cursor once truncated, or grows by the
+        // number of bytes entered, an expression, with the fill in hex
+        // repeated over them. An empty fill is zeroes.
+        //
+        uint64_t size = buffer->cursor;
+        uint8_t fill[BLOCK_KEY_SIZE];
+        size_t fill_size = 0;
+        if (operation == 1) {
+            char *user_input = NULL;
+            prompt_input("Extend by", NULL, &user_input);
+            if (user_input == NULL) {
+                goto reset;
+            }
+
+            int64_t extra;
+            progress_t progress = render_progress("Extend by");
+            int error = calculator_eval(buffer, user_input, &progress, &extra) || extra <= 0
+                || (uint64_t) extra > SIZE_MAX - buffer->size;
+            free(user_input);
+
+            if (error) {
+                prompt_error("Invalid size.");
+                goto reset;
+            }
+
+            user_input = NULL;
+            prompt_input("Fill in hex", NULL, &user_input);
+            if (user_input == NULL) {
+                goto reset;
+            }
+
+            error = parse_key(user_input, fill, &fill_size);
+            free(user_input);
+
+            if (error) {
+                prompt_error("Invalid key.");
+                goto reset;
+            }
+
+            size = buffer->size + extra;
+        } else if (size == 0) {
+            prompt_error("The whole file cannot be cut.");
+            goto reset;
+        }
+
+        if (buffer_resize(buffer, size, fill, fill_size)) {
+            prompt_error("The file could not be resized.");
+            goto reset;
+        }
+
+        // The log is of the file before it was resized.
+        //
+        if (screen->recovery != NULL) {
+            int interval = screen->recovery->interval;
+            recovery_stop(screen->recovery, 1);
+            screen->recovery = recovery_start(buffer, interval);
+        }
+
+        buffer->start_mark = -1;
+        buffer->end_mark = -1;
+        pane_scroll(pane, MIN(buffer->cursor, buffer->size - 1));
+        goto reset;
+    }
+    case KEY_F(10):
+        // Only reached if saving failed.
+        //
+        render_options(&EMPTY_OPT);
+        prompt_error(buffer->failed ? "The file was left partly saved. F10 quits." : "The changes could not be saved.");
+        goto reset;
     case KEY_F(9): {
         size_t comments_size = g_hash_table_size(buffer->comments);
         if (comments_size == 0) {
@@ -128,7 +1135,7 @@ driver(int input, int width, int height, pane_t **pane, buffer_t *buffer)
         n = 0;
         while (g_hash_table_iter_next(&i, &key, &value)) {
             if (n++ == selected) {
-                pane_scroll(*pane, GPOINTER_TO_SIZE(key));
+                pane_scroll(pane, GPOINTER_TO_SIZE(key));
             }
         }
 
@@ -141,12 +1148,80 @@ driver(int input, int width, int height, pane_t **pane, buffer_t *buffer)
     }
     case '\x0a':
     case KEY_ENTER: {
-        pane_type_t previous = (*pane)->type;
-        pane_unpost(*pane);
-        clear();
-        render_status(buffer->path);
-        *pane = next_pane(previous, buffer, width, height);
+        // Move the focus to the other pane, which is drawn over the previous
+        // one if not split. It only follows the focused pane while split, so
+        // it is brought to the same rows and the cursor first.
+        //
+        uint64_t top, size;
+        pane_view(pane, &top, &size);
+        screen->focus = !screen->focus;
+        pane = screen->panes[screen->focus];
+        pane_follow(pane, top);
+        goto drive;
+    }
+    case KEY_F(4):
+        screen->split = !screen->split;
+        layout_screen(screen);
         goto reset;
+    case 'o':
+        if (screen->overview == NULL) {
+            screen->overview = overview_start(buffer);
+        }
+
+        screen->overview_visible = !screen->overview_visible;
+        screen->overview_selected = -1;
+        layout_screen(screen);
+        goto reset;
+    case 'O':
+        if (!screen->overview_visible) {
+            goto drive;
+        }
+
+        // Start from the cell containing the cursor.
+        //
+        screen->overview_selected = buffer->cursor / overview_cell_size(buffer->size, screen->height - 2);
+        goto draw;
+    case KEY_RESIZE:
+        settle_resize();
+        goto reset;
+    case ERR:
+        // Timed out polling, only redraw unless a Find completed.
+        //
+        if (screen->scan != NULL && scan_progress(screen->scan) == 100) {
+            render_options(&EMPTY_OPT);
+            if (screen->replacing) {
+                replace_matches(screen, buffer);
+            } else {
+                show_matches(screen, buffer);
+            }
+            goto reset;
+        }
+        goto draw;
+    case KEY_PASTE: {
+        // The text is decoded and written as one edit, then drawn once.
+        //
+        size_t text_size;
+        char *text = input_paste(&text_size);
+
+        size_t size;
+        uint8_t *data = buffer_decode(text, text_size, &size);
+        g_free(text);
+
+        if (data == NULL) {
+            render_options(&EMPTY_OPT);
+            prompt_error("The paste is not hex or base64.");
+            goto reset;
+        }
+
+        int status = pane_paste(pane, data, size);
+        g_free(data);
+
+        if (status != 0) {
+            render_options(&EMPTY_OPT);
+            prompt_error(status == 1 ? "Paste in the Hex pane in edit mode." : "The paste does not fit.");
+            goto reset;
+        }
+        goto draw;
     }
     case KEY_F(3):
         if (!buffer->editable) {
@@ -158,33 +1233,127 @@ driver(int input, int width, int height, pane_t **pane, buffer_t *buffer)
         goto drive;
     default:
 drive:
-        render_status(buffer->path);
-        render_options((*pane)->options);
-        pane_drive(*pane, input);
+        pane_drive(pane, input);
+draw: {
+        int64_t start = g_get_monotonic_time();
+        render_options(pane->options);
+        draw_panes(screen, buffer);
+        frame_time = g_get_monotonic_time() - start;
+
+        draw_status(screen, buffer);
+    }
     }
 
     return;
 reset:
+    // Dialogs swallow resize events, so check the size after any of them.
+    //
+    if (is_term_resized(screen->height, screen->width)) {
+        if (!wait_for_screen(&screen->width, &screen->height)) {
+            ungetch(KEY_F(10));
+            return;
+        }
+
+        layout_screen(screen);
+    }
+
     clear();
+    render_status_invalidate();
     goto drive;
 }
 
 inline static void __attribute__ ((noreturn))
 error(const char *message)
 {
+    render_paste_mode(0);
     endwin();
     fprintf(stderr, "error: %s\n", message);
     exit(1);
 }
 
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: hexxed [-c columns] [-g group] [-s symbols] [-a interval] path\n"
+            "       hexxed -p patch [-o output] path\n");
+    exit(1);
+}
+
 int
 main(int argc, char *argv[])
 {
-    if (argc < 2) {
+    const char *symbols = NULL;
+    const char *patch = NULL;
+    const char *output = NULL;
+    int interval = RECOVERY_INTERVAL_MS;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:g:s:p:o:a:")) != -1) {
+        switch (opt) {
+        case 'c': {
+            size_t columns_size = sizeof(LAYOUT_COLUMNS_VALUES) / sizeof(*LAYOUT_COLUMNS_VALUES);
+            int columns = strcmp(optarg, "auto") == 0 ? 0 : atoi(optarg);
+            if (layout_index(LAYOUT_COLUMNS_VALUES, columns_size, columns) < 0) {
+                fprintf(stderr, "error: columns must be one of 8, 16, 24, 32, 64 or auto\n");
+                return 1;
+            }
+            layout.columns = columns;
+        } break;
+        case 'g': {
+            size_t groups_size = sizeof(LAYOUT_GROUPS_VALUES) / sizeof(*LAYOUT_GROUPS_VALUES);
+            int group = atoi(optarg);
+            if (layout_index(LAYOUT_GROUPS_VALUES, groups_size, group) < 0) {
+                fprintf(stderr, "error: group must be one of 0, 2, 4, 8 or 16\n");
+                return 1;
+            }
+            layout.group = group;
+        } break;
+        case 's':
+            symbols = optarg;
+            break;
+        case 'p':
+            patch = optarg;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'a': {
+            char *end;
+            long milliseconds = strtol(optarg, &end, 10);
+            if (*optarg == '\0' || *end != '\0' || milliseconds < 0 || milliseconds > G_MAXINT) {
+                fprintf(stderr, "error: interval must be a number of milliseconds, or 0\n");
+                return 1;
+            }
+            interval = milliseconds;
+        } break;
+        default:
+            usage();
+        }
+    }
+
+    if (optind >= argc) {
         fprintf(stderr, "error: no path provided\n");
         return 1;
     }
 
+    // Patches are applied without the editor.
+    //
+    if (patch != NULL) {
+        switch (patch_apply(patch, argv[optind], output != NULL ? output : argv[optind])) {
+        case 0:
+            return 0;
+        case 2:
+            fprintf(stderr, "error: invalid patch, or not for this file\n");
+            return 1;
+        case 3:
+            fprintf(stderr, "error: checksum mismatch\n");
+            return 1;
+        default:
+            fprintf(stderr, "error: cannot apply patch\n");
+            return 1;
+        }
+    }
+
     setlocale(LC_ALL, "");
 
     initscr();
@@ -216,41 +1385,106 @@ main(int argc, char *argv[])
     init_pair(COLOR_STANDARD, COLOR_WHITE, COLOR_BLACK);
     init_pair(HIGHLIGHT_BLUE, COLOR_WHITE, COLOR_BLUE);
 
-    // Exit if the terminal is too small.
-    //
-    int height, width;
-    getmaxyx(stdscr, height, width);
-
-    if (width < 86 || height < 24) {
-        error("screen must be >=86x24");
-    }
-
     // Make the default cursor invisible.
     //
     curs_set(0);
     clear();
 
     buffer_t buffer;
-    if (buffer_open(&buffer, argv[1]) != 0) {
+    if (buffer_open(&buffer, argv[optind]) != 0) {
         error("cannot open path");
     }
 
+    if (symbols != NULL && buffer_import_symbols(&buffer, symbols) < 0) {
+        error("cannot read symbols");
+    }
+
+    // Wait for the terminal to be resized if it is too small.
+    //
+    screen_t screen = {
+        .focus = PANE_HEX,
+        .overview_selected = -1,
+        .compare = -1,
+        .history = history_open(buffer.path),
+    };
+    if (!wait_for_screen(&screen.width, &screen.height)) {
+        history_close(screen.history);
+        buffer_close(&buffer);
+        endwin();
+        return 0;
+    }
+    clear();
+
+    // Edits left by an editor that was killed are offered first. Escape, or a
+    // replay that fails, leaves them to be offered again, and does not record
+    // this session.
+    //
+    if (interval > 0) {
+        int choice = 1;
+        if (recovery_pending(&buffer)) {
+            size_t choices_size = sizeof(RECOVERY_CHOICES) / sizeof(*RECOVERY_CHOICES);
+            choice = prompt_menu("Unsaved edits found", RECOVERY_CHOICES, choices_size, 32, 0);
+            if (choice == 0 && (buffer_try_reopen(&buffer) || recovery_replay(&buffer) < 0)) {
+                prompt_error("The edits could not be recovered, and are kept.");
+                choice = -1;
+            }
+            clear();
+        }
+
+        if (choice >= 0) {
+            screen.recovery = recovery_start(&buffer, interval);
+        }
+    }
+
+    screen.panes[PANE_HEX] = hex_post(&buffer, &layout, 0, screen.width, screen.height);
+    screen.panes[PANE_TEXT] = text_post(&buffer, 0, screen.width, screen.height);
+
+    render_paste_mode(1);
+
     // Render the first time to the screen.
     //
-    render_status(buffer.path);
-    pane_t *hex_pane = hex_post(&buffer, width, height);
-    render_options(hex_pane->options);
+    render_options(screen.panes[PANE_HEX]->options);
+    draw_panes(&screen, &buffer);
+    draw_status(&screen, &buffer);
 
-    int input;
-    pane_t *active_pane = hex_pane;
-    while ((input = getch()) != KEY_F(10)) {
-        driver(input, width, height, &active_pane, &buffer);
+    for (;;) {
+        // Poll while background jobs run, so their progress is drawn.
+        //
+        timeout(overview_running(&screen) || screen.scan != NULL ? JOB_REFRESH_MS : -1);
+        int input = getch();
+        timeout(-1);
+
+        // A buffer left by a failed save cannot be saved, and quits.
+        //
+        if (input == KEY_F(10) && (buffer.failed || buffer_save(&buffer) == 0)) {
+            break;
+        }
+
+        driver(input, &screen, &buffer);
     }
 
-    if (active_pane != NULL) {
-        pane_unpost(active_pane);
+    render_paste_mode(0);
+
+    // The edits are saved, or the file no longer matches the log.
+    //
+    if (screen.recovery != NULL) {
+        recovery_stop(screen.recovery, 1);
+    }
+
+    if (screen.overview != NULL) {
+        overview_stop(screen.overview);
     }
 
+    if (screen.scan != NULL) {
+        scan_stop(screen.scan);
+    }
+
+    pane_unpost(screen.panes[PANE_HEX]);
+    pane_unpost(screen.panes[PANE_TEXT]);
+    g_free(screen.frame);
+    g_free(screen.changed);
+    history_close(screen.history);
+
     if (buffer_close(&buffer) != 0) {
         error("cannot close buffer");
     }
@@ -0,0 +1,210 @@
+#include "overview.h"
+#include "buffer.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Reduces a histogram of size bytes to a summary.
+//
+static void
+summarize(const uint64_t histogram[256], uint64_t size, summary_t *summary)
+{
+    double entropy = 0;
+    uint64_t printable = 0;
+
+    if (size == 0) {
+        *summary = (summary_t) {};
+        return;
+    }
+
+    for (int i = 0; i < 256; i++) {
+        if (histogram[i] != 0) {
+            double p = (double) histogram[i] / size;
+            entropy -= p * log2(p);
+        }
+    }
+
+    for (int i = 0x20; i < 0x7f; i++) {
+        printable += histogram[i];
+    }
+
+    summary->entropy = (uint8_t) (entropy / 8 * 255 + 0.5);
+    summary->zeroes = (uint8_t) (histogram[0] * 255 / size);
+    summary->printable = (uint8_t) (printable * 255 / size);
+}
+
+// Combines two cells of a level into a cell of the level above. right is NULL
+// if left is the last cell of an odd-sized level.
+//
+static void
+combine(const summary_t *left, const summary_t *right, summary_t *summary)
+{
+    if (right == NULL) {
+        *summary = *left;
+        return;
+    }
+
+    summary->entropy = left->entropy > right->entropy ? left->entropy : right->entropy;
+    summary->zeroes = (left->zeroes + right->zeroes) / 2;
+    summary->printable = (left->printable + right->printable) / 2;
+}
+
+static gpointer
+overview_worker(gpointer user_data)
+{
+    overview_t *overview = (overview_t*) user_data;
+    buffer_t *buffer = overview->buffer;
+
+    for (uint64_t i = 0; i < overview->counts[0] && !g_atomic_int_get(&overview->cancel); i++) {
+        uint64_t address = i * OVERVIEW_BLOCK_SIZE;
+        uint64_t size = overview->size - address;
+        if (size > OVERVIEW_BLOCK_SIZE) {
+            size = OVERVIEW_BLOCK_SIZE;
+        }
+
+        // The buffer may be remapped by the UI thread between blocks.
+        //
+        uint64_t histogram[256];
+        g_rw_lock_reader_lock(&buffer->lock);
+        int error = buffer_histogram(buffer, address, size, NULL, histogram);
+        g_rw_lock_reader_unlock(&buffer->lock);
+
+        if (error) {
+            memset(histogram, 0, sizeof(histogram));
+            histogram[0] = size;
+        }
+
+        summarize(histogram, size, &overview->levels[0][i]);
+
+        // Complete every parent whose children are now all summarized.
+        //
+        uint64_t child = i;
+        for (int level = 1; level < overview->depth; level++) {
+            uint64_t last = overview->counts[level - 1] - 1;
+            if (child % 2 == 0 && child != last) {
+                break;
+            }
+
+            uint64_t left = child - child % 2;
+            combine(&overview->levels[level - 1][left],
+                    left + 1 <= last ? &overview->levels[level - 1][left + 1] : NULL,
+                    &overview->levels[level][left / 2]);
+            child = left / 2;
+        }
+
+        g_atomic_int_set(&overview->done, (gint) (i + 1));
+    }
+
+    return NULL;
+}
+
+overview_t*
+overview_start(buffer_t *buffer)
+{
+    overview_t *overview = g_malloc0(sizeof(overview_t));
+    overview->buffer = buffer;
+    overview->size = buffer->size;
+    overview->edits = buffer->edits;
+
+    uint64_t count = (overview->size + OVERVIEW_BLOCK_SIZE - 1) / OVERVIEW_BLOCK_SIZE;
+    if (count == 0) {
+        count = 1;
+    }
+
+    for (overview->depth = 0; overview->depth < OVERVIEW_MAX_LEVELS; overview->depth++) {
+        overview->counts[overview->depth] = count;
+        overview->levels[overview->depth] = g_malloc0(count * sizeof(summary_t));
+
+        if (count == 1) {
+            overview->depth++;
+            break;
+        }
+
+        count = (count + 1) / 2;
+    }
+
+    overview->thread = g_thread_new("overview", overview_worker, overview);
+    return overview;
+}
+
+void
+overview_stop(overview_t *overview)
+{
+    g_atomic_int_set(&overview->cancel, 1);
+    g_thread_join(overview->thread);
+
+    for (int i = 0; i < overview->depth; i++) {
+        g_free(overview->levels[i]);
+    }
+
+    g_free(overview);
+}
+
+int
+overview_progress(overview_t *overview)
+{
+    return (int) ((uint64_t) g_atomic_int_get(&overview->done) * 100 / overview->counts[0]);
+}
+
+uint64_t
+overview_cell_size(uint64_t size, int cells)
+{
+    uint64_t cell = (size + cells - 1) / cells;
+    return cell > 0 ? cell : 1;
+}
+
+int
+overview_summary(overview_t *overview, uint64_t address, uint64_t size, summary_t *summary)
+{
+    if (size == 0) {
+        return 1;
+    }
+
+    uint64_t first = address / OVERVIEW_BLOCK_SIZE;
+    uint64_t last = (address + size - 1) / OVERVIEW_BLOCK_SIZE;
+    if (last >= overview->counts[0]) {
+        last = overview->counts[0] - 1;
+    }
+
+    if (first > last) {
+        return 1;
+    }
+
+    // Pick the finest level that covers the range in a handful of cells.
+    //
+    int level = 0;
+    while (level + 1 < overview->depth && (last >> level) - (first >> level) >= 4) {
+        level++;
+    }
+
+    // A cell is complete once the last block beneath it is.
+    //
+    uint64_t done = g_atomic_int_get(&overview->done);
+    uint64_t end = ((last >> level) + 1) << level;
+    if (end > overview->counts[0]) {
+        end = overview->counts[0];
+    }
+
+    if (end > done) {
+        return 1;
+    }
+
+    const summary_t *cells = overview->levels[level];
+    uint32_t zeroes = 0, printable = 0, cells_size = 0;
+    summary->entropy = 0;
+
+    for (uint64_t i = first >> level; i <= last >> level; i++) {
+        if (cells[i].entropy > summary->entropy) {
+            summary->entropy = cells[i].entropy;
+        }
+
+        zeroes += cells[i].zeroes;
+        printable += cells[i].printable;
+        cells_size++;
+    }
+
+    summary->zeroes = zeroes / cells_size;
+    summary->printable = printable / cells_size;
+    return 0;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+#include <gmodule.h>
+
+#include "buffer.h"
+
+// Bytes summarized by each cell at the bottom of the pyramid.
+//
+#define OVERVIEW_BLOCK_SIZE (64 * 1024)
+#define OVERVIEW_MAX_LEVELS 48
+
+// Summary of a block of the buffer. Each field is scaled to 0-255.
+//
+typedef struct {
+    // Shannon entropy in bits per byte, over 8.
+    //
+    uint8_t entropy;
+    // Ratio of zero bytes.
+    //
+    uint8_t zeroes;
+    // Ratio of printable bytes.
+    //
+    uint8_t printable;
+} summary_t;
+
+// Multi-resolution summary of a buffer, computed by a background thread. The
+// bottom level has a summary per block and each level above combines two cells
+// of the level below: the entropy is the maximum of the two, so that small
+// compressed or encrypted regions are not averaged away, and the ratios are the
+// mean.
+//
+typedef struct {
+    buffer_t *buffer;
+    // Size and edit count of the buffer summarized. The overview is stale once
+    // either differs.
+    //
+    uint64_t size;
+    uint64_t edits;
+    GThread *thread;
+    summary_t *levels[OVERVIEW_MAX_LEVELS];
+    uint64_t counts[OVERVIEW_MAX_LEVELS];
+    int depth;
+    // Number of blocks summarized so far, and if != 0, the thread should stop.
+    // Both are accessed atomically.
+    //
+    gint done;
+    gint cancel;
+} overview_t;
+
+// Starts summarizing the buffer in the background. The buffer MUST outlive the
+// overview.
+//
+overview_t *overview_start(buffer_t *buffer);
+// Stops the background thread and frees the overview.
+//
+void overview_stop(overview_t *overview);
+// Returns the percentage of the buffer summarized so far.
+//
+int overview_progress(overview_t *overview);
+// Returns the number of bytes in each cell when a buffer of the given size is
+// shown as a number of cells.
+//
+uint64_t overview_cell_size(uint64_t size, int cells);
+// Summarizes the range from the coarsest level which still resolves it.
+// Returns 1 if the range has not been summarized yet.
+//
+int overview_summary(overview_t *overview, uint64_t address, uint64_t size, summary_t *summary);
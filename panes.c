@@ -12,6 +12,30 @@ pane_drive(pane_t *pane, int input)
     pane->driver(pane->user_data, input);
 }
 
+void
+pane_draw(pane_t *pane, const frame_t *frame)
+{
+    pane->draw(pane->user_data, frame);
+}
+
+void
+pane_view(pane_t *pane, uint64_t *address, uint64_t *size)
+{
+    pane->view(pane->user_data, address, size);
+}
+
+void
+pane_follow(pane_t *pane, uint64_t address)
+{
+    pane->follow(pane->user_data, address);
+}
+
+int
+pane_paste(pane_t *pane, const uint8_t *data, size_t size)
+{
+    return pane->paste(pane->user_data, data, size);
+}
+
 void
 pane_unpost(pane_t *pane)
 {
@@ -25,6 +49,12 @@ pane_scroll(pane_t *pane, uint64_t offset)
     pane->scroll(pane->user_data, offset);
 }
 
+void
+pane_resize(pane_t *pane, int x, int width, int height)
+{
+    pane->resize(pane->user_data, x, width, height);
+}
+
 // If a character can be printed to the screen SAFELY.
 //
 static inline int
@@ -33,24 +63,69 @@ can_print(char c)
     return (unsigned) c - 0x20 < 0x5f;
 }
 
+// Returns the bytes at address, which MUST be inside of the frame.
+//
+static inline const uint8_t*
+frame_data(const frame_t *frame, uint64_t address)
+{
+    return frame->data + (address - frame->address);
+}
+
+// If the byte at address, which MUST be inside of the frame, differs from the
+// snapshot compared with.
+//
+static inline int
+frame_changed(const frame_t *frame, uint64_t address)
+{
+    return frame->changed != NULL && frame->changed[address - frame->address];
+}
+
+// Blanks the rows of a pane that are past the end of the buffer.
+//
+static void
+blank_rows(int row, int x, int width, int height)
+{
+    attrset(COLOR_PAIR(COLOR_STANDARD));
+    for (; row < height - 1; row++) {
+        mvhline(row, x, ' ', width);
+    }
+}
+
 const options_t HEX_OPT = {
     [0 ... 9] = "      ",
     [2] = "Edit  ",
     // Handled in main driver.
     //
+    [1] = "SaveAs",
+    [3] = "Split ",
     [4] = "Goto  ",
+    [5] = "Layout",
+    [6] = "Find  ",
     [8] = "Names ",
 };
 
 typedef struct {
     buffer_t *buffer;
+    // Owned by the caller, and may change between updates.
+    //
+    const layout_t *layout;
     // If on the odd-end of a pair, e.g.: 0 for "[0]0" and 1 for "0[0]"
     //
     int odd;
     // If in edit mode, != 0.
     //
     int edit;
+    // If != 0, typing the high nibble of a byte in edit mode inserts a byte
+    // before the cursor instead of overwriting it.
+    //
+    int insert;
     uint64_t scroll;
+    // Column, width and screen height of the area the pane was last laid out
+    // for.
+    //
+    int x;
+    int width;
+    int height;
 } hex_pane_t;
 
 static void
@@ -59,26 +134,58 @@ hex_unpost(void *user_data)
     free(user_data);
 }
 
+int
+hex_columns(const layout_t *layout, int width)
+{
+    // Each row is ".00000000`00000000:  ", "00 " per byte, a separator and
+    // one printable character per byte.
+    //
+    int fit = (width - 22) / 4;
+
+    // Only fit whole groups, unless not even a single group fits.
+    //
+    if (layout->group > 0 && fit > layout->group) {
+        fit -= fit % layout->group;
+    }
+
+    if (fit < 1) {
+        fit = 1;
+    }
+
+    if (layout->columns > 0 && layout->columns < fit) {
+        return layout->columns;
+    }
+
+    return fit;
+}
+
 static void
-hex_update(hex_pane_t *pane, int width, int height)
+hex_update(hex_pane_t *pane, const frame_t *frame)
 {
     attrset(COLOR_PAIR(COLOR_STANDARD));
     buffer_t *buffer = pane->buffer;
+    int width = pane->width, height = pane->height;
 
-    uint8_t *data = buffer->data + pane->scroll * 16;
-    cursor_t current;
-    for (int i = 1; (current = data - buffer->data) < buffer->size && i < (height - 1); data += 16, i++) {
-        // Determine the number of characters left in this row: 16 unless there
-        // is no more data to print.
+    int columns = hex_columns(pane->layout, width);
+    int group = pane->layout->group;
+
+    cursor_t row = pane->scroll * columns;
+    int i;
+    for (i = 1; row < buffer->size && i < (height - 1); row += columns, i++) {
+        const uint8_t *data = frame_data(frame, row);
+        cursor_t current = row;
+
+        // Determine the number of characters left in this row: a full row
+        // unless there is no more data to print.
         //
         size_t size = buffer->size - current;
-        if (size >= 16) {
-            size = 16;
+        if (size >= columns) {
+            size = columns;
         }
 
         // .00000000`00000000:
         //
-        size_t offset = 0, wrote;
+        size_t offset = pane->x, wrote;
         char addr_str[22];
         wrote = snprintf(addr_str, sizeof(addr_str), ".%08lx`%08lx:  ",
                 current & 0xffffffff00000000,
@@ -102,6 +209,11 @@ hex_update(hex_pane_t *pane, int width, int height)
                 }
             }
 
+            int changed = frame_changed(frame, current);
+            if (changed) {
+                attrset(COLOR_PAIR(HIGHLIGHT_BLUE));
+            }
+
             // If the block is under the cursor or inside of a mark, color it.
             //
             cursor_t mark_end = buffer->end_mark == -1 ? buffer->cursor : buffer->end_mark;
@@ -142,8 +254,12 @@ hex_update(hex_pane_t *pane, int width, int height)
                 attrset(COLOR_PAIR(COLOR_STANDARD));
             }
 
+            // A run of changed bytes is joined up to its last byte.
+            //
             int in_range = range != NULL && range->address + range->size - 1 == current;
-            if ((buffer->cursor == current && !mark_backwards && !mark_forwards) || j == 15 || in_range) {
+            int changed_end = changed && (j == size - 1 || !frame_changed(frame, current + 1));
+            if ((buffer->cursor == current && !mark_backwards && !mark_forwards) || j == columns - 1 || in_range
+                    || changed_end) {
                 attrset(COLOR_PAIR(COLOR_STANDARD));
             }
 
@@ -153,9 +269,9 @@ hex_update(hex_pane_t *pane, int width, int height)
 
             current++;
 
-            // Terminate the hex pair with a dash if it is a multiple of 4.
+            // Terminate the hex pair with a dash if it ends a group.
             //
-            char end = (j + 1) % 4 == 0 && j != 15 ? '-' : ' ';
+            char end = group > 0 && (j + 1) % group == 0 && j != columns - 1 ? '-' : ' ';
             char term_str[2] = { end, '\0' };
             mvaddstr(i, offset, term_str);
             offset += 1;
@@ -165,9 +281,9 @@ hex_update(hex_pane_t *pane, int width, int height)
 
         current -= size;
 
-        // If size <= 16, add more spaces.
+        // If the row is short, add more spaces.
         //
-        for (int j = 0; j < 16 - size; j++) {
+        for (int j = 0; j < columns - size; j++) {
             // For each character in the pair, e.g.: "00 ".
             //
             mvaddstr(i, offset, "   ");
@@ -192,6 +308,8 @@ hex_update(hex_pane_t *pane, int width, int height)
             int mark_backwards = buffer->start_mark != -1 && current <= buffer->start_mark && current >= mark_end;
             if (buffer->cursor == current || (!pane->edit && (mark_forwards || mark_backwards))) {
                 attrset(COLOR_PAIR(COLOR_SELECTED));
+            } else if (frame_changed(frame, current)) {
+                attrset(COLOR_PAIR(HIGHLIGHT_BLUE));
             }
 
             mvaddstr(i, offset, print_str);
@@ -201,19 +319,20 @@ hex_update(hex_pane_t *pane, int width, int height)
             attrset(COLOR_PAIR(COLOR_STANDARD));
         }
 
-        // If size <= 16, add more spaces.
+        // If the row is short, add more spaces, up to the edge of the pane.
         //
-        for (int j = 0; j < 16 - size; j++) {
-            mvaddstr(i, offset, " ");
-            offset++;
+        if (offset < pane->x + width) {
+            mvhline(i, offset, ' ', pane->x + width - offset);
         }
     }
 
+    blank_rows(i, pane->x, width, height);
+
     // Convert 1D cursor coordinate to 2D.
     //
     cursor_t cursor = buffer->cursor;
-    int x = strlen(".00000000`00000000: ");
-    int y = (cursor / 16 - pane->scroll) + 1; // Account for the status bar
+    int x = pane->x + strlen(".00000000`00000000: ");
+    int y = (cursor / columns - pane->scroll) + 1; // Account for the status bar
 
     // If there is a comment present: print the comment shifted down or up
     // depending if there is space.
@@ -227,7 +346,7 @@ hex_update(hex_pane_t *pane, int width, int height)
         }
         attrset(COLOR_PAIR(COLOR_SELECTED));
         mvaddstr(y, x, "; ");
-        mvaddstr(y, x + 2, comment);
+        mvaddnstr(y, x + 2, comment, pane->x + width - x - 2);
         attrset(COLOR_PAIR(COLOR_STANDARD));
     }
 }
@@ -238,9 +357,8 @@ hex_driver(void *user_data, int input)
     hex_pane_t *pane = (hex_pane_t*) user_data;
     buffer_t *buffer = pane->buffer;
 
-    int height, width;
-    getmaxyx(stdscr, height, width);
-    width = 16;
+    int height = pane->height;
+    int width = hex_columns(pane->layout, pane->width);
 
     cursor_t top = pane->scroll * width;
     cursor_t bottom = top + (height - 3) * width;
@@ -420,7 +538,17 @@ end:
             n = 10 + input - 'a';
         }
 
-        uint8_t b = buffer->data[buffer->cursor];
+        if (pane->insert && !pane->odd) {
+            uint8_t b = n << 4;
+            buffer_insert(buffer, buffer->cursor, &b, 1);
+            goto advance;
+        }
+
+        uint8_t b;
+        if (buffer_read_at(buffer, buffer->cursor, &b, 1)) {
+            break;
+        }
+
         uint8_t st = b & 0x0f;
         uint8_t nd = (b & 0xf0) >> 4;
 
@@ -430,9 +558,41 @@ end:
             nd = n;
         }
 
-        buffer->data[buffer->cursor] = ((nd << 4) | st);
+        b = (nd << 4) | st;
+        buffer_write(buffer, buffer->cursor, &b, 1);
         goto advance;
     } break;
+    case KEY_IC:
+        if (pane->edit) {
+            pane->insert = !pane->insert;
+        }
+        break;
+    case KEY_BACKSPACE:
+    case '\x7f':
+    case KEY_DC: {
+        if (!pane->edit)
+            break;
+
+        // Backspace deletes the byte before the cursor, and Delete the byte
+        // under it.
+        //
+        uint64_t address = buffer->cursor;
+        if (input != KEY_DC) {
+            if (address == 0) {
+                break;
+            }
+
+            address--;
+        }
+
+        if (buffer_delete(buffer, address, 1)) {
+            break;
+        }
+
+        buffer->cursor = MIN(address, buffer->size - 1);
+        pane->odd = 0;
+        pane->scroll = buffer_follow(buffer, top, width, height);
+    } break;
     case '+':
         buffer_bookmark_push(buffer, buffer->cursor);
         break;
@@ -444,42 +604,109 @@ end:
         }
     } break;
     }
+}
+
+static int
+hex_paste(void *user_data, const uint8_t *data, size_t size)
+{
+    hex_pane_t *pane = (hex_pane_t*) user_data;
+    buffer_t *buffer = pane->buffer;
+
+    if (!pane->edit) {
+        return 1;
+    }
 
-    hex_update(pane, width, height);
+    uint64_t address = buffer->cursor;
+    if ((pane->insert ? buffer_insert : buffer_write)(buffer, address, data, size)) {
+        return 2;
+    }
+
+    int width = hex_columns(pane->layout, pane->width);
+    buffer->cursor = MIN(address + size, buffer->size - 1);
+    pane->odd = 0;
+    pane->scroll = buffer_follow(buffer, pane->scroll * width, width, pane->height);
+    return 0;
 }
 
 static void
-hex_scroll(void *user_data, uint64_t offset)
+hex_draw(void *user_data, const frame_t *frame)
+{
+    hex_update((hex_pane_t*) user_data, frame);
+}
+
+static void
+hex_view(void *user_data, uint64_t *address, uint64_t *size)
 {
     hex_pane_t *pane = (hex_pane_t*) user_data;
 
-    int height, width;
-    getmaxyx(stdscr, height, width);
-    (void) width;
+    int columns = hex_columns(pane->layout, pane->width);
+    buffer_view(pane->buffer, pane->scroll, columns, pane->height, address, size);
+}
+
+static void
+hex_follow(void *user_data, uint64_t address)
+{
+    hex_pane_t *pane = (hex_pane_t*) user_data;
+
+    int columns = hex_columns(pane->layout, pane->width);
+    pane->scroll = buffer_follow(pane->buffer, address, columns, pane->height);
+}
+
+static void
+hex_scroll(void *user_data, uint64_t offset)
+{
+    hex_pane_t *pane = (hex_pane_t*) user_data;
 
-    pane->scroll = buffer_scroll(pane->buffer, offset, 16, height);
+    int columns = hex_columns(pane->layout, pane->width);
+    pane->scroll = buffer_scroll(pane->buffer, offset, columns, pane->height);
     pane->odd = 0;
 }
 
+static void
+hex_resize(void *user_data, int x, int width, int height)
+{
+    hex_pane_t *pane = (hex_pane_t*) user_data;
+
+    // Keep the cursor on the same screen row it was on before the resize.
+    //
+    int columns = hex_columns(pane->layout, pane->width);
+    int64_t row = (int64_t) (pane->buffer->cursor / columns) - (int64_t) pane->scroll;
+
+    pane->x = x;
+    pane->width = width;
+    pane->height = height;
+
+    columns = hex_columns(pane->layout, width);
+    pane->scroll = buffer_anchor(pane->buffer, row, columns, height);
+}
+
 pane_t*
-hex_post(buffer_t *buffer, int width, int height)
+hex_post(buffer_t *buffer, const layout_t *layout, int x, int width, int height)
 {
     hex_pane_t *hex_pane = malloc(sizeof(hex_pane_t));
     hex_pane->buffer = buffer;
+    hex_pane->layout = layout;
     hex_pane->odd = 0;
     hex_pane->edit = 0;
+    hex_pane->insert = 0;
+    hex_pane->x = x;
+    hex_pane->width = width;
+    hex_pane->height = height;
     hex_scroll((void*) hex_pane, buffer->cursor);
 
     pane_t *pane = malloc(sizeof(pane_t));
     pane->driver = hex_driver;
+    pane->draw = hex_draw;
     pane->unpost = hex_unpost;
     pane->scroll = hex_scroll;
+    pane->resize = hex_resize;
+    pane->view = hex_view;
+    pane->follow = hex_follow;
+    pane->paste = hex_paste;
     pane->options = &HEX_OPT;
     pane->user_data = (void*) hex_pane;
     pane->type = PANE_HEX;
 
-    hex_update(hex_pane, width, height);
-
     return pane;
 }
 
@@ -487,25 +714,38 @@ const options_t TEXT_OPT = {
     [0 ... 9] = "      ",
     // Handled in main driver.
     //
+    [1] = "SaveAs",
+    [3] = "Split ",
     [4] = "Goto  ",
+    [6] = "Find  ",
     [8] = "Names ",
 };
 
 typedef struct {
     buffer_t *buffer;
     uint64_t scroll;
+    // Column, width and screen height of the area the pane was last laid out
+    // for.
+    //
+    int x;
+    int width;
+    int height;
 } text_pane_t;
 
 static void
-text_update(text_pane_t *pane, int width, int height)
+text_update(text_pane_t *pane, const frame_t *frame)
 {
     attrset(COLOR_PAIR(COLOR_STANDARD));
 
     buffer_t *buffer = pane->buffer;
+    int x = pane->x, width = pane->width, height = pane->height;
+
+    cursor_t row = pane->scroll * width;
+    int i;
+    for (i = 1; row < buffer->size && i < (height - 1); row += width, i++) {
+        const uint8_t *data = frame_data(frame, row);
+        cursor_t current = row;
 
-    uint8_t *data = buffer->data + pane->scroll * width;
-    cursor_t current;
-    for (int i = 1; (current = data - buffer->data) < buffer->size && i < (height - 1); data += width, i++) {
         size_t size = buffer->size - current;
         if (size >= width) {
             size = width;
@@ -523,8 +763,10 @@ text_update(text_pane_t *pane, int width, int height)
             int mark_backwards = buffer->start_mark != -1 && current <= buffer->start_mark && current >= mark_end;
             if (buffer->cursor == current || mark_forwards || mark_backwards) {
                 attrset(COLOR_PAIR(COLOR_SELECTED));
+            } else if (frame_changed(frame, current)) {
+                attrset(COLOR_PAIR(HIGHLIGHT_BLUE));
             }
-            mvaddch(i, j, c);
+            mvaddch(i, x + j, c);
             attrset(COLOR_PAIR(COLOR_STANDARD));
             current++;
         }
@@ -533,9 +775,11 @@ text_update(text_pane_t *pane, int width, int height)
         //
         attrset(COLOR_PAIR(COLOR_STANDARD));
         for (int j = 0; j < width - size; j++) {
-            mvaddch(i, size + j, ' ');
+            mvaddch(i, x + size + j, ' ');
         }
     }
+
+    blank_rows(i, x, width, height);
 }
 
 static void
@@ -544,8 +788,7 @@ text_driver(void *user_data, int input)
     text_pane_t *pane = (text_pane_t*) user_data;
     buffer_t *buffer = pane->buffer;
 
-    int height, width;
-    getmaxyx(stdscr, height, width);
+    int height = pane->height, width = pane->width;
 
     cursor_t top = pane->scroll * width;
     cursor_t bottom = top + (height - 3) * width;
@@ -670,8 +913,36 @@ end:
         }
         break;
     }
+}
 
-    text_update(pane, width, height);
+static void
+text_draw(void *user_data, const frame_t *frame)
+{
+    text_update((text_pane_t*) user_data, frame);
+}
+
+static void
+text_view(void *user_data, uint64_t *address, uint64_t *size)
+{
+    text_pane_t *pane = (text_pane_t*) user_data;
+
+    buffer_view(pane->buffer, pane->scroll, pane->width, pane->height, address, size);
+}
+
+static void
+text_follow(void *user_data, uint64_t address)
+{
+    text_pane_t *pane = (text_pane_t*) user_data;
+
+    pane->scroll = buffer_follow(pane->buffer, address, pane->width, pane->height);
+}
+
+// The text pane has no edit mode.
+//
+static int
+text_paste(void *user_data, const uint8_t *data, size_t size)
+{
+    return 1;
 }
 
 static void
@@ -685,28 +956,46 @@ text_scroll(void *user_data, uint64_t offset)
 {
     text_pane_t *pane = (text_pane_t*) user_data;
 
-    int height, width;
-    getmaxyx(stdscr, height, width);
+    pane->scroll = buffer_scroll(pane->buffer, offset, pane->width, pane->height);
+}
+
+static void
+text_resize(void *user_data, int x, int width, int height)
+{
+    text_pane_t *pane = (text_pane_t*) user_data;
+
+    // Keep the cursor on the same screen row it was on before the resize.
+    //
+    int64_t row = (int64_t) (pane->buffer->cursor / pane->width) - (int64_t) pane->scroll;
 
-    pane->scroll = buffer_scroll(pane->buffer, offset, width, height);
+    pane->x = x;
+    pane->width = width;
+    pane->height = height;
+    pane->scroll = buffer_anchor(pane->buffer, row, width, height);
 }
 
 pane_t*
-text_post(buffer_t *buffer, int width, int height)
+text_post(buffer_t *buffer, int x, int width, int height)
 {
     text_pane_t *text_pane = malloc(sizeof(text_pane_t));
     text_pane->buffer = buffer;
+    text_pane->x = x;
+    text_pane->width = width;
+    text_pane->height = height;
     text_scroll((void*) text_pane, buffer->cursor);
 
     pane_t *pane = malloc(sizeof(pane_t));
     pane->driver = text_driver;
+    pane->draw = text_draw;
     pane->unpost = text_unpost;
     pane->scroll = text_scroll;
+    pane->resize = text_resize;
+    pane->view = text_view;
+    pane->follow = text_follow;
+    pane->paste = text_paste;
     pane->options = &TEXT_OPT;
     pane->user_data = text_pane;
     pane->type = PANE_TEXT;
 
-    text_update(text_pane, width, height);
-
     return pane;
 }
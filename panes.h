@@ -13,23 +13,75 @@ typedef enum {
     PANE_TEXT,
 } pane_type_t;
 
+// Bytes read from the buffer for a single frame. Every pane on screen draws
+// from the same frame, so the buffer is only read once per frame.
+//
+typedef struct {
+    uint64_t address;
+    uint64_t size;
+    const uint8_t *data;
+    // If not NULL, != 0 for each byte that differs from the snapshot compared
+    // with.
+    //
+    const uint8_t *changed;
+} frame_t;
+
 typedef struct {
     pane_type_t type;
     void (*driver)(void *user_data, int input);
+    void (*draw)(void *user_data, const frame_t *frame);
     void (*unpost)(void *user_data);
     void (*scroll)(void *user_data, uint64_t offset);
+    void (*resize)(void *user_data, int x, int width, int height);
+    void (*view)(void *user_data, uint64_t *address, uint64_t *size);
+    void (*follow)(void *user_data, uint64_t address);
+    int (*paste)(void *user_data, const uint8_t *data, size_t size);
     const options_t *options;
     void *user_data;
 } pane_t;
 
+// Handles an input. The pane is NOT redrawn.
+//
 void pane_drive(pane_t *pane, int input);
+// Draws the pane from a frame, which MUST contain the range from pane_view.
+//
+void pane_draw(pane_t *pane, const frame_t *frame);
 void pane_unpost(pane_t *pane);
 // Scroll to a PHYSICAL offset.
 //
 void pane_scroll(pane_t *pane, uint64_t offset);
+// Lay the pane out over the columns [x, x + width) of a screen of the given
+// height, keeping the cursor on the same row where possible.
+//
+void pane_resize(pane_t *pane, int x, int width, int height);
+// Sets address and size to the range of the buffer visible in the pane.
+//
+void pane_view(pane_t *pane, uint64_t *address, uint64_t *size);
+// Scroll so the top row is at address, or as close as possible while keeping
+// the cursor visible. Used to keep an unfocused pane in sync.
+//
+void pane_follow(pane_t *pane, uint64_t address);
+// Writes bytes at the cursor as one edit, over those there or before them in
+// insert mode, and moves the cursor past them. Returns 1 if the pane is not in
+// edit mode, and 2 if the bytes do not fit before the end of the buffer.
+//
+int pane_paste(pane_t *pane, const uint8_t *data, size_t size);
+
+// Row layout of the hex pane. A column count of 0 fits as many bytes per row
+// as the screen allows. A group of 0 disables the dash separators.
+//
+typedef struct {
+    int columns;
+    int group;
+} layout_t;
+
+// Returns the number of bytes per row for the layout on a screen of the given
+// width. Fixed column counts are clamped to what fits on the screen.
+//
+int hex_columns(const layout_t *layout, int width);
 
 extern const options_t HEX_OPT;
-pane_t *hex_post(buffer_t *buffer, int width, int height);
+pane_t *hex_post(buffer_t *buffer, const layout_t *layout, int x, int width, int height);
 
 extern const options_t TEXT_OPT;
-pane_t *text_post(buffer_t *buffer, int width, int height);
+pane_t *text_post(buffer_t *buffer, int x, int width, int height);
@@ -0,0 +1,969 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "patch.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Runs of at least this many equal bytes are written as runs, and changes at
+// most this many bytes apart as one record, which is cheaper than two.
+//
+#define PATCH_RUN_SIZE 16
+#define PATCH_GAP_SIZE 8
+
+#define PATCH_IPS_RECORD_SIZE 0xffff
+#define PATCH_IPS_LIMIT 0x1000000
+// A record at the offset spelling "EOF" would end the patch.
+//
+#define PATCH_IPS_EOF 0x454f46
+#define PATCH_NATIVE_RECORD_SIZE (1024 * 1024)
+
+// Bytes read and written at a time when applying a patch.
+//
+#define PATCH_CHUNK_SIZE (1024 * 1024)
+
+// Types of the records of the native format.
+//
+enum {
+    NATIVE_END,
+    NATIVE_BYTES,
+    NATIVE_RUN,
+    NATIVE_COPY,
+};
+
+// Actions of BPS.
+//
+enum {
+    BPS_SOURCE_READ,
+    BPS_TARGET_READ,
+    BPS_SOURCE_COPY,
+    BPS_TARGET_COPY,
+};
+
+static const char IPS_MAGIC[] = "PATCH";
+static const char BPS_MAGIC[] = "BPS1";
+static const char NATIVE_MAGIC[] = "HXP1";
+
+typedef struct {
+    FILE *file;
+    buffer_t *buffer;
+    patch_format_t format;
+    // The CRC-32 of the patch so far, and 1 if it could not be written or 2
+    // if the format cannot express the changes.
+    //
+    uint32_t crc;
+    int error;
+    // Changed bytes not written yet, from offset.
+    //
+    uint64_t offset;
+    GByteArray *pending;
+    // Bytes of the result written by BPS actions, and the offsets the next
+    // copies are relative to.
+    //
+    uint64_t output;
+    uint64_t source_relative;
+    uint64_t target_relative;
+} writer_t;
+
+static void
+writer_bytes(writer_t *writer, const void *data, size_t size)
+{
+    if (writer->error) {
+        return;
+    }
+
+    if (fwrite(data, 1, size, writer->file) != size) {
+        writer->error = 1;
+    }
+
+    writer->crc = buffer_crc32_data(writer->crc, data, size);
+}
+
+static void
+writer_u8(writer_t *writer, uint8_t value)
+{
+    writer_bytes(writer, &value, 1);
+}
+
+// Writes the low size bytes of a value, most significant first if big.
+//
+static void
+writer_number(writer_t *writer, uint64_t value, int size, int big)
+{
+    uint8_t bytes[8];
+    for (int i = 0; i < size; i++) {
+        bytes[big ? size - 1 - i : i] = value >> (i * 8);
+    }
+
+    writer_bytes(writer, bytes, size);
+}
+
+// BPS numbers are 7 bits a byte, least significant first, with the last byte
+// flagged. Each byte but the last counts from one, so that every number has a
+// single encoding.
+//
+static void
+writer_bps_number(writer_t *writer, uint64_t value)
+{
+    for (;;) {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        if (value == 0) {
+            writer_u8(writer, byte | 0x80);
+            break;
+        }
+
+        writer_u8(writer, byte);
+        value--;
+    }
+}
+
+static void
+writer_bps_action(writer_t *writer, int action, uint64_t size)
+{
+    writer_bps_number(writer, (size - 1) << 2 | action);
+}
+
+// Copies are relative to the end of the previous one, with the sign in the
+// lowest bit.
+//
+static void
+writer_bps_relative(writer_t *writer, uint64_t *relative, uint64_t offset, uint64_t size)
+{
+    uint64_t distance = offset >= *relative ? offset - *relative : *relative - offset;
+    writer_bps_number(writer, distance << 1 | (offset < *relative));
+    *relative = offset + size;
+}
+
+// Returns the number of bytes equal to the first, up to size.
+//
+static size_t
+run_size(const uint8_t *data, size_t size)
+{
+    size_t i = 1;
+    while (i < size && data[i] == data[0]) {
+        i++;
+    }
+
+    return i;
+}
+
+// Writes a record of bytes, or of a run of a byte if data is NULL.
+//
+static void
+writer_record(writer_t *writer, uint64_t offset, const uint8_t *data, size_t size, uint8_t byte)
+{
+    if (writer->format == PATCH_NATIVE) {
+        writer_u8(writer, data != NULL ? NATIVE_BYTES : NATIVE_RUN);
+        writer_number(writer, offset, 8, 0);
+        writer_number(writer, size, 8, 0);
+        if (data != NULL) {
+            writer_bytes(writer, data, size);
+        } else {
+            writer_u8(writer, byte);
+        }
+        return;
+    }
+
+    if (offset + size > PATCH_IPS_LIMIT) {
+        writer->error = 2;
+        return;
+    }
+
+    // The first byte is written with the one before instead, which is
+    // unchanged.
+    //
+    if (offset == PATCH_IPS_EOF) {
+        uint8_t pair[2] = { 0, data != NULL ? data[0] : byte };
+        (void) buffer_read_at(writer->buffer, offset - 1, pair, 1);
+        writer_record(writer, offset - 1, pair, 2, 0);
+
+        if (size > 1) {
+            writer_record(writer, offset + 1, data != NULL ? data + 1 : NULL, size - 1, byte);
+        }
+        return;
+    }
+
+    writer_number(writer, offset, 3, 1);
+    if (data != NULL) {
+        writer_number(writer, size, 2, 1);
+        writer_bytes(writer, data, size);
+    } else {
+        writer_number(writer, 0, 2, 1);
+        writer_number(writer, size, 2, 1);
+        writer_u8(writer, byte);
+    }
+}
+
+// Writes the changed bytes pending as records, runs apart.
+//
+static void
+writer_flush(writer_t *writer)
+{
+    const uint8_t *data = writer->pending->data;
+    size_t size = writer->pending->len;
+
+    size_t bytes = 0;
+    for (size_t i = 0; i < size;) {
+        size_t run = run_size(data + i, size - i);
+        if (run >= PATCH_RUN_SIZE) {
+            if (i > bytes) {
+                writer_record(writer, writer->offset + bytes, data + bytes, i - bytes, 0);
+            }
+
+            writer_record(writer, writer->offset + i, NULL, run, data[i]);
+            bytes = i + run;
+        }
+
+        i += run;
+    }
+
+    if (size > bytes) {
+        writer_record(writer, writer->offset + bytes, data + bytes, size - bytes, 0);
+    }
+
+    writer->offset += size;
+    g_byte_array_set_size(writer->pending, 0);
+}
+
+// Adds changed bytes at offset, after those pending.
+//
+static void
+writer_change(writer_t *writer, uint64_t offset, const uint8_t *data, size_t size)
+{
+    size_t limit = writer->format == PATCH_IPS ? PATCH_IPS_RECORD_SIZE : PATCH_NATIVE_RECORD_SIZE;
+    uint64_t end = writer->offset + writer->pending->len;
+    if (writer->pending->len > 0 && offset > end && offset - end <= PATCH_GAP_SIZE
+            && writer->pending->len + PATCH_GAP_SIZE < limit) {
+        uint8_t gap[PATCH_GAP_SIZE];
+        (void) buffer_read_at(writer->buffer, end, gap, offset - end);
+        g_byte_array_append(writer->pending, gap, offset - end);
+    } else if (offset != end) {
+        writer_flush(writer);
+        writer->offset = offset;
+    }
+
+    while (size > 0) {
+        size_t chunk = MIN(size, limit - writer->pending->len);
+        g_byte_array_append(writer->pending, data, chunk);
+        data += chunk;
+        size -= chunk;
+
+        if (writer->pending->len == limit) {
+            writer_flush(writer);
+        }
+    }
+}
+
+// Adds the bytes of a piece that differ from those of the file at the same
+// offset.
+//
+static void
+writer_diff(writer_t *writer, const piece_t *piece)
+{
+    buffer_t *buffer = writer->buffer;
+    const uint8_t *data = piece->data != NULL ? piece->data : buffer->data + piece->source;
+
+    uint64_t i = 0;
+    while (i < piece->size) {
+        uint64_t offset = piece->start + i;
+        if (offset < buffer->data_size && data[i] == buffer->data[offset]) {
+            i++;
+            continue;
+        }
+
+        uint64_t changed = i;
+        while (i < piece->size && (piece->start + i >= buffer->data_size || data[i] != buffer->data[piece->start + i])) {
+            i++;
+        }
+
+        writer_change(writer, piece->start + changed, data + changed, i - changed);
+    }
+}
+
+static void
+export_records(writer_t *writer)
+{
+    buffer_t *buffer = writer->buffer;
+
+    writer->pending = g_byte_array_new();
+    for (guint i = 0; i < buffer->pieces->len && !writer->error; i++) {
+        const piece_t *piece = &g_array_index(buffer->pieces, piece_t, i);
+        if (piece->data == NULL && piece->source == piece->start) {
+            continue;
+        }
+
+        // The native format copies the bytes of the file that moved.
+        //
+        if (writer->format == PATCH_NATIVE && piece->data == NULL) {
+            writer_flush(writer);
+            writer_u8(writer, NATIVE_COPY);
+            writer_number(writer, piece->start, 8, 0);
+            writer_number(writer, piece->size, 8, 0);
+            writer_number(writer, piece->source, 8, 0);
+            continue;
+        }
+
+        writer_diff(writer, piece);
+    }
+
+    writer_flush(writer);
+    g_byte_array_unref(writer->pending);
+}
+
+static void
+export_ips(writer_t *writer)
+{
+    buffer_t *buffer = writer->buffer;
+
+    writer_bytes(writer, IPS_MAGIC, 5);
+    export_records(writer);
+    writer_bytes(writer, "EOF", 3);
+
+    // Truncation is an extension, after the end.
+    //
+    if (buffer->size < buffer->data_size) {
+        if (buffer->size >= PATCH_IPS_LIMIT) {
+            writer->error = 2;
+        }
+
+        writer_number(writer, buffer->size, 3, 1);
+    }
+}
+
+static void
+export_native(writer_t *writer)
+{
+    writer_bytes(writer, NATIVE_MAGIC, 4);
+    writer_number(writer, writer->buffer->data_size, 8, 0);
+    writer_number(writer, writer->buffer->size, 8, 0);
+    export_records(writer);
+    writer_u8(writer, NATIVE_END);
+}
+
+// Writes the bytes of a piece added by an edit, with runs copied from their
+// first byte.
+//
+static void
+export_bps_added(writer_t *writer, const piece_t *piece)
+{
+    const uint8_t *data = piece->data;
+
+    size_t bytes = 0;
+    for (size_t i = 0; i < piece->size;) {
+        size_t run = run_size(data + i, piece->size - i);
+        if (run >= PATCH_RUN_SIZE) {
+            writer_bps_action(writer, BPS_TARGET_READ, i + 1 - bytes);
+            writer_bytes(writer, data + bytes, i + 1 - bytes);
+
+            writer_bps_action(writer, BPS_TARGET_COPY, run - 1);
+            writer_bps_relative(writer, &writer->target_relative, writer->output + i, run - 1);
+            bytes = i + run;
+        }
+
+        i += run;
+    }
+
+    if (piece->size > bytes) {
+        writer_bps_action(writer, BPS_TARGET_READ, piece->size - bytes);
+        writer_bytes(writer, data + bytes, piece->size - bytes);
+    }
+}
+
+static void
+export_bps(writer_t *writer)
+{
+    buffer_t *buffer = writer->buffer;
+
+    writer_bytes(writer, BPS_MAGIC, 4);
+    writer_bps_number(writer, buffer->data_size);
+    writer_bps_number(writer, buffer->size);
+    writer_bps_number(writer, 0);
+
+    for (guint i = 0; i < buffer->pieces->len && !writer->error; i++) {
+        const piece_t *piece = &g_array_index(buffer->pieces, piece_t, i);
+
+        if (piece->data != NULL) {
+            export_bps_added(writer, piece);
+        } else if (piece->source == piece->start) {
+            writer_bps_action(writer, BPS_SOURCE_READ, piece->size);
+        } else {
+            writer_bps_action(writer, BPS_SOURCE_COPY, piece->size);
+            writer_bps_relative(writer, &writer->source_relative, piece->source, piece->size);
+        }
+
+        writer->output += piece->size;
+    }
+
+    uint32_t target;
+    (void) buffer_crc32(buffer, 0, buffer->size, NULL, &target);
+    writer_number(writer, buffer_crc32_data(0, buffer->data, buffer->data_size), 4, 0);
+    writer_number(writer, target, 4, 0);
+    writer_number(writer, writer->crc, 4, 0);
+}
+
+int
+patch_export(buffer_t *buffer, patch_format_t format, const char *path)
+{
+    if (buffer->f < 0) {
+        return 1;
+    }
+
+    writer_t writer = {
+        .file = fopen(path, "wb"),
+        .buffer = buffer,
+        .format = format,
+    };
+
+    if (writer.file == NULL) {
+        return 1;
+    }
+
+    switch (format) {
+    case PATCH_IPS:
+        export_ips(&writer);
+        break;
+    case PATCH_BPS:
+        export_bps(&writer);
+        break;
+    case PATCH_NATIVE:
+        export_native(&writer);
+        break;
+    }
+
+    if (fclose(writer.file) != 0 && writer.error == 0) {
+        writer.error = 1;
+    }
+
+    if (writer.error) {
+        unlink(path);
+    }
+
+    return writer.error;
+}
+
+typedef struct {
+    FILE *file;
+    // The CRC-32 of the bytes read so far, and their number.
+    //
+    uint32_t crc;
+    uint64_t offset;
+    // The file patched, mapped, and the result.
+    //
+    int source;
+    const uint8_t *data;
+    uint64_t size;
+    int target;
+    // Bytes of the result not written yet, from written, and the CRC-32 of
+    // all of them.
+    //
+    uint8_t *output;
+    size_t output_size;
+    uint64_t written;
+    uint32_t output_crc;
+    // Bytes read or written at a time.
+    //
+    uint8_t *chunk;
+} reader_t;
+
+static int
+reader_bytes(reader_t *reader, void *data, size_t size)
+{
+    if (fread(data, 1, size, reader->file) != size) {
+        return 1;
+    }
+
+    reader->crc = buffer_crc32_data(reader->crc, data, size);
+    reader->offset += size;
+    return 0;
+}
+
+static int
+reader_number(reader_t *reader, uint64_t *value, int size, int big)
+{
+    uint8_t bytes[8];
+    if (reader_bytes(reader, bytes, size)) {
+        return 1;
+    }
+
+    *value = 0;
+    for (int i = 0; i < size; i++) {
+        *value |= (uint64_t) bytes[big ? size - 1 - i : i] << (i * 8);
+    }
+
+    return 0;
+}
+
+static int
+reader_bps_number(reader_t *reader, uint64_t *value)
+{
+    *value = 0;
+    for (uint64_t shift = 1;; shift <<= 7) {
+        uint8_t byte;
+        if (reader_bytes(reader, &byte, 1) || shift >> 56 != 0) {
+            return 1;
+        }
+
+        *value += (byte & 0x7f) * shift;
+        if (byte & 0x80) {
+            return 0;
+        }
+
+        *value += shift << 7;
+    }
+}
+
+static int
+patch_pwrite(int f, const uint8_t *data, uint64_t size, uint64_t offset)
+{
+    while (size > 0) {
+        ssize_t written = pwrite(f, data, size, offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return 1;
+        }
+
+        data += written;
+        size -= written;
+        offset += written;
+    }
+
+    return 0;
+}
+
+// Copies a range of the file patched to the result, within the kernel if the
+// file system can.
+//
+static int
+reader_copy(reader_t *reader, uint64_t source, uint64_t size, uint64_t destination)
+{
+    loff_t in = source, out = destination;
+    while (size > 0) {
+        ssize_t copied = copy_file_range(reader->source, &in, reader->target, &out, size, 0);
+        if (copied <= 0) {
+            if (copied < 0 && errno == EINTR) {
+                continue;
+            }
+
+            return patch_pwrite(reader->target, reader->data + in, size, out);
+        }
+
+        size -= copied;
+    }
+
+    return 0;
+}
+
+// Writes a run of a byte to the result.
+//
+static int
+reader_fill(reader_t *reader, uint8_t byte, uint64_t size, uint64_t destination)
+{
+    memset(reader->chunk, byte, MIN(size, PATCH_CHUNK_SIZE));
+    for (uint64_t done = 0; done < size;) {
+        uint64_t chunk = MIN(PATCH_CHUNK_SIZE, size - done);
+        if (patch_pwrite(reader->target, reader->chunk, chunk, destination + done)) {
+            return 1;
+        }
+
+        done += chunk;
+    }
+
+    return 0;
+}
+
+// Copies bytes of the patch to the result. Returns 2 if the patch ends first.
+//
+static int
+reader_copy_bytes(reader_t *reader, uint64_t size, uint64_t destination)
+{
+    for (uint64_t done = 0; done < size;) {
+        uint64_t chunk = MIN(PATCH_CHUNK_SIZE, size - done);
+        if (reader_bytes(reader, reader->chunk, chunk)) {
+            return 2;
+        }
+
+        if (patch_pwrite(reader->target, reader->chunk, chunk, destination + done)) {
+            return 1;
+        }
+
+        done += chunk;
+    }
+
+    return 0;
+}
+
+static int
+apply_ips(reader_t *reader)
+{
+    if (reader_copy(reader, 0, reader->size, 0)) {
+        return 1;
+    }
+
+    for (;;) {
+        uint64_t offset, size;
+        if (reader_number(reader, &offset, 3, 1)) {
+            return 2;
+        }
+
+        if (offset == PATCH_IPS_EOF) {
+            // Truncation is an extension, after the end.
+            //
+            if (reader_number(reader, &size, 3, 1) == 0 && ftruncate(reader->target, size) != 0) {
+                return 1;
+            }
+
+            return 0;
+        }
+
+        if (reader_number(reader, &size, 2, 1)) {
+            return 2;
+        }
+
+        int status;
+        if (size == 0) {
+            uint64_t byte;
+            if (reader_number(reader, &size, 2, 1) || reader_number(reader, &byte, 1, 0)) {
+                return 2;
+            }
+
+            status = reader_fill(reader, byte, size, offset);
+        } else {
+            status = reader_copy_bytes(reader, size, offset);
+        }
+
+        if (status) {
+            return status;
+        }
+    }
+}
+
+static int
+apply_native(reader_t *reader)
+{
+    uint64_t source_size, target_size;
+    if (reader_number(reader, &source_size, 8, 0) || reader_number(reader, &target_size, 8, 0)
+            || source_size != reader->size) {
+        return 2;
+    }
+
+    // The bytes between records are those of the file at the same offset.
+    //
+    uint64_t end = 0;
+    for (;;) {
+        uint64_t type, offset = target_size, size = 0;
+        if (reader_number(reader, &type, 1, 0)) {
+            return 2;
+        }
+
+        if (type != NATIVE_END && (reader_number(reader, &offset, 8, 0) || reader_number(reader, &size, 8, 0))) {
+            return 2;
+        }
+
+        if (offset < end || offset > target_size || size > target_size - offset) {
+            return 2;
+        }
+
+        if (offset > end) {
+            if (offset > reader->size) {
+                return 2;
+            }
+
+            if (reader_copy(reader, end, offset - end, end)) {
+                return 1;
+            }
+        }
+
+        int status = 0;
+        switch (type) {
+        case NATIVE_END:
+            return ftruncate(reader->target, target_size) != 0;
+        case NATIVE_BYTES:
+            status = reader_copy_bytes(reader, size, offset);
+            break;
+        case NATIVE_RUN: {
+            uint64_t byte;
+            status = reader_number(reader, &byte, 1, 0) ? 2 : reader_fill(reader, byte, size, offset);
+        } break;
+        case NATIVE_COPY: {
+            uint64_t source;
+            if (reader_number(reader, &source, 8, 0) || source > reader->size || size > reader->size - source) {
+                return 2;
+            }
+
+            status = reader_copy(reader, source, size, offset);
+        } break;
+        default:
+            return 2;
+        }
+
+        if (status) {
+            return status;
+        }
+
+        end = offset + size;
+    }
+}
+
+static int
+reader_flush(reader_t *reader)
+{
+    if (patch_pwrite(reader->target, reader->output, reader->output_size, reader->written)) {
+        return 1;
+    }
+
+    reader->written += reader->output_size;
+    reader->output_size = 0;
+    return 0;
+}
+
+// Appends bytes to the result of a BPS patch, which is written in order.
+//
+static int
+reader_output(reader_t *reader, const uint8_t *data, uint64_t size)
+{
+    reader->output_crc = buffer_crc32_data(reader->output_crc, data, size);
+
+    while (size > 0) {
+        size_t chunk = MIN(size, PATCH_CHUNK_SIZE - reader->output_size);
+        memcpy(reader->output + reader->output_size, data, chunk);
+        reader->output_size += chunk;
+        data += chunk;
+        size -= chunk;
+
+        if (reader->output_size == PATCH_CHUNK_SIZE && reader_flush(reader)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Reads a copy relative to the end of the previous one. Returns 1 if it is
+// out of [0, limit).
+//
+static int
+reader_bps_relative(reader_t *reader, uint64_t *relative, uint64_t limit)
+{
+    uint64_t distance;
+    if (reader_bps_number(reader, &distance)) {
+        return 1;
+    }
+
+    uint64_t offset = *relative + (distance & 1 ? -(distance >> 1) : distance >> 1);
+    if (offset >= limit) {
+        return 1;
+    }
+
+    *relative = offset;
+    return 0;
+}
+
+static int
+apply_bps(reader_t *reader, uint64_t patch_size)
+{
+    uint64_t source_size, target_size, metadata_size;
+    if (reader_bps_number(reader, &source_size) || reader_bps_number(reader, &target_size)
+            || reader_bps_number(reader, &metadata_size) || source_size != reader->size) {
+        return 2;
+    }
+
+    for (uint64_t i = 0; i < metadata_size; i++) {
+        uint8_t byte;
+        if (reader_bytes(reader, &byte, 1)) {
+            return 2;
+        }
+    }
+
+    // The actions are followed by three CRC-32s.
+    //
+    uint64_t output = 0, source_relative = 0, target_relative = 0;
+    while (reader->offset + 12 < patch_size) {
+        uint64_t action;
+        if (reader_bps_number(reader, &action)) {
+            return 2;
+        }
+
+        uint64_t size = (action >> 2) + 1;
+        if (size > target_size - output) {
+            return 2;
+        }
+
+        switch (action & 3) {
+        case BPS_SOURCE_READ:
+            if (output + size > reader->size) {
+                return 2;
+            }
+
+            if (reader_output(reader, reader->data + output, size)) {
+                return 1;
+            }
+            break;
+        case BPS_TARGET_READ:
+            for (uint64_t done = 0; done < size;) {
+                uint64_t chunk = MIN(PATCH_CHUNK_SIZE, size - done);
+                if (reader_bytes(reader, reader->chunk, chunk)) {
+                    return 2;
+                }
+
+                if (reader_output(reader, reader->chunk, chunk)) {
+                    return 1;
+                }
+
+                done += chunk;
+            }
+            break;
+        case BPS_SOURCE_COPY:
+            if (reader_bps_relative(reader, &source_relative, reader->size)
+                    || size > reader->size - source_relative) {
+                return 2;
+            }
+
+            if (reader_output(reader, reader->data + source_relative, size)) {
+                return 1;
+            }
+
+            source_relative += size;
+            break;
+        case BPS_TARGET_COPY:
+            if (reader_bps_relative(reader, &target_relative, output)) {
+                return 2;
+            }
+
+            // The copy may overlap the bytes it writes, so each chunk is at
+            // most as far back as the copy.
+            //
+            for (uint64_t done = 0; done < size;) {
+                uint64_t chunk = MIN(MIN(PATCH_CHUNK_SIZE, size - done), output + done - target_relative);
+                if (reader_flush(reader) || pread(reader->target, reader->chunk, chunk, target_relative) != chunk
+                        || reader_output(reader, reader->chunk, chunk)) {
+                    return 1;
+                }
+
+                target_relative += chunk;
+                done += chunk;
+            }
+            break;
+        }
+
+        output += size;
+    }
+
+    if (output != target_size) {
+        return 2;
+    }
+
+    if (reader_flush(reader)) {
+        return 1;
+    }
+
+    uint64_t source_crc, target_crc, patch_crc;
+    if (reader_number(reader, &source_crc, 4, 0) || reader_number(reader, &target_crc, 4, 0)) {
+        return 2;
+    }
+
+    uint32_t crc = reader->crc;
+    if (reader_number(reader, &patch_crc, 4, 0)) {
+        return 2;
+    }
+
+    if (patch_crc != crc || target_crc != reader->output_crc
+            || source_crc != buffer_crc32_data(0, reader->data, reader->size)) {
+        return 3;
+    }
+
+    return 0;
+}
+
+int
+patch_apply(const char *path, const char *source, const char *target)
+{
+    reader_t reader = {
+        .file = fopen(path, "rb"),
+        .source = open(source, O_RDONLY),
+        .target = -1,
+    };
+
+    char *temporary = g_strdup_printf("%s.XXXXXX", target);
+    int status = 1;
+
+    struct stat patch, file;
+    if (reader.file == NULL || reader.source < 0 || fstat(fileno(reader.file), &patch) != 0
+            || fstat(reader.source, &file) != 0) {
+        goto done;
+    }
+
+    reader.size = file.st_size;
+    if (reader.size > 0) {
+        reader.data = mmap(NULL, reader.size, PROT_READ, MAP_PRIVATE, reader.source, 0);
+        if (reader.data == MAP_FAILED) {
+            reader.data = NULL;
+            goto done;
+        }
+    }
+
+    // The result is written next to target and renamed over it once
+    // complete.
+    //
+    reader.target = mkstemp(temporary);
+    if (reader.target < 0 || fchmod(reader.target, file.st_mode & 07777) != 0) {
+        goto done;
+    }
+
+    reader.output = g_malloc(PATCH_CHUNK_SIZE);
+    reader.chunk = g_malloc(PATCH_CHUNK_SIZE);
+
+    char magic[5] = {};
+    if (reader_bytes(&reader, magic, 4)) {
+        status = 2;
+    } else if (memcmp(magic, BPS_MAGIC, 4) == 0) {
+        status = apply_bps(&reader, patch.st_size);
+    } else if (memcmp(magic, NATIVE_MAGIC, 4) == 0) {
+        status = apply_native(&reader);
+    } else if (memcmp(magic, IPS_MAGIC, 4) == 0 && reader_bytes(&reader, magic + 4, 1) == 0
+            && memcmp(magic, IPS_MAGIC, 5) == 0) {
+        status = apply_ips(&reader);
+    } else {
+        status = 2;
+    }
+
+    if (status == 0 && (fdatasync(reader.target) != 0 || rename(temporary, target) != 0)) {
+        status = 1;
+    }
+
+done:
+    if (reader.target >= 0) {
+        close(reader.target);
+        if (status != 0) {
+            unlink(temporary);
+        }
+    }
+
+    if (reader.data != NULL) {
+        munmap((void*) reader.data, reader.size);
+    }
+
+    if (reader.source >= 0) {
+        close(reader.source);
+    }
+
+    if (reader.file != NULL) {
+        fclose(reader.file);
+    }
+
+    g_free(reader.output);
+    g_free(reader.chunk);
+    g_free(temporary);
+    return status;
+}
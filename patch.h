@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "buffer.h"
+
+typedef enum {
+    // Records of the bytes changed at 24-bit offsets, for files of up to 16
+    // MiB.
+    //
+    PATCH_IPS,
+    // Copies from the file and bytes added, with the CRC-32s of the file, the
+    // result and the patch.
+    //
+    PATCH_BPS,
+    // Records of bytes, runs and copies from the file at 64-bit offsets. The
+    // bytes no record covers are those of the file at the same offset.
+    //
+    PATCH_NATIVE,
+} patch_format_t;
+
+// Writes the changes of a buffer to its file as a patch at path. Returns 1 if
+// the patch could not be written, and 2 if the format cannot express them.
+//
+int patch_export(buffer_t *buffer, patch_format_t format, const char *path);
+// Applies the patch at path, of any format, to the file at source, and writes
+// the result to target, replacing it once complete. Target may be source. The
+// files are streamed rather than loaded. Returns 1 if a file could not be read
+// or written, 2 if the patch is invalid or is not for source, and 3 if a
+// checksum does not match.
+//
+int patch_apply(const char *path, const char *source, const char *target);
@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "buffer.h"
+#include "patch.h"
+
+int
+main(int argc, char *argv[])
+{
+    // A patch of the changes, in each format, applied to the file gives the
+    // bytes of the buffer.
+    //
+    {
+        size_t size = 5 * 1024 * 1024;
+        uint8_t *data = g_malloc(size);
+        for (size_t i = 0; i < size; i++) {
+            data[i] = i * 13 + (i >> 10);
+        }
+
+        char path[] = "/tmp/patch_test.XXXXXX";
+        int file = mkstemp(path);
+        assert(file >= 0);
+        assert(write(file, data, size) == size);
+        close(file);
+
+        buffer_t patched;
+        assert(buffer_open(&patched, path) == 0);
+
+        uint8_t run[100];
+        memset(run, 0x5a, sizeof(run));
+        memcpy(run + 40, "hexxed", 6);
+        const uint8_t eof[] = { 1, 2, 3 };
+        assert(buffer_write(&patched, 1000, run, sizeof(run)) == 0);
+        assert(buffer_write(&patched, 0x454f46, eof, sizeof(eof)) == 0);
+        assert(buffer_delete(&patched, 4 * 1024 * 1024, 4096) == 0);
+        assert(buffer_copy(&patched, 2048, 300) == 0);
+        assert(buffer_paste(&patched, 100 * 1024, 1) == 0);
+        assert(buffer_insert(&patched, patched.size, run, sizeof(run)) == 0);
+
+        uint8_t *expected = g_malloc(patched.size);
+        assert(buffer_read_at(&patched, 0, expected, patched.size) == 0);
+
+        char patch_path[] = "/tmp/patch_test.XXXXXX";
+        char output_path[] = "/tmp/patch_test.XXXXXX";
+        close(mkstemp(patch_path));
+        close(mkstemp(output_path));
+
+        uint8_t *contents = g_malloc(patched.size + 1);
+        patch_format_t formats[] = { PATCH_IPS, PATCH_BPS, PATCH_NATIVE };
+        for (int i = 0; i < 3; i++) {
+            assert(patch_export(&patched, formats[i], patch_path) == 0);
+            assert(patch_apply(patch_path, path, output_path) == 0);
+
+            file = open(output_path, O_RDONLY);
+            assert(read(file, contents, patched.size + 1) == patched.size);
+            assert(memcmp(contents, expected, patched.size) == 0);
+            close(file);
+        }
+
+        // The result of a BPS patch is checked.
+        //
+        assert(patch_export(&patched, PATCH_BPS, patch_path) == 0);
+        file = open(patch_path, O_RDWR);
+        off_t end = lseek(file, 0, SEEK_END);
+        uint8_t byte;
+        assert(pread(file, &byte, 1, end - 8) == 1);
+        byte ^= 1;
+        assert(pwrite(file, &byte, 1, end - 8) == 1);
+        close(file);
+        assert(patch_apply(patch_path, path, output_path) == 3);
+        assert(patch_apply(path, path, output_path) == 2);
+
+        // IPS only reaches 16 MiB.
+        //
+        assert(buffer_insert(&patched, 0, run, 16) == 0);
+        assert(patch_export(&patched, PATCH_IPS, patch_path) == 0);
+        for (int i = 0; i < 3; i++) {
+            assert(buffer_insert(&patched, patched.size, data, size) == 0);
+        }
+
+        assert(patch_export(&patched, PATCH_IPS, patch_path) == 2);
+        buffer_close(&patched);
+
+        unlink(output_path);
+        unlink(patch_path);
+        unlink(path);
+        g_free(contents);
+        g_free(expected);
+        g_free(data);
+    }
+
+    return 0;
+}
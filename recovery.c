@@ -0,0 +1,383 @@
+#include "recovery.h"
+#include "buffer.h"
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// The log starts with the magic, then the device, inode, size and modification
+// time in seconds and nanoseconds of the file, as 64-bit little-endian numbers.
+//
+static const uint8_t RECOVERY_MAGIC[4] = { 'H', 'X', 'R', '1' };
+#define RECOVERY_HEADER_SIZE (4 + 5 * 8)
+
+// Each record is its size, then the address and size of the range replaced and
+// the number of pieces, each a type and a size followed by the source of the
+// bytes of the file, or the bytes added, and last the CRC-32 of all but its
+// size.
+//
+#define RECORD_FILE 0
+#define RECORD_BYTES 1
+
+static void
+put_u64(uint8_t *data, uint64_t value)
+{
+    for (int i = 0; i < 8; i++) {
+        data[i] = value >> (i * 8);
+    }
+}
+
+static uint64_t
+get_u64(const uint8_t *data)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        value |= (uint64_t) data[i] << (i * 8);
+    }
+
+    return value;
+}
+
+static void
+append_u64(GByteArray *array, uint64_t value)
+{
+    uint8_t bytes[8];
+    put_u64(bytes, value);
+    g_byte_array_append(array, bytes, sizeof(bytes));
+}
+
+// Sets status to that of the file of buffer, and returns the path of its log,
+// which must be freed with g_free, or NULL if the buffer has no file.
+//
+static char*
+recovery_path(buffer_t *buffer, struct stat *status)
+{
+    if (buffer->path == NULL || fstat(buffer->f, status) < 0) {
+        return NULL;
+    }
+
+    char name[40];
+    snprintf(name, sizeof(name), "%" PRIx64 "-%" PRIx64, (uint64_t) status->st_dev, (uint64_t) status->st_ino);
+    return g_build_filename(g_get_user_data_dir(), "hexxed", "recovery", name, NULL);
+}
+
+static void
+recovery_header(const struct stat *status, uint8_t header[RECOVERY_HEADER_SIZE])
+{
+    memcpy(header, RECOVERY_MAGIC, sizeof(RECOVERY_MAGIC));
+    put_u64(header + 4, status->st_dev);
+    put_u64(header + 12, status->st_ino);
+    put_u64(header + 20, status->st_size);
+    put_u64(header + 28, status->st_mtim.tv_sec);
+    put_u64(header + 36, status->st_mtim.tv_nsec);
+}
+
+int
+recovery_pending(buffer_t *buffer)
+{
+    struct stat status;
+    char *path = recovery_path(buffer, &status);
+    if (path == NULL) {
+        return 0;
+    }
+
+    uint8_t expected[RECOVERY_HEADER_SIZE], header[RECOVERY_HEADER_SIZE + 1];
+    recovery_header(&status, expected);
+
+    // A log with no record has nothing to recover.
+    //
+    int pending = 0;
+    int f = open(path, O_RDONLY);
+    if (f >= 0) {
+        pending = read(f, header, sizeof(header)) == sizeof(header)
+            && memcmp(header, expected, sizeof(expected)) == 0;
+        close(f);
+    }
+
+    g_free(path);
+    return pending;
+}
+
+// Parses the body of a record into the range replaced and its pieces, whose
+// added bytes point into the body. Returns 1 if it is invalid.
+//
+static int
+recovery_parse(const uint8_t *body, uint64_t size, uint64_t *address, uint64_t *replaced, GArray *pieces)
+{
+    if (size < 24) {
+        return 1;
+    }
+
+    *address = get_u64(body);
+    *replaced = get_u64(body + 8);
+    uint64_t count = get_u64(body + 16);
+
+    g_array_set_size(pieces, 0);
+    uint64_t offset = 24;
+    for (uint64_t i = 0; i < count; i++) {
+        if (size - offset < 9) {
+            return 1;
+        }
+
+        uint8_t type = body[offset];
+        piece_t piece = {
+            .size = get_u64(body + offset + 1),
+        };
+        offset += 9;
+
+        if (type == RECORD_FILE) {
+            if (size - offset < 8) {
+                return 1;
+            }
+
+            piece.source = get_u64(body + offset);
+            offset += 8;
+        } else if (type == RECORD_BYTES) {
+            if (size - offset < piece.size) {
+                return 1;
+            }
+
+            piece.data = body + offset;
+            offset += piece.size;
+        } else {
+            return 1;
+        }
+
+        g_array_append_val(pieces, piece);
+    }
+
+    return offset != size;
+}
+
+int
+recovery_replay(buffer_t *buffer)
+{
+    struct stat status;
+    char *path = recovery_path(buffer, &status);
+    if (path == NULL) {
+        return -1;
+    }
+
+    char *contents;
+    gsize size;
+    if (!g_file_get_contents(path, &contents, &size, NULL)) {
+        g_free(path);
+        return -1;
+    }
+
+    uint8_t header[RECOVERY_HEADER_SIZE];
+    recovery_header(&status, header);
+
+    int replayed = -1;
+    if (size >= sizeof(header) && memcmp(contents, header, sizeof(header)) == 0) {
+        const uint8_t *data = (const uint8_t*) contents;
+        GArray *pieces = g_array_new(FALSE, FALSE, sizeof(piece_t));
+
+        replayed = 0;
+        for (uint64_t offset = sizeof(header); size - offset >= 8 + 4;) {
+            uint64_t length = get_u64(data + offset);
+            if (length > size - offset - 8 - 4) {
+                break;
+            }
+
+            const uint8_t *body = data + offset + 8;
+            uint32_t crc = body[length] | body[length + 1] << 8 | body[length + 2] << 16
+                | (uint32_t) body[length + 3] << 24;
+
+            uint64_t address, replaced;
+            if (crc != buffer_crc32_data(0, body, length)
+                    || recovery_parse(body, length, &address, &replaced, pieces)
+                    || buffer_apply(buffer, address, replaced, (const piece_t*) pieces->data, pieces->len)) {
+                break;
+            }
+
+            replayed++;
+            offset += 8 + length + 4;
+        }
+
+        g_array_free(pieces, TRUE);
+    }
+
+    g_free(contents);
+    g_free(path);
+    return replayed;
+}
+
+// Queues a record of a change to the pieces. Called on the UI thread, which
+// only waits for the background thread to take the queue.
+//
+static void
+recovery_record(void *user_data, uint64_t address, uint64_t size, const piece_t *pieces, guint pieces_size)
+{
+    recovery_t *recovery = (recovery_t*) user_data;
+    if (g_atomic_int_get(&recovery->error)) {
+        return;
+    }
+
+    g_mutex_lock(&recovery->lock);
+
+    GByteArray *queue = recovery->queue;
+    guint start = queue->len;
+    append_u64(queue, 0);
+    append_u64(queue, address);
+    append_u64(queue, size);
+    append_u64(queue, pieces_size);
+
+    for (guint i = 0; i < pieces_size; i++) {
+        const piece_t *piece = &pieces[i];
+        uint8_t type = piece->data != NULL ? RECORD_BYTES : RECORD_FILE;
+        g_byte_array_append(queue, &type, 1);
+        append_u64(queue, piece->size);
+
+        if (piece->data != NULL) {
+            g_byte_array_append(queue, piece->data, piece->size);
+        } else {
+            append_u64(queue, piece->source);
+        }
+    }
+
+    uint64_t length = queue->len - start - 8;
+    put_u64(queue->data + start, length);
+
+    uint32_t crc = buffer_crc32_data(0, queue->data + start + 8, length);
+    uint8_t bytes[4] = { crc, crc >> 8, crc >> 16, crc >> 24 };
+    g_byte_array_append(queue, bytes, sizeof(bytes));
+
+    g_cond_signal(&recovery->wake);
+    g_mutex_unlock(&recovery->lock);
+}
+
+static int
+recovery_write(int f, const uint8_t *data, size_t size)
+{
+    while (size > 0) {
+        ssize_t written = write(f, data, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return 1;
+        }
+
+        data += written;
+        size -= written;
+    }
+
+    return 0;
+}
+
+static gpointer
+recovery_worker(gpointer user_data)
+{
+    recovery_t *recovery = (recovery_t*) user_data;
+    GByteArray *batch = g_byte_array_new();
+
+    g_mutex_lock(&recovery->lock);
+    for (;;) {
+        while (recovery->queue->len == 0 && !recovery->stop) {
+            g_cond_wait(&recovery->wake, &recovery->lock);
+        }
+
+        // Wait for further changes, to write and sync them all at once.
+        //
+        gint64 deadline = g_get_monotonic_time() + (gint64) recovery->interval * G_TIME_SPAN_MILLISECOND;
+        while (!recovery->stop && g_cond_wait_until(&recovery->wake, &recovery->lock, deadline));
+
+        if (recovery->queue->len == 0) {
+            break;
+        }
+
+        GByteArray *queue = recovery->queue;
+        recovery->queue = batch;
+        batch = queue;
+        g_mutex_unlock(&recovery->lock);
+
+        if (!g_atomic_int_get(&recovery->error)
+                && (recovery_write(recovery->f, batch->data, batch->len) || fdatasync(recovery->f) < 0)) {
+            g_atomic_int_set(&recovery->error, 1);
+        }
+
+        g_byte_array_set_size(batch, 0);
+        g_mutex_lock(&recovery->lock);
+    }
+    g_mutex_unlock(&recovery->lock);
+
+    g_byte_array_unref(batch);
+    return NULL;
+}
+
+recovery_t*
+recovery_start(buffer_t *buffer, int interval)
+{
+    struct stat status;
+    char *path = recovery_path(buffer, &status);
+    if (path == NULL) {
+        return NULL;
+    }
+
+    char *directory = g_path_get_dirname(path);
+    int f = g_mkdir_with_parents(directory, 0700) == 0 ? open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600) : -1;
+    g_free(directory);
+
+    if (f < 0) {
+        g_free(path);
+        return NULL;
+    }
+
+    recovery_t *recovery = g_malloc0(sizeof(recovery_t));
+    recovery->buffer = buffer;
+    recovery->f = f;
+    recovery->path = path;
+    recovery->interval = interval;
+    recovery->queue = g_byte_array_new();
+    g_mutex_init(&recovery->lock);
+    g_cond_init(&recovery->wake);
+
+    // The header is written with the first batch.
+    //
+    uint8_t header[RECOVERY_HEADER_SIZE];
+    recovery_header(&status, header);
+    g_byte_array_append(recovery->queue, header, sizeof(header));
+
+    // A buffer already changed, as by replaying a log, is recorded as a
+    // change of the whole file to its pieces.
+    //
+    if (buffer->modified) {
+        recovery_record(recovery, 0, buffer->data_size, (const piece_t*) buffer->pieces->data, buffer->pieces->len);
+    }
+
+    recovery->thread = g_thread_new("recovery", recovery_worker, recovery);
+    buffer->recorder = recovery_record;
+    buffer->recorder_data = recovery;
+    return recovery;
+}
+
+void
+recovery_stop(recovery_t *recovery, int remove)
+{
+    recovery->buffer->recorder = NULL;
+    recovery->buffer->recorder_data = NULL;
+
+    g_mutex_lock(&recovery->lock);
+    recovery->stop = 1;
+    g_cond_signal(&recovery->wake);
+    g_mutex_unlock(&recovery->lock);
+    g_thread_join(recovery->thread);
+
+    close(recovery->f);
+    if (remove) {
+        unlink(recovery->path);
+    }
+
+    g_byte_array_unref(recovery->queue);
+    g_mutex_clear(&recovery->lock);
+    g_cond_clear(&recovery->wake);
+    g_free(recovery->path);
+    g_free(recovery);
+}
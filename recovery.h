@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+#include <gmodule.h>
+
+#include "buffer.h"
+
+// How long changes wait to be written to the recovery log by default, so that
+// bursts of edits are written and synced together.
+//
+#define RECOVERY_INTERVAL_MS 2000
+
+// A log of the changes made to a buffer since it was opened or saved, from
+// which they are recovered if the editor is killed before saving. Changes are
+// queued by the UI thread, and appended to the log by a background thread that
+// writes and syncs them in batches, so editing never waits for the disk.
+//
+// The log is named after the device and inode of the file, and starts with the
+// size and modification time of the file, so that it is only replayed over the
+// file it was recorded for. Each change is a record of the range replaced and
+// the pieces replacing it, with the bytes they add, followed by its CRC-32; a
+// record cut short by the editor being killed is ignored.
+//
+typedef struct {
+    buffer_t *buffer;
+    int f;
+    char *path;
+    GThread *thread;
+    // Guards the queue and stop, signalled when either changes. Held by the
+    // background thread only while taking the queue, never while writing.
+    //
+    GMutex lock;
+    GCond wake;
+    // Records queued and not written yet.
+    //
+    GByteArray *queue;
+    int stop;
+    // Time to wait after a change for more, in milliseconds.
+    //
+    int interval;
+    // If != 0, writing the log failed and it is no longer written. Accessed
+    // atomically.
+    //
+    gint error;
+} recovery_t;
+
+// Returns 1 if a log of changes recorded for the file of buffer, as it is now,
+// is left to recover, or 0 otherwise.
+//
+int recovery_pending(buffer_t *buffer);
+// Replays the changes of the log left for the file of buffer as edits, up to
+// the first invalid or incomplete record. The buffer MUST be editable. Returns
+// the number of changes replayed, or -1 if the log could not be read.
+//
+int recovery_replay(buffer_t *buffer);
+// Starts a log for a buffer opened from a file, replacing any left, and records
+// the changes made until stopped. If the buffer already differs from its file,
+// its pieces are recorded first. Returns NULL if the buffer has no file, or the
+// log could not be created. The buffer MUST outlive the recovery.
+//
+recovery_t *recovery_start(buffer_t *buffer, int interval);
+// Writes the changes queued, stops recording, and removes the log if remove !=
+// 0, as once the buffer is saved.
+//
+void recovery_stop(recovery_t *recovery, int remove);
@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "buffer.h"
+#include "recovery.h"
+
+int
+main(int argc, char *argv[])
+{
+    // The changes recorded before the editor is killed are replayed over the
+    // same file, up to a record cut short.
+    //
+    {
+        char directory[] = "/tmp/recovery_test.XXXXXX";
+        assert(mkdtemp(directory) != NULL);
+        setenv("XDG_DATA_HOME", directory, 1);
+
+        uint8_t data[4096];
+        for (int i = 0; i < sizeof(data); i++) {
+            data[i] = i * 13;
+        }
+
+        char path[] = "/tmp/recovery_test.XXXXXX";
+        int file = mkstemp(path);
+        assert(file >= 0);
+        assert(write(file, data, sizeof(data)) == sizeof(data));
+        close(file);
+
+        buffer_t recorded;
+        assert(buffer_open(&recorded, path) == 0);
+        assert(recovery_pending(&recorded) == 0);
+        assert(buffer_try_reopen(&recorded) == 0);
+
+        recovery_t *recovery = recovery_start(&recorded, 10);
+        assert(recovery != NULL);
+
+        assert(buffer_write(&recorded, 10, "hexxed", 6) == 0);
+        assert(buffer_insert(&recorded, 100, "inserted", 8) == 0);
+        assert(buffer_delete(&recorded, 2000, 500) == 0);
+        assert(buffer_copy(&recorded, 3000, 300) == 0);
+        assert(buffer_paste(&recorded, 0, 1) == 0);
+        assert(buffer_write(&recorded, 1, "x", 1) == 0);
+
+        uint64_t address;
+        assert(buffer_undo(&recorded, &address) == 0);
+
+        uint8_t expected[sizeof(data) + 300];
+        uint64_t expected_size = recorded.size;
+        assert(buffer_read_at(&recorded, 0, expected, expected_size) == 0);
+
+        recovery_stop(recovery, 0);
+        buffer_close(&recorded);
+
+        uint8_t actual[sizeof(expected)];
+        assert(buffer_open(&recorded, path) == 0);
+        assert(recovery_pending(&recorded) == 1);
+        assert(buffer_try_reopen(&recorded) == 0);
+        assert(recovery_replay(&recorded) == 6);
+        assert(recorded.size == expected_size);
+        assert(buffer_read_at(&recorded, 0, actual, expected_size) == 0);
+        assert(memcmp(actual, expected, expected_size) == 0);
+
+        // Starting again records the buffer replayed as one change.
+        //
+        recovery = recovery_start(&recorded, 10);
+        assert(recovery != NULL);
+        recovery_stop(recovery, 0);
+        buffer_close(&recorded);
+
+        assert(buffer_open(&recorded, path) == 0);
+        assert(buffer_try_reopen(&recorded) == 0);
+        assert(recovery_replay(&recorded) == 1);
+        assert(buffer_read_at(&recorded, 0, actual, expected_size) == 0);
+        assert(memcmp(actual, expected, expected_size) == 0);
+
+        // A record cut short is left out.
+        //
+        recovery = recovery_start(&recorded, 10);
+        assert(buffer_write(&recorded, 0, "y", 1) == 0);
+        recovery_stop(recovery, 0);
+        buffer_close(&recorded);
+
+        assert(buffer_open(&recorded, path) == 0);
+        char *log;
+        struct stat status;
+        assert(fstat(recorded.f, &status) == 0);
+        char name[40];
+        snprintf(name, sizeof(name), "%" PRIx64 "-%" PRIx64, (uint64_t) status.st_dev, (uint64_t) status.st_ino);
+        log = g_build_filename(directory, "hexxed", "recovery", name, NULL);
+        assert(stat(log, &status) == 0);
+        assert(truncate(log, status.st_size - 2) == 0);
+
+        assert(buffer_try_reopen(&recorded) == 0);
+        assert(recovery_replay(&recorded) == 1);
+        assert(buffer_read_at(&recorded, 0, actual, expected_size) == 0);
+        assert(memcmp(actual, expected, expected_size) == 0);
+
+        // The log is removed once saved, and not replayed over another file.
+        //
+        recovery = recovery_start(&recorded, 10);
+        recovery_stop(recovery, 1);
+        assert(recovery_pending(&recorded) == 0);
+        assert(access(log, F_OK) != 0);
+
+        recovery = recovery_start(&recorded, 10);
+        recovery_stop(recovery, 0);
+        assert(recovery_pending(&recorded) == 1);
+        assert(buffer_save(&recorded) == 0);
+        assert(recovery_pending(&recorded) == 0);
+
+        buffer_close(&recorded);
+        unlink(path);
+        char *parent = g_path_get_dirname(log);
+        rmdir(parent);
+        g_free(parent);
+        g_free(log);
+
+        log = g_build_filename(directory, "hexxed", NULL);
+        rmdir(log);
+        g_free(log);
+        rmdir(directory);
+    }
+
+    return 0;
+}
@@ -5,7 +5,7 @@
 #include <stdlib.h>
 #include <inttypes.h>
 
-int calculator_eval(buffer_t *buffer, const char *input, int64_t *result);
+#include "calc.h"
 
 static inline int
 input_is_esc(int input)
@@ -24,27 +24,121 @@ input_is_esc(int input)
     return 0;
 }
 
+// The last status drawn, and the width of the screen it was drawn on.
+//
+static status_t last_status;
+static int last_status_width = -1;
+
+void
+render_status_invalidate(void)
+{
+    last_status_width = -1;
+}
+
 void
-render_status(const char *path)
+render_status(const status_t *status)
 {
     int height, width;
     getmaxyx(stdscr, height, width);
     (void) height;
 
+    // The frame time is displayed in tenths of a millisecond, changes below
+    // that don't need a redraw.
+    //
+    status_t current = *status;
+    current.frame_time /= 100;
+
+    if (last_status_width == width
+            && last_status.path == current.path
+            && last_status.cursor == current.cursor
+            && last_status.selection == current.selection
+            && last_status.job == current.job
+            && last_status.job_progress == current.job_progress
+            && last_status.frame_time == current.frame_time) {
+        return;
+    }
+
+    last_status = current;
+    last_status_width = width;
+
     attrset(COLOR_PAIR(COLOR_STATUS));
     char status_bar[width + 1];
 
     memset(status_bar, ' ', width);
     status_bar[width] = '\0';
 
-    char status_message[81];
-    snprintf(status_message, sizeof(status_message), "    %-36s%40s",
-        path, "    UNK+.00000000`00000000");
-    memcpy(status_bar, status_message, sizeof(status_message) - 1 /* NUL */);
+    // Job, selection, frame time and cursor, right-aligned.
+    //
+    char right[128];
+    int length = 0;
+    if (current.job != NULL) {
+        length += snprintf(right + length, sizeof(right) - length, "%s %3d%%    ",
+                current.job, current.job_progress);
+    }
+    if (current.selection != 0) {
+        length += snprintf(right + length, sizeof(right) - length, "Sel:%" PRIx64 "    ",
+                current.selection);
+    }
+    length += snprintf(right + length, sizeof(right) - length, "%" PRId64 ".%" PRId64 "ms    ",
+            current.frame_time / 10, current.frame_time % 10);
+    length += snprintf(right + length, sizeof(right) - length, "UNK+.%08x`%08x",
+            (uint32_t) (current.cursor >> 32), (uint32_t) current.cursor);
+
+    int right_start = width - 4 - length;
+    if (right_start < 0) {
+        right_start = 0;
+    }
+    memcpy(status_bar + right_start, right, width - right_start < length ? width - right_start : length);
+
+    // The path is truncated if it would run into the right side.
+    //
+    int path_length = current.path != NULL ? strlen(current.path) : 0;
+    if (path_length > right_start - 8) {
+        path_length = right_start - 8;
+    }
+    if (path_length > 0) {
+        memcpy(status_bar + 4, current.path, path_length);
+    }
 
     mvaddstr(0, 0, status_bar);
 }
 
+// Operations shorter than a frame at 60 Hz don't show their progress.
+//
+#define PROGRESS_DELAY_US 16000
+
+static int64_t progress_start;
+
+static void
+progress_report(void *user_data, uint64_t done, uint64_t total)
+{
+    if (g_get_monotonic_time() - progress_start < PROGRESS_DELAY_US) {
+        return;
+    }
+
+    // Redraw the last status with the job, the frame time is stored in tenths
+    // of a millisecond.
+    //
+    status_t status = last_status;
+    status.frame_time *= 100;
+    status.job = (const char*) user_data;
+    status.job_progress = total > 0 ? done * 100 / total : 100;
+
+    render_status(&status);
+    refresh();
+}
+
+progress_t
+render_progress(const char *job)
+{
+    progress_start = g_get_monotonic_time();
+
+    return (progress_t) {
+        .report = progress_report,
+        .user_data = (void*) job,
+    };
+}
+
 void
 render_options(const options_t *options)
 {
@@ -98,54 +192,273 @@ render_border(WINDOW *window)
             &BOX_TOP_LEFT, &BOX_TOP_RIGHT, &BOX_BOTTOM_LEFT, &BOX_BOTTOM_RIGHT);
 }
 
+void
+render_overview(overview_t *overview, int x, int height, cursor_t cursor, int selected)
+{
+    static const cchar_t SEPARATOR = { 0, { L'│' } };
+    // By entropy, from lowest to highest.
+    //
+    static const wchar_t *SHADES[] = { L" ", L"░", L"▒", L"▓", L"█" };
+
+    uint64_t size = overview->size;
+    int rows = height - 2;
+    uint64_t cell = overview_cell_size(size, rows);
+
+    attrset(COLOR_PAIR(COLOR_STANDARD));
+    mvvline_set(1, x, &SEPARATOR, rows);
+
+    for (int i = 0; i < rows; i++) {
+        uint64_t address = i * cell;
+
+        int highlight = selected == -1 ? cursor >= address && cursor < address + cell : i == selected;
+        attrset(COLOR_PAIR(highlight ? COLOR_SELECTED : COLOR_STANDARD));
+
+        summary_t summary;
+        if (address >= size) {
+            attrset(COLOR_PAIR(COLOR_STANDARD));
+            mvaddstr(i + 1, x + 1, "  ");
+        } else if (overview_summary(overview, address, cell, &summary)) {
+            // Not summarized yet.
+            //
+            mvaddwstr(i + 1, x + 1, L"· ");
+        } else {
+            mvaddwstr(i + 1, x + 1, SHADES[summary.entropy * 5 / 256]);
+
+            // Mark blocks that are mostly zeroes or mostly text.
+            //
+            char class = ' ';
+            if (summary.zeroes >= 192) {
+                class = '0';
+            } else if (summary.printable >= 192) {
+                class = 'a';
+            }
+            mvaddch(i + 1, x + 2, class);
+        }
+    }
+
+    attrset(COLOR_PAIR(COLOR_STANDARD));
+}
+
+void
+render_message(const char *message)
+{
+    int height, width;
+    getmaxyx(stdscr, height, width);
+
+    int length = strlen(message);
+    int x = length < width ? (width - length) / 2 : 0;
+
+    clear();
+    render_status_invalidate();
+    attrset(COLOR_PAIR(COLOR_STANDARD));
+    mvaddnstr(height / 2, x, message, width);
+    refresh();
+}
+
+void
+render_paste_mode(int enable)
+{
+    if (enable) {
+        define_key("\x1b[200~", KEY_PASTE);
+        define_key("\x1b[201~", KEY_PASTE_END);
+    }
+
+    putp(enable ? "\x1b[?2004h" : "\x1b[?2004l");
+    fflush(stdout);
+}
+
+char*
+input_paste(size_t *size)
+{
+    // Keys are dropped, the text of a paste has none.
+    //
+    GString *text = g_string_new(NULL);
+    int input;
+    while ((input = getch()) != ERR && input != KEY_PASTE_END) {
+        if (input <= 0xff) {
+            g_string_append_c(text, input);
+        }
+    }
+
+    *size = text->len;
+    return g_string_free(text, FALSE);
+}
+
+// Formats a 128-bit integer in decimal, which printf has no conversion for.
+//
+static void
+format_u128(char *output, unsigned __int128 value)
+{
+    char digits[40];
+    int size = 0;
+    do {
+        digits[size++] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+
+    for (int i = 0; i < size; i++) {
+        output[i] = digits[size - 1 - i];
+    }
+
+    output[size] = '\0';
+}
+
+// Formats a double with the fewest digits that read back as the same value.
+//
+static void
+format_f64(char *output, size_t size, double value)
+{
+    for (int precision = 1; precision <= 17; precision++) {
+        snprintf(output, size, "Flt:%.*g", precision, value);
+        if (strtod(output + 4, NULL) == value) {
+            break;
+        }
+    }
+}
+
+// Evaluates the input field into the result fields, or zeroes them if the
+// expression is invalid. Sig, Uns and Flt show the value as each type, Bin and
+// Hex show its bits: those of a double, or the low 64 bits of a 128-bit
+// integer in Bin.
+//
+static void
+calculator_update(lexer_t *lexer, buffer_t *buffer, FORM *form, FIELD **fields)
+{
+    // Sychronize the field so we can get the buffer data.
+    //
+    form_driver(form, REQ_VALIDATION);
+
+    char *expression = field_buffer(fields[0], 0);
+
+    program_t program;
+    value_t result;
+    progress_t progress = render_progress("Calculator");
+    if (calculator_lex(lexer, expression) || calculator_parse(lexer, buffer, &program)
+            || calculator_run_value(&program, buffer, buffer->cursor, &progress, &result)) {
+        set_field_buffer(fields[1], 0, "Sig:0");
+        set_field_buffer(fields[2], 0, "Uns:0");
+        set_field_buffer(fields[3], 0, "Bin:0000000000000000000000000000000000000000000000000000000000000000");
+        set_field_buffer(fields[4], 0, "Hex:00000000`00000000");
+        set_field_buffer(fields[5], 0, "Flt:0");
+    } else {
+        // The value as an integer, and its bits.
+        //
+        __int128 integer;
+        unsigned __int128 bits;
+        double real;
+        switch (result.type) {
+        case TYPE_I128:
+            integer = result.i128;
+            bits = result.i128;
+            real = (double) result.i128;
+            break;
+        case TYPE_F64: {
+            uint64_t f64_bits;
+            memcpy(&f64_bits, &result.f64, sizeof(f64_bits));
+            integer = calculator_integer(&result);
+            bits = f64_bits;
+            real = result.f64;
+        } break;
+        default:
+            integer = result.i64;
+            bits = (uint64_t) result.i64;
+            real = (double) result.i64;
+            break;
+        }
+
+        char sig_message[69] = "Sig:-";
+        format_u128(sig_message + 4 + (integer < 0), integer < 0 ? -(unsigned __int128) integer : integer);
+        set_field_buffer(fields[1], 0, sig_message);
+
+        // 64-bit integers and doubles are shown unsigned in 64 bits.
+        //
+        char uns_message[69] = "Uns:";
+        format_u128(uns_message + 4, result.type == TYPE_I128 ? (unsigned __int128) integer : (uint64_t) integer);
+        set_field_buffer(fields[2], 0, uns_message);
+
+        char bin_message[69];
+        snprintf(bin_message, sizeof(bin_message), "Bin:");
+        for (int i = 0; i < 64; i++) {
+            snprintf(bin_message + i + 4, sizeof(bin_message) - i - 4, "%d", (bits & ((uint64_t) 1 << (63 - i))) != 0);
+        }
+        set_field_buffer(fields[3], 0, bin_message);
+
+        char hex_message[69];
+        if (result.type == TYPE_I128) {
+            snprintf(hex_message, sizeof(hex_message), "Hex:%08x`%08x`%08x`%08x",
+                    (uint32_t) (bits >> 96), (uint32_t) (bits >> 64), (uint32_t) (bits >> 32), (uint32_t) bits);
+        } else {
+            snprintf(hex_message, sizeof(hex_message), "Hex:%08x`%08x", (uint32_t) (bits >> 32), (uint32_t) bits);
+        }
+        set_field_buffer(fields[4], 0, hex_message);
+
+        char flt_message[69];
+        format_f64(flt_message, sizeof(flt_message), real);
+        set_field_buffer(fields[5], 0, flt_message);
+    }
+
+    pos_form_cursor(form);
+}
+
+// The input of a prompt recalled from a history, age inputs before the newest,
+// or -1 while the typed input is edited.
+//
+typedef struct {
+    history_t *history;
+    int age;
+    char *typed;
+} recall_t;
+
+// Replaces the input with an older one of the history on up, and a newer one
+// on down, back to the typed input. Returns 0 if the key is neither or there
+// is no history.
+//
 static int
-calculator_driver(int input, buffer_t *buffer, WINDOW *window, FORM *form, FIELD **fields)
+input_recall(int input, recall_t *recall, FORM *form, FIELD **fields)
 {
-    if (input_is_esc(input)) {
+    if (recall->history == NULL || (input != KEY_UP && input != KEY_DOWN)) {
         return 0;
     }
 
-    switch (input) {
-    case KEY_ENTER:
-    case '\x0a':
-        // Sychronize the field so we can get the buffer data.
-        //
+    int age = recall->age + (input == KEY_UP ? 1 : -1);
+    if (age < -1 || (age >= 0 && history_get(recall->history, age) == NULL)) {
+        return 1;
+    }
+
+    if (recall->age == -1) {
         form_driver(form, REQ_VALIDATION);
+        g_free(recall->typed);
+        recall->typed = g_strchomp(g_strdup(field_buffer(fields[0], 0)));
+    }
 
-        char *expression = field_buffer(fields[0], 0);
+    recall->age = age;
+    set_field_buffer(fields[0], 0, age == -1 ? recall->typed : history_get(recall->history, age));
+    form_driver(form, REQ_END_LINE);
+    return 1;
+}
 
-        // Evaluate the input. If an error occurs, zero out the result fields.
-        int64_t result;
-        if (calculator_eval(buffer, expression, &result) != 0) {
-            set_field_buffer(fields[1], 0, "Sig:0");
-            set_field_buffer(fields[2], 0, "Uns:0");
-            set_field_buffer(fields[3], 0, "Bin:0000000000000000000000000000000000000000000000000000000000000000");
-            set_field_buffer(fields[4], 0, "Hex:00000000`00000000");
-        } else {
-            char sig_message[69];
-            snprintf(sig_message, sizeof(sig_message), "Sig:%" PRId64, result);
-            set_field_buffer(fields[1], 0, sig_message);
-
-            char uns_message[69];
-            snprintf(uns_message, sizeof(uns_message), "Uns:%" PRIu64, result);
-            set_field_buffer(fields[2], 0, uns_message);
-
-            char bin_message[69];
-            snprintf(bin_message, sizeof(bin_message), "Bin:");
-            for (int i = 0; i < 64; i++) {
-                snprintf(bin_message + i + 4, sizeof(bin_message) - i - 4, "%d", (result & ((uint64_t) 1 << (63 - i))) != 0);
-            }
-            set_field_buffer(fields[3], 0, bin_message);
+// The result is updated as the expression is typed.
+//
+static int
+calculator_driver(int input, lexer_t *lexer, recall_t *recall, buffer_t *buffer, WINDOW *window, FORM *form,
+        FIELD **fields)
+{
+    if (input_is_esc(input)) {
+        return 0;
+    }
 
-            char hex_message[69];
-            snprintf(hex_message, sizeof(hex_message), "Hex:%08x`%08x",
-                    (uint32_t) ((result & 0xffffffff00000000) >> 32),
-                    (uint32_t) (result & 0x00000000ffffffff));
-            set_field_buffer(fields[4], 0, hex_message);
-        }
+    if (input_recall(input, recall, form, fields)) {
+        calculator_update(lexer, buffer, form, fields);
+        wrefresh(window);
+        return 1;
+    }
 
-        refresh();
-        pos_form_cursor(form);
+    switch (input) {
+    case KEY_ENTER:
+    case '\x0a':
+        form_driver(form, REQ_VALIDATION);
+        history_add(recall->history, field_buffer(fields[0], 0));
+        recall->age = -1;
         break;
     case KEY_LEFT:
         form_driver(form, REQ_PREV_CHAR);
@@ -167,12 +480,15 @@ calculator_driver(int input, buffer_t *buffer, WINDOW *window, FORM *form, FIELD
         break;
     }
 
+    calculator_update(lexer, buffer, form, fields);
+
+    refresh();
     wrefresh(window);
     return 1;
 }
 
 void
-prompt_calculator(buffer_t *buffer)
+prompt_calculator(buffer_t *buffer, history_t *history)
 {
     // Create a window to contain the calculator, factoring in the border sizes.
     // +2 for the vertical border, and +4 for the left and right padding on the
@@ -180,30 +496,34 @@ prompt_calculator(buffer_t *buffer)
     //
     int height, width;
     getmaxyx(stdscr, height, width);
-    WINDOW *window = newwin(5 + 2, 68 + 4, (height / 2) - (7 / 2), (width / 2) - (72 / 2));
+    WINDOW *window = newwin(6 + 2, 68 + 4, (height / 2) - (8 / 2), (width / 2) - (72 / 2));
     assert(window != NULL);
 
     render_border(window);
 
-    FIELD *fields[6];
+    FIELD *fields[7];
     fields[0] = new_field(1, 68, 0, 1, 0, 0);
     fields[1] = new_field(1, 68, 1, 1, 0, 0);
     fields[2] = new_field(1, 68, 2, 1, 0, 0);
     fields[3] = new_field(1, 68, 3, 1, 0, 0);
     fields[4] = new_field(1, 68, 4, 1, 0, 0);
-    fields[5] = NULL;
-    assert(fields[0] != NULL && fields[1] != NULL && fields[2] != NULL && fields[3] != NULL && fields[4] != NULL);
+    fields[5] = new_field(1, 68, 5, 1, 0, 0);
+    fields[6] = NULL;
+    assert(fields[0] != NULL && fields[1] != NULL && fields[2] != NULL && fields[3] != NULL && fields[4] != NULL
+            && fields[5] != NULL);
 
     set_field_buffer(fields[1], 0, "Sig:0");
     set_field_buffer(fields[2], 0, "Uns:0");
     set_field_buffer(fields[3], 0, "Bin:0000000000000000000000000000000000000000000000000000000000000000");
     set_field_buffer(fields[4], 0, "Hex:00000000`00000000");
+    set_field_buffer(fields[5], 0, "Flt:0");
 
     set_field_opts(fields[0], O_VISIBLE | O_PUBLIC | O_EDIT | O_ACTIVE);
     set_field_opts(fields[1], O_VISIBLE | O_PUBLIC | O_AUTOSKIP);
     set_field_opts(fields[2], O_VISIBLE | O_PUBLIC | O_AUTOSKIP);
     set_field_opts(fields[3], O_VISIBLE | O_PUBLIC | O_AUTOSKIP);
     set_field_opts(fields[4], O_VISIBLE | O_PUBLIC | O_AUTOSKIP);
+    set_field_opts(fields[5], O_VISIBLE | O_PUBLIC | O_AUTOSKIP);
 
     // Underline the field to indicate it can be edited.
     //
@@ -213,7 +533,7 @@ prompt_calculator(buffer_t *buffer)
     assert(form != NULL);
 
     set_form_win(form, window);
-    set_form_sub(form, derwin(window, 9 - 4, 72 - 2, 1, 1));
+    set_form_sub(form, derwin(window, 10 - 4, 72 - 2, 1, 1));
     post_form(form);
 
     // Draw the header for the dialog, and reset the cursor back to the input.
@@ -228,7 +548,11 @@ prompt_calculator(buffer_t *buffer)
     //
     curs_set(1);
 
-    while (calculator_driver(getch(), buffer, window, form, fields));
+    lexer_t lexer = {};
+    recall_t recall = { .history = history, .age = -1 };
+    while (calculator_driver(getch(), &lexer, &recall, buffer, window, form, fields));
+
+    g_free(recall.typed);
 
     // Restore the cursor state.
     //
@@ -241,6 +565,7 @@ prompt_calculator(buffer_t *buffer)
     free_field(fields[2]);
     free_field(fields[3]);
     free_field(fields[4]);
+    free_field(fields[5]);
     delwin(window);
 }
 
@@ -280,16 +605,42 @@ input_driver(int input, WINDOW *window, FORM *form, FIELD **fields)
     return 1;
 }
 
+// Calls the preview with the input, and draws the line it returns below the
+// input field.
+//
+static void
+input_preview(WINDOW *window, FORM *form, FIELD **fields, preview_t preview, void *user_data)
+{
+    form_driver(form, REQ_VALIDATION);
+
+    const char *line = preview(field_buffer(fields[0], 0), user_data);
+    mvwprintw(window, 2, 2, "%-68.68s", line != NULL ? line : "");
+
+    // The preview may have drawn over the dialog.
+    //
+    touchwin(window);
+    pos_form_cursor(form);
+    wrefresh(window);
+}
+
 size_t
 prompt_input(const char *title, const char *placeholder, char **user_input)
+{
+    return prompt_input_preview(title, placeholder, NULL, NULL, NULL, user_input);
+}
+
+size_t
+prompt_input_preview(const char *title, const char *placeholder, preview_t preview, void *user_data,
+        history_t *history, char **user_input)
 {
     // Create a window to contain the menu, factoring in the border sizes.
     // +2 for the vertical border, and +4 for the left and right padding on the
-    // horizontal border.
+    // horizontal border. The preview takes an extra line.
     //
+    int lines = preview != NULL ? 2 : 1;
     int height, width;
     getmaxyx(stdscr, height, width);
-    WINDOW *window = newwin(1 + 2, 68 + 4,  (height / 2) - (3 / 2), (width / 2) - (72 / 2));
+    WINDOW *window = newwin(lines + 2, 68 + 4,  (height / 2) - ((lines + 2) / 2), (width / 2) - (72 / 2));
     assert(window != NULL);
 
     render_border(window);
@@ -334,11 +685,23 @@ prompt_input(const char *title, const char *placeholder, char **user_input)
     //
     curs_set(1);
 
+    if (preview != NULL) {
+        input_preview(window, form, fields, preview, user_data);
+    }
+
+    recall_t recall = { .history = history, .age = -1 };
+
     int input;
     while ((input = getch()) && !input_is_esc(input)) {
-        if (input_driver(input, window, form, fields) == 0) {
+        if (input_recall(input, &recall, form, fields)) {
+            wrefresh(window);
+        } else if (input_driver(input, window, form, fields) == 0) {
             break;
         }
+
+        if (preview != NULL) {
+            input_preview(window, form, fields, preview, user_data);
+        }
     }
 
     // If ESC is pressed "cancel" the input request and set user_input to NULL.
@@ -353,6 +716,8 @@ prompt_input(const char *title, const char *placeholder, char **user_input)
         input_size = strlen(*user_input);
     }
 
+    g_free(recall.typed);
+
     // Restore the cursor state.
     //
     curs_set(0);
@@ -432,6 +797,10 @@ prompt_menu(const char *title, const char **options, size_t options_size, int re
     set_menu_format(menu, height, 1);
     post_menu(menu);
 
+    if (start_item < options_size) {
+        set_current_item(menu, items[start_item]);
+    }
+
     int start = window_width / 2 - (strlen(title) / 2);
     mvwprintw(window, 0, start - 1, " ");
     mvwprintw(window, 0, start, title);
@@ -462,7 +831,13 @@ prompt_menu(const char *title, const char **options, size_t options_size, int re
 void
 prompt_error(const char *message)
 {
-    assert(strlen(message) < 68);
+    prompt_message("Error", message);
+}
+
+void
+prompt_message(const char *title, const char *message)
+{
+    assert(strlen(message) < 68 && strlen(title) < 66);
 
     int height, width;
     getmaxyx(stdscr, height, width);
@@ -487,14 +862,14 @@ prompt_error(const char *message)
     set_form_sub(form, derwin(window, 1, 72 - 2, 1, 1));
     post_form(form);
 
-    mvwprintw(window, 0, 72 / 2 - ((sizeof(" Error ") - 1) / 2), " Error ");
+    mvwprintw(window, 0, 72 / 2 - (strlen(title) + 2) / 2, " %s ", title);
     wmove(window, 1, 2);
 
     refresh();
     wrefresh(window);
 
     int input;
-    while ((input = getch()) && !input_is_esc(input) && input != KEY_ENTER);
+    while ((input = getch()) && !input_is_esc(input) && input != KEY_ENTER && input != '\x0a');
 
     unpost_form(form);
     free_form(form);
@@ -9,6 +9,8 @@
 #include <wchar.h>
 
 #include "buffer.h"
+#include "history.h"
+#include "overview.h"
 
 // Thanks, ncurses.
 //
@@ -27,6 +29,12 @@ static const options_t EMPTY_OPT = {
 
 static const wchar_t *FILL_CHAR = L"▒";
 
+// Keys sent at the start and end of a bracketed paste, once render_paste_mode
+// enabled it.
+//
+#define KEY_PASTE (KEY_MAX + 1)
+#define KEY_PASTE_END (KEY_MAX + 2)
+
 enum {
     COLOR_STATUS = 1,
     COLOR_SELECTED,
@@ -38,15 +46,73 @@ enum {
     COLOR_BRIGHT_WHITE
 };
 
-void render_status(const char *path);
+// Fields shown in the status bar.
+//
+typedef struct {
+    const char *path;
+    cursor_t cursor;
+    // Number of selected bytes, 0 if there is no selection.
+    //
+    uint64_t selection;
+    // Name of the running background job, or NULL if there is none. The
+    // progress is in percent.
+    //
+    const char *job;
+    int job_progress;
+    // Time taken to draw the last frame, in microseconds.
+    //
+    int64_t frame_time;
+} status_t;
+
+// Draws the status bar, unless none of the displayed fields changed since it
+// was last drawn.
+//
+void render_status(const status_t *status);
+// Forces the next render_status to draw, must be called after the screen is
+// cleared.
+//
+void render_status_invalidate(void);
+// Returns a progress that shows the job in the status bar, once it has run for
+// longer than a frame. Only for operations on the UI thread.
+//
+progress_t render_progress(const char *job);
 void render_options(const options_t *options);
 void render_border(WINDOW *window);
+// Columns taken by the overview strip, including its separator.
+//
+#define OVERVIEW_WIDTH 3
+
+// Draws the overview strip at column x, one cell per row between the status and
+// options bars. The cell containing the cursor is highlighted, or the selected
+// row if it is not -1.
+//
+void render_overview(overview_t *overview, int x, int height, cursor_t cursor, int selected);
+// Clears the screen and draws a message in its centre.
+//
+void render_message(const char *message);
+// Asks the terminal to bracket pasted text with KEY_PASTE and KEY_PASTE_END,
+// if enable != 0, or to send it as typed.
+//
+void render_paste_mode(int enable);
+// Reads the text of a paste, after KEY_PASTE, up to KEY_PASTE_END. Returns
+// the text, which must be freed with g_free, and sets size.
+//
+char *input_paste(size_t *size);
 
 // Prompts the user for a message setting user_input which must be free'd.
 // user_input is set to NULL if the prompt is cancelled with ESC.
 // The state of the screen is UNDEFINED after this function returns.
 //
 size_t prompt_input(const char *title, const char *placeholder, char **user_input);
+// Called with the input of a prompt after every edit. Returns the line to show
+// below the input, or NULL.
+//
+typedef const char *(*preview_t)(const char *input, void *user_data);
+// As prompt_input, showing a preview of the input as it is typed. Up and down
+// recall the inputs of the history, if it is not NULL.
+//
+size_t prompt_input_preview(const char *title, const char *placeholder, preview_t preview, void *user_data,
+        history_t *history, char **user_input);
 // Prompts the user for a menu item returning the index into options.
 // The result is -1 if the prompt is cancelled with ESC.
 // The state of the screen is UNDEFINED after this function returns.
@@ -55,6 +121,10 @@ int prompt_menu(const char *title, const char **options, size_t options_size, in
 // after this function returns.
 //
 void prompt_error(const char *message);
+// Displays a message under a title, as prompt_error.
+//
+void prompt_message(const char *title, const char *message);
+// Up and down recall the inputs of the history, and enter adds the input to it.
 // The state of the screen is UNDEFINED after this function returns.
 //
-void prompt_calculator(buffer_t *buffer);
+void prompt_calculator(buffer_t *buffer, history_t *history);
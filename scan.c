@@ -0,0 +1,211 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "scan.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Appends the occurrences of the pattern starting in [first, last) to matches.
+// The bytes of the chunk are copied out once, with those of an occurrence
+// running past its end.
+//
+static void
+scan_pattern(scan_t *scan, uint64_t first, uint64_t last, GArray *matches)
+{
+    uint64_t end = MIN(last + scan->pattern_size - 1, scan->end);
+    if (end - first < scan->pattern_size) {
+        return;
+    }
+
+    uint8_t *data = g_malloc(end - first);
+    if (buffer_read_at(scan->buffer, first, data, end - first) == 0) {
+        const uint8_t *found = data;
+        while (!g_atomic_int_get(&scan->cancel)
+                && (found = memmem(found, data + (end - first) - found, scan->pattern, scan->pattern_size)) != NULL
+                && found < data + (last - first)) {
+            uint64_t offset = first + (found - data);
+            g_array_append_val(matches, offset);
+            found++;
+        }
+    }
+
+    g_free(data);
+}
+
+// Stores the matches of a chunk. Once the chunks evaluated in order from the
+// first hold more than limit matches, those after them are skipped.
+//
+static void
+scan_finish(scan_t *scan, uint64_t chunk, GArray *matches)
+{
+    g_mutex_lock(&scan->lock);
+
+    scan->chunks[chunk] = matches;
+    while (scan->ordered < scan->chunks_size && scan->chunks[scan->ordered] != NULL) {
+        scan->ordered_matches += scan->chunks[scan->ordered++]->len;
+        if (scan->ordered_matches > (uint64_t) scan->limit) {
+            scan->cutoff = MIN(scan->cutoff, scan->ordered);
+        }
+    }
+
+    g_mutex_unlock(&scan->lock);
+    g_atomic_int_inc(&scan->done);
+}
+
+static void
+scan_worker(gpointer data, gpointer user_data)
+{
+    scan_t *scan = (scan_t*) user_data;
+    buffer_t *buffer = scan->buffer;
+    uint64_t chunk = GPOINTER_TO_SIZE(data) - 1;
+
+    uint64_t first = scan->start + chunk * SCAN_CHUNK_SIZE;
+    uint64_t last = MIN(first + SCAN_CHUNK_SIZE, scan->end);
+
+    GArray *matches = g_array_new(FALSE, FALSE, sizeof(uint64_t));
+
+    // Every match of a chunk skipped would be dropped.
+    //
+    g_mutex_lock(&scan->lock);
+    int skipped = chunk >= scan->cutoff;
+    g_mutex_unlock(&scan->lock);
+
+    if (skipped) {
+        scan_finish(scan, chunk, matches);
+        return;
+    }
+
+    // The buffer may be remapped by the UI thread between chunks.
+    //
+    g_rw_lock_reader_lock(&buffer->lock);
+
+    if (scan->pattern_size != 0) {
+        scan_pattern(scan, first, last, matches);
+    } else {
+        for (uint64_t offset = first; offset < last && !g_atomic_int_get(&scan->cancel); offset += scan->alignment) {
+            int64_t result;
+            if (calculator_run(&scan->program, buffer, offset, NULL, &result) || result == 0) {
+                continue;
+            }
+
+            g_array_append_val(matches, offset);
+            if (matches->len > (guint) scan->limit) {
+                break;
+            }
+        }
+    }
+
+    g_rw_lock_reader_unlock(&buffer->lock);
+    scan_finish(scan, chunk, matches);
+}
+
+// Queues the chunks of the range to a new thread pool.
+//
+static scan_t*
+scan_run(scan_t *scan, buffer_t *buffer, uint64_t address, uint64_t size, int alignment)
+{
+    scan->buffer = buffer;
+    scan->alignment = alignment;
+
+    // Round the start up to the alignment.
+    //
+    scan->start = (address + alignment - 1) & ~((uint64_t) alignment - 1);
+    scan->end = address + size;
+    if (scan->start < scan->end) {
+        scan->chunks_size = (scan->end - scan->start + SCAN_CHUNK_SIZE - 1) / SCAN_CHUNK_SIZE;
+    }
+
+    scan->chunks = g_malloc0(scan->chunks_size * sizeof(GArray*));
+    scan->cutoff = scan->chunks_size;
+    g_mutex_init(&scan->lock);
+    scan->pool = g_thread_pool_new(scan_worker, scan, g_get_num_processors(), FALSE, NULL);
+
+    // Tasks are queued in order, so that the chunks skipped once enough
+    // matches are found are the last. The task data is offset by one, as NULL
+    // cannot be queued.
+    //
+    for (uint64_t i = 0; i < scan->chunks_size; i++) {
+        g_thread_pool_push(scan->pool, GSIZE_TO_POINTER(i + 1), NULL);
+    }
+
+    return scan;
+}
+
+scan_t*
+scan_start(buffer_t *buffer, const program_t *program, uint64_t address, uint64_t size, int alignment)
+{
+    scan_t *scan = g_malloc0(sizeof(scan_t));
+    scan->program = *program;
+    scan->limit = SCAN_MAX_MATCHES;
+    return scan_run(scan, buffer, address, size, alignment);
+}
+
+scan_t*
+scan_start_pattern(buffer_t *buffer, const uint8_t *pattern, size_t pattern_size, uint64_t address,
+        uint64_t size)
+{
+    scan_t *scan = g_malloc0(sizeof(scan_t));
+    scan->pattern = g_malloc(pattern_size);
+    memcpy(scan->pattern, pattern, pattern_size);
+    scan->pattern_size = pattern_size;
+    scan->limit = G_MAXINT;
+    return scan_run(scan, buffer, address, size, 1);
+}
+
+void
+scan_stop(scan_t *scan)
+{
+    g_atomic_int_set(&scan->cancel, 1);
+    g_thread_pool_free(scan->pool, TRUE, TRUE);
+
+    for (uint64_t i = 0; i < scan->chunks_size; i++) {
+        if (scan->chunks[i] != NULL) {
+            g_array_free(scan->chunks[i], TRUE);
+        }
+    }
+
+    if (scan->matches != NULL) {
+        g_array_free(scan->matches, TRUE);
+    }
+
+    g_mutex_clear(&scan->lock);
+    g_free(scan->chunks);
+    g_free(scan->pattern);
+    g_free(scan);
+}
+
+int
+scan_progress(scan_t *scan)
+{
+    if (scan->chunks_size == 0) {
+        return 100;
+    }
+
+    return (int) ((uint64_t) g_atomic_int_get(&scan->done) * 100 / scan->chunks_size);
+}
+
+GArray*
+scan_matches(scan_t *scan, int *truncated)
+{
+    assert(scan_progress(scan) == 100);
+
+    if (scan->matches == NULL) {
+        scan->matches = g_array_new(FALSE, FALSE, sizeof(uint64_t));
+
+        for (uint64_t i = 0; i < scan->chunks_size && scan->matches->len <= (guint) scan->limit; i++) {
+            g_array_append_vals(scan->matches, scan->chunks[i]->data, scan->chunks[i]->len);
+        }
+
+        scan->truncated = scan->matches->len > (guint) scan->limit;
+        if (scan->truncated) {
+            g_array_set_size(scan->matches, scan->limit);
+        }
+    }
+
+    *truncated = scan->truncated;
+    return scan->matches;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdint.h>
+#include <gmodule.h>
+
+#include "buffer.h"
+#include "calc.h"
+
+// Offsets evaluated by each task of the thread pool. A multiple of every
+// alignment.
+//
+#define SCAN_CHUNK_SIZE (1024 * 1024)
+// Matches kept by a search for a program, further matches are dropped.
+//
+#define SCAN_MAX_MATCHES 4096
+
+// Search for the offsets of a range where a program evaluates to non-zero,
+// with the cursor set to each offset, or where a pattern of bytes occurs. The
+// range is split into chunks that are evaluated by a thread pool, each into
+// its own list of matches.
+//
+typedef struct {
+    buffer_t *buffer;
+    program_t program;
+    // The bytes searched for instead, if pattern_size != 0.
+    //
+    uint8_t *pattern;
+    size_t pattern_size;
+    // First offset, end of the range, and the step between offsets.
+    //
+    uint64_t start;
+    uint64_t end;
+    int alignment;
+
+    GThreadPool *pool;
+    GArray **chunks;
+    uint64_t chunks_size;
+    // The matches merged from the chunks, and if != 0, matches were dropped.
+    //
+    GArray *matches;
+    int truncated;
+    // Matches kept, the first in order, further matches are dropped. Chunks
+    // finish in any order, so each keeps one more than limit of its own, and
+    // they are cut to limit once merged.
+    //
+    gint limit;
+    // Guards the number of chunks evaluated in order from the first, and of
+    // their matches, and the first chunk skipped: those before it already
+    // hold more than limit matches.
+    //
+    GMutex lock;
+    uint64_t ordered;
+    uint64_t ordered_matches;
+    uint64_t cutoff;
+    // Number of chunks evaluated so far, and if != 0, the tasks should stop.
+    // Both are accessed atomically.
+    //
+    gint done;
+    gint cancel;
+} scan_t;
+
+// Starts evaluating the program at every offset of the range that is a multiple
+// of alignment, a power of two. The buffer MUST outlive the scan.
+//
+scan_t *scan_start(buffer_t *buffer, const program_t *program, uint64_t address, uint64_t size, int alignment);
+// Starts searching for every occurrence of a pattern within the range,
+// overlapping ones included. Every match is kept.
+//
+scan_t *scan_start_pattern(buffer_t *buffer, const uint8_t *pattern, size_t pattern_size, uint64_t address,
+        uint64_t size);
+// Stops the thread pool and frees the scan.
+//
+void scan_stop(scan_t *scan);
+// Returns the percentage of the range evaluated so far.
+//
+int scan_progress(scan_t *scan);
+// Returns the matching offsets in ascending order, once progress is 100. Sets
+// truncated if matches were dropped.
+//
+GArray *scan_matches(scan_t *scan, int *truncated);
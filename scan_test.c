@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "buffer.h"
+#include "calc.h"
+#include "scan.h"
+
+int
+main(int argc, char *argv[])
+{
+    // A scan with more than SCAN_MAX_MATCHES matches keeps the first, in
+    // whatever order its chunks finish.
+    //
+    {
+        size_t size = 16 * SCAN_CHUNK_SIZE;
+        uint8_t *data = g_malloc0(size);
+
+        buffer_t scanned;
+        buffer_from_data(&scanned, data, size);
+
+        program_t every;
+        assert(calculator_compile(&scanned, "@b == 0", &every) == 0);
+
+        scan_t *scan = scan_start(&scanned, &every, 3, size - 3, 2);
+        while (scan_progress(scan) < 100) {
+            usleep(1000);
+        }
+
+        int truncated;
+        GArray *matches = scan_matches(scan, &truncated);
+        assert(truncated && matches->len == SCAN_MAX_MATCHES);
+        for (guint i = 0; i < matches->len; i++) {
+            assert(g_array_index(matches, uint64_t, i) == 4 + 2 * i);
+        }
+
+        scan_stop(scan);
+
+        // Matches in every chunk, fewer than the limit, are all kept.
+        //
+        for (size_t i = 0; i < size; i += 8192) {
+            data[i] = 1;
+        }
+
+        buffer_close(&scanned);
+        buffer_from_data(&scanned, data, size);
+
+        program_t ones;
+        assert(calculator_compile(&scanned, "@b == 1", &ones) == 0);
+
+        scan = scan_start(&scanned, &ones, 0, size, 1);
+        while (scan_progress(scan) < 100) {
+            usleep(1000);
+        }
+
+        matches = scan_matches(scan, &truncated);
+        assert(!truncated && matches->len == size / 8192);
+        for (guint i = 0; i < matches->len; i++) {
+            assert(g_array_index(matches, uint64_t, i) == 8192 * i);
+        }
+
+        scan_stop(scan);
+        buffer_close(&scanned);
+        g_free(data);
+    }
+
+    // Every occurrence of a pattern found by a scan, across chunks too, is
+    // replaced as one edit whatever the size of the replacement.
+    //
+    {
+        size_t size = 3 * SCAN_CHUNK_SIZE;
+        uint8_t *data = g_malloc0(size);
+        const uint8_t pattern[] = { 0xde, 0xad, 0xbe, 0xef };
+        size_t occurrences = 2;
+        for (size_t i = 500; i + sizeof(pattern) <= size; i += 1000) {
+            memcpy(data + i, pattern, sizeof(pattern));
+            occurrences++;
+        }
+        memcpy(data + SCAN_CHUNK_SIZE - 2, pattern, sizeof(pattern));
+        memcpy(data + 2 * SCAN_CHUNK_SIZE - 1, pattern, sizeof(pattern));
+
+        buffer_t replaced;
+        buffer_from_data(&replaced, data, size);
+
+        scan_t *scan = scan_start_pattern(&replaced, pattern, sizeof(pattern), 0, size);
+        while (scan_progress(scan) < 100) {
+            usleep(1000);
+        }
+
+        int truncated;
+        GArray *matches = scan_matches(scan, &truncated);
+        assert(!truncated && matches->len == occurrences);
+
+        const uint8_t replacement[] = { 'h', 'x' };
+        size_t count;
+        assert(buffer_replace(&replaced, (const uint64_t*) matches->data, matches->len, sizeof(pattern),
+                    replacement, sizeof(replacement), &count) == 0);
+        assert(count == matches->len && replaced.undo->len == 1);
+        assert(replaced.size == size - count * 2);
+
+        uint8_t *expected = g_malloc(size);
+        size_t expected_size = 0;
+        for (size_t i = 0; i < size;) {
+            if (i + sizeof(pattern) <= size && memcmp(data + i, pattern, sizeof(pattern)) == 0) {
+                memcpy(expected + expected_size, replacement, sizeof(replacement));
+                expected_size += sizeof(replacement);
+                i += sizeof(pattern);
+            } else {
+                expected[expected_size++] = data[i++];
+            }
+        }
+
+        uint8_t *actual = g_malloc(size);
+        assert(expected_size == replaced.size);
+        assert(buffer_read_at(&replaced, 0, actual, replaced.size) == 0);
+        assert(memcmp(actual, expected, expected_size) == 0);
+
+        uint64_t address;
+        assert(buffer_undo(&replaced, &address) == 0 && replaced.size == size);
+        assert(buffer_read_at(&replaced, 0, actual, size) == 0 && memcmp(actual, data, size) == 0);
+        scan_stop(scan);
+
+        // Overlapping occurrences are replaced once, of the same size in
+        // place.
+        //
+        const uint64_t overlapping[] = { 10, 11, 20 };
+        assert(buffer_replace(&replaced, overlapping, 3, 2, replacement, 2, &count) == 0 && count == 2);
+        assert(replaced.size == size && replaced.edit_end[(replaced.edits - 1) % BUFFER_EDITS] == 22);
+        assert(buffer_replace(&replaced, overlapping, 3, size, NULL, 0, &count) != 0);
+        assert(buffer_replace(&replaced, (const uint64_t[]) { 0 }, 1, size, NULL, 0, &count) != 0);
+
+        buffer_close(&replaced);
+        g_free(actual);
+        g_free(expected);
+        g_free(data);
+    }
+
+    return 0;
+}